@@ -0,0 +1,1033 @@
+
+#ifndef CONCURRENT_HASHMAP_H
+#define CONCURRENT_HASHMAP_H
+
+/* A thread safe hash map built out of several independent HashMaps ("shards").
+*  Every key belongs to exactly one shard (picked from its hash), and every shard has its own reader-writer lock, so threads
+*  working on different shards never wait for each other and readers of the same shard run in parallel.
+*  Each shard grows and shrinks on its own, so a resize only blocks the keys of one shard.
+*  The functions mirror the hash_table_* ones. Lookups copy the value out because an Entry can move or be freed as soon as
+*  the shard is unlocked. Link with -pthread
+*
+*  Maps that are read far more often than written can be created with concurrent_hash_table_create_lock_free_reads()
+*  instead: lookups then take no lock at all (see LOCK-FREE READS below)
+*
+*  hash_table_parallel_batch_insert() and hash_table_parallel_resize() use several threads to build or rehash one
+*  ordinary (single threaded) HashMap
+*
+*  The definitions are compiled in with those of hashmap.h, where HASHMAP_IMPLEMENTATION is defined (see hashmap.h)
+*/
+
+#include <pthread.h> // reader-writer locks
+#include <stdatomic.h> // atomic loads/stores for the lock-free read path
+#include <sched.h> // sched_yield while waiting for readers
+#include "hashmap.h"
+
+#define CONCURRENT_SHARD_ALIGNMENT 64 // shards are padded to a cache line so their locks do not share one
+#define EPOCH_READER_STRIPES 64 // readers of a lock-free map announce themselves in one of this many padded counters
+#define LOCK_FREE_RETIRE_BATCH 64 // retired entries a lock-free shard collects before waiting for a grace period to free them
+
+// an entry of a lock-free shard. Everything except next is immutable once the entry is published
+typedef struct Lock_free_entry {
+    Key key;
+    Value value;
+    size_t hash; // mixed hash of the key
+    _Atomic(struct Lock_free_entry *) next;
+    struct Lock_free_entry *retired_next; // link in the shard's retired list
+    bool owns_strings; // false for the old copy of an entry moved by a resize (the new copy took over its strings)
+} Lock_free_entry;
+
+// the bucket array of a lock-free shard, replaced as a whole on resize
+typedef struct Lock_free_buckets {
+    size_t bucket_count; // always a power of 2
+    struct Lock_free_buckets *retired_next; // link in the shard's retired list
+    _Atomic(Lock_free_entry *) heads[];
+} Lock_free_buckets;
+
+// counts the readers inside a read section, per epoch parity
+typedef struct {
+    _Alignas(CONCURRENT_SHARD_ALIGNMENT) atomic_size_t active[2];
+} Epoch_reader_stripe;
+
+// one shard and the lock(s) protecting it. Only the fields of the map's mode are used
+typedef struct {
+    _Alignas(CONCURRENT_SHARD_ALIGNMENT) pthread_rwlock_t lock; // locked mode: protects map
+    HashMap *map; // locked mode
+    pthread_mutex_t write_lock; // lock-free reads mode: serializes writers, readers never take it
+    _Atomic(Lock_free_buckets *) table; // lock-free reads mode
+    atomic_size_t key_count; // lock-free reads mode
+    Lock_free_entry *retired_entries; // unlinked entries waiting for a grace period (lock-free reads mode)
+    size_t retired_count; // length of retired_entries
+    Lock_free_buckets *retired_buckets; // replaced bucket arrays waiting for a grace period (lock-free reads mode)
+} Concurrent_shard;
+
+// ConcurrentHashMap structure definition
+typedef struct {
+    Concurrent_shard *shards; // shard_count shards
+    size_t shard_count; // always a power of 2
+    DATA_TYPE key_type; // the type of key every shard uses (see enum)
+    Key_ops key_ops; // used to pick the shard of a key (and to find keys in lock-free shards)
+    bool lock_free_reads; // lookups use atomic loads and epochs instead of the shard locks
+    atomic_size_t epoch; // bumped by every grace period (lock-free reads mode)
+    pthread_mutex_t epoch_lock; // one grace period at a time (lock-free reads mode)
+    Epoch_reader_stripe *reader_stripes; // EPOCH_READER_STRIPES counters (lock-free reads mode)
+} ConcurrentHashMap;
+
+/* THE API (each function is documented at its definition below) */
+
+ConcurrentHashMap *concurrent_hash_table_create_with_options(size_t desired_size, DATA_TYPE key_type, size_t shard_count, const HashMap_options *options);
+ConcurrentHashMap *concurrent_hash_table_create(size_t desired_size, DATA_TYPE key_type, size_t shard_count);
+ConcurrentHashMap *concurrent_hash_table_create_lock_free_reads(size_t desired_size, DATA_TYPE key_type, size_t shard_count);
+bool concurrent_hash_table_insert(ConcurrentHashMap *map, const Key *key, const Value *value);
+bool concurrent_hash_table_lookup(ConcurrentHashMap *map, const Key *key, Value *value_out);
+bool concurrent_hash_table_contains(ConcurrentHashMap *map, const Key *key);
+bool concurrent_hash_table_entry_delete(ConcurrentHashMap *map, const Key *key_to_delete);
+size_t concurrent_hash_table_key_count(ConcurrentHashMap *map);
+bool concurrent_hash_table_clear(ConcurrentHashMap *map);
+bool concurrent_hash_table_destroy(ConcurrentHashMap **map);
+bool hash_table_parallel_resize(HashMap *map, size_t new_buckets_count, size_t thread_count);
+bool hash_table_parallel_batch_insert(HashMap *map, void *array_of_keys, void *array_of_values, size_t number_of_elements, const DATA_TYPE key_type, const DATA_TYPE value_type, size_t thread_count);
+
+#endif /* CONCURRENT_HASHMAP_H */
+
+#if defined(HASHMAP_IMPLEMENTATION) && !defined(CONCURRENT_HASHMAP_IMPLEMENTATION_INCLUDED)
+#define CONCURRENT_HASHMAP_IMPLEMENTATION_INCLUDED
+
+// the shard a hash belongs to. Uses the high bits of the mixed hash so it does not correlate with the bucket index inside the shard
+static Concurrent_shard *concurrent_shard_for_hash(const ConcurrentHashMap *map, size_t mixed_hash) {
+    size_t shard_index = (mixed_hash >> (sizeof(size_t) * 4)) & (map->shard_count - 1);
+    return &(map->shards[shard_index]);
+}
+
+/* LOCK-FREE READS
+*  Each shard is a chained table that readers walk with atomic loads only. Writers of a shard are serialized by its mutex and
+*  never change anything a reader may be looking at: new entries are fully built before being linked in, a replaced value
+*  gets a whole new entry, and resizes copy every entry into a new bucket array before publishing it.
+*  Unlinked entries and bucket arrays are retired and only freed after a grace period: the global epoch is bumped and the
+*  writer waits until no reader that started in the previous epoch is still inside its read section
+*/
+
+static atomic_size_t epoch_next_reader_stripe; // hands out stripes to threads round robin
+static _Thread_local size_t epoch_reader_stripe_index = SIZE_MAX; // the stripe of the calling thread, SIZE_MAX until first use
+
+// starts a read section. Returns the epoch it belongs to, which must be passed to epoch_read_unlock()
+static size_t epoch_read_lock(ConcurrentHashMap *map) {
+    if (epoch_reader_stripe_index == SIZE_MAX) {
+        epoch_reader_stripe_index = atomic_fetch_add_explicit(&epoch_next_reader_stripe, 1, memory_order_relaxed) % EPOCH_READER_STRIPES;
+    }
+    Epoch_reader_stripe *stripe = &(map->reader_stripes[epoch_reader_stripe_index]);
+    for (;;) {
+        size_t epoch = atomic_load(&(map->epoch));
+        atomic_fetch_add(&(stripe->active[epoch & 1]), 1);
+        // if a grace period started in between it may already have checked this stripe, so announce again in the new epoch
+        if (atomic_load(&(map->epoch)) == epoch) {
+            return epoch;
+        }
+        atomic_fetch_sub(&(stripe->active[epoch & 1]), 1);
+    }
+}
+
+static void epoch_read_unlock(ConcurrentHashMap *map, size_t epoch) {
+    atomic_fetch_sub_explicit(&(map->reader_stripes[epoch_reader_stripe_index].active[epoch & 1]), 1, memory_order_release);
+}
+
+// waits until no reader can still see anything that was unlinked before this call
+static void epoch_wait_for_readers(ConcurrentHashMap *map) {
+    pthread_mutex_lock(&(map->epoch_lock));
+    size_t epoch = atomic_load(&(map->epoch));
+    atomic_store(&(map->epoch), epoch + 1);
+    for (size_t i = 0; i < EPOCH_READER_STRIPES; i++) {
+        while (atomic_load(&(map->reader_stripes[i].active[epoch & 1])) != 0) {
+            sched_yield();
+        }
+    }
+    pthread_mutex_unlock(&(map->epoch_lock));
+}
+
+// copies key or value data the shard will own (strings and byte strings are duplicated). True on success, else false
+static bool lock_free_copy_data(DATA_TYPE type, Data *destination, const Data *source) {
+    if (!duplicate_data(type, destination, source)) {
+        perror("strdup failed for lock-free shard string data!\n");
+        return false;
+    }
+    return true;
+}
+
+// a new, not yet published entry holding copies of the key and value. NULL on failure
+static Lock_free_entry *lock_free_new_entry(const Key *key, const Value *value, size_t hash) {
+    Lock_free_entry *entry = malloc(sizeof(Lock_free_entry));
+    if (entry == NULL) {
+        perror("Could not malloc a new entry for a lock-free shard!\n");
+        return NULL;
+    }
+    entry->key.type = key->type;
+    entry->value.type = value->type;
+    if (!lock_free_copy_data(key->type, &(entry->key.data), &(key->data))) {
+        free(entry);
+        return NULL;
+    }
+    if (!lock_free_copy_data(value->type, &(entry->value.data), &(value->data))) {
+        free_data(key->type, entry->key.data);
+        free(entry);
+        return NULL;
+    }
+    entry->hash = hash;
+    entry->retired_next = NULL;
+    entry->owns_strings = true;
+    atomic_init(&(entry->next), NULL);
+    return entry;
+}
+
+static void lock_free_free_entry(Lock_free_entry *entry) {
+    if (entry->owns_strings) {
+        free_data(entry->key.type, entry->key.data);
+        free_data(entry->value.type, entry->value.data);
+    }
+    free(entry);
+}
+
+// an empty bucket array (bucket_count must be a power of 2). NULL on failure
+static Lock_free_buckets *lock_free_new_buckets(size_t bucket_count) {
+    Lock_free_buckets *buckets = malloc(sizeof(Lock_free_buckets) + bucket_count * sizeof(_Atomic(Lock_free_entry *)));
+    if (buckets == NULL) {
+        perror("Could not malloc the bucket array of a lock-free shard!\n");
+        return NULL;
+    }
+    buckets->bucket_count = bucket_count;
+    buckets->retired_next = NULL;
+    for (size_t i = 0; i < bucket_count; i++) {
+        atomic_init(&(buckets->heads[i]), NULL);
+    }
+    return buckets;
+}
+
+// frees everything the shard retired. Only call after a grace period (or when no reader can exist anymore)
+static void lock_free_free_retired(Concurrent_shard *shard) {
+    while (shard->retired_entries != NULL) {
+        Lock_free_entry *next = shard->retired_entries->retired_next;
+        lock_free_free_entry(shard->retired_entries);
+        shard->retired_entries = next;
+    }
+    while (shard->retired_buckets != NULL) {
+        Lock_free_buckets *next = shard->retired_buckets->retired_next;
+        free(shard->retired_buckets);
+        shard->retired_buckets = next;
+    }
+    shard->retired_count = 0;
+}
+
+// waits for a grace period and frees the retired memory of a shard. The shard's write lock must be held
+static void lock_free_reclaim(ConcurrentHashMap *map, Concurrent_shard *shard) {
+    if (shard->retired_entries == NULL && shard->retired_buckets == NULL) {
+        return;
+    }
+    epoch_wait_for_readers(map);
+    lock_free_free_retired(shard);
+}
+
+// hands an unlinked entry over to the reclaimer. The shard's write lock must be held
+static void lock_free_retire_entry(ConcurrentHashMap *map, Concurrent_shard *shard, Lock_free_entry *entry) {
+    entry->retired_next = shard->retired_entries;
+    shard->retired_entries = entry;
+    if (++(shard->retired_count) >= LOCK_FREE_RETIRE_BATCH) {
+        lock_free_reclaim(map, shard);
+    }
+}
+
+// the link (bucket head or previous entry's next) pointing at the key's entry, or NULL. The shard's write lock must be held
+static _Atomic(Lock_free_entry *) *lock_free_find_link(const ConcurrentHashMap *map, Lock_free_buckets *buckets, const Key *key, size_t hash) {
+    _Atomic(Lock_free_entry *) *link = &(buckets->heads[hash & (buckets->bucket_count - 1)]);
+    for (Lock_free_entry *entry = atomic_load_explicit(link, memory_order_relaxed); entry != NULL;
+         entry = atomic_load_explicit(link, memory_order_relaxed)) {
+        if (entry->hash == hash && map->key_ops.cmp_func(&(entry->key), key) == 0) {
+            return link;
+        }
+        link = &(entry->next);
+    }
+    return NULL;
+}
+
+/* publishes a copy of the shard with twice the buckets. Entries are copied instead of relinked because readers may still be
+   walking the old chains. The shard's write lock must be held. A failed allocation just keeps the old (fuller) table */
+static void lock_free_grow(ConcurrentHashMap *map, Concurrent_shard *shard) {
+    Lock_free_buckets *old_buckets = atomic_load_explicit(&(shard->table), memory_order_relaxed);
+    Lock_free_buckets *new_buckets = lock_free_new_buckets(old_buckets->bucket_count * 2);
+    if (new_buckets == NULL) {
+        return;
+    }
+    for (size_t i = 0; i < old_buckets->bucket_count; i++) {
+        for (Lock_free_entry *entry = atomic_load_explicit(&(old_buckets->heads[i]), memory_order_relaxed); entry != NULL;
+             entry = atomic_load_explicit(&(entry->next), memory_order_relaxed)) {
+            Lock_free_entry *copy = malloc(sizeof(Lock_free_entry));
+            if (copy == NULL) {
+                perror("Could not malloc an entry copy while growing a lock-free shard!\n");
+                // undo the copies (the strings still belong to the old entries)
+                for (size_t j = 0; j < new_buckets->bucket_count; j++) {
+                    Lock_free_entry *current = atomic_load_explicit(&(new_buckets->heads[j]), memory_order_relaxed);
+                    while (current != NULL) {
+                        Lock_free_entry *next = atomic_load_explicit(&(current->next), memory_order_relaxed);
+                        free(current);
+                        current = next;
+                    }
+                }
+                free(new_buckets);
+                return;
+            }
+            *copy = (Lock_free_entry){.key = entry->key, .value = entry->value, .hash = entry->hash, .owns_strings = true};
+            _Atomic(Lock_free_entry *) *head = &(new_buckets->heads[entry->hash & (new_buckets->bucket_count - 1)]);
+            atomic_init(&(copy->next), atomic_load_explicit(head, memory_order_relaxed));
+            atomic_store_explicit(head, copy, memory_order_relaxed);
+        }
+    }
+    atomic_store_explicit(&(shard->table), new_buckets, memory_order_release);
+    // the old entries and array stay readable until the grace period is over, their strings now belong to the copies
+    for (size_t i = 0; i < old_buckets->bucket_count; i++) {
+        Lock_free_entry *entry = atomic_load_explicit(&(old_buckets->heads[i]), memory_order_relaxed);
+        while (entry != NULL) {
+            Lock_free_entry *next = atomic_load_explicit(&(entry->next), memory_order_relaxed);
+            entry->owns_strings = false;
+            entry->retired_next = shard->retired_entries;
+            shard->retired_entries = entry;
+            entry = next;
+        }
+    }
+    old_buckets->retired_next = shard->retired_buckets;
+    shard->retired_buckets = old_buckets;
+    lock_free_reclaim(map, shard);
+}
+
+static bool lock_free_insert(ConcurrentHashMap *map, Concurrent_shard *shard, const Key *key, const Value *value, size_t hash) {
+    Lock_free_entry *new_entry = lock_free_new_entry(key, value, hash);
+    if (new_entry == NULL) {
+        return false;
+    }
+    pthread_mutex_lock(&(shard->write_lock));
+    Lock_free_buckets *buckets = atomic_load_explicit(&(shard->table), memory_order_relaxed);
+    _Atomic(Lock_free_entry *) *link = lock_free_find_link(map, buckets, key, hash);
+    if (link != NULL) {
+        // replace the whole entry so readers see either the old or the new value, never a half written one
+        Lock_free_entry *old_entry = atomic_load_explicit(link, memory_order_relaxed);
+        atomic_init(&(new_entry->next), atomic_load_explicit(&(old_entry->next), memory_order_relaxed));
+        atomic_store_explicit(link, new_entry, memory_order_release);
+        lock_free_retire_entry(map, shard, old_entry);
+    } else {
+        _Atomic(Lock_free_entry *) *head = &(buckets->heads[hash & (buckets->bucket_count - 1)]);
+        atomic_init(&(new_entry->next), atomic_load_explicit(head, memory_order_relaxed));
+        atomic_store_explicit(head, new_entry, memory_order_release);
+        size_t key_count = atomic_load_explicit(&(shard->key_count), memory_order_relaxed) + 1;
+        atomic_store_explicit(&(shard->key_count), key_count, memory_order_relaxed);
+        if (key_count > buckets->bucket_count * MAX_LOAD_FACTOR) {
+            lock_free_grow(map, shard);
+        }
+    }
+    pthread_mutex_unlock(&(shard->write_lock));
+    return true;
+}
+
+// the key's entry or NULL. Must be called inside a read section, and the entry is only valid until it ends
+static const Lock_free_entry *lock_free_lookup(const ConcurrentHashMap *map, Concurrent_shard *shard, const Key *key, size_t hash) {
+    Lock_free_buckets *buckets = atomic_load_explicit(&(shard->table), memory_order_acquire);
+    const Lock_free_entry *entry = atomic_load_explicit(&(buckets->heads[hash & (buckets->bucket_count - 1)]), memory_order_acquire);
+    for (; entry != NULL; entry = atomic_load_explicit(&(entry->next), memory_order_acquire)) {
+        if (entry->hash == hash && map->key_ops.cmp_func(&(entry->key), key) == 0) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+// lock-free shards only grow, a map that is mostly read is not expected to shrink much
+static bool lock_free_remove(ConcurrentHashMap *map, Concurrent_shard *shard, const Key *key, size_t hash) {
+    pthread_mutex_lock(&(shard->write_lock));
+    Lock_free_buckets *buckets = atomic_load_explicit(&(shard->table), memory_order_relaxed);
+    _Atomic(Lock_free_entry *) *link = lock_free_find_link(map, buckets, key, hash);
+    if (link == NULL) {
+        pthread_mutex_unlock(&(shard->write_lock));
+        return false;
+    }
+    Lock_free_entry *entry = atomic_load_explicit(link, memory_order_relaxed);
+    // readers already on this entry can still follow its next pointer, which is left untouched
+    atomic_store_explicit(link, atomic_load_explicit(&(entry->next), memory_order_relaxed), memory_order_release);
+    atomic_fetch_sub_explicit(&(shard->key_count), 1, memory_order_relaxed);
+    lock_free_retire_entry(map, shard, entry);
+    pthread_mutex_unlock(&(shard->write_lock));
+    return true;
+}
+
+// publishes an empty bucket array of the same size and retires every entry. False if the new array cannot be allocated
+static bool lock_free_clear(ConcurrentHashMap *map, Concurrent_shard *shard) {
+    pthread_mutex_lock(&(shard->write_lock));
+    Lock_free_buckets *old_buckets = atomic_load_explicit(&(shard->table), memory_order_relaxed);
+    Lock_free_buckets *new_buckets = lock_free_new_buckets(old_buckets->bucket_count);
+    if (new_buckets == NULL) {
+        pthread_mutex_unlock(&(shard->write_lock));
+        return false;
+    }
+    atomic_store_explicit(&(shard->table), new_buckets, memory_order_release);
+    for (size_t i = 0; i < old_buckets->bucket_count; i++) {
+        Lock_free_entry *entry = atomic_load_explicit(&(old_buckets->heads[i]), memory_order_relaxed);
+        while (entry != NULL) {
+            Lock_free_entry *next = atomic_load_explicit(&(entry->next), memory_order_relaxed);
+            entry->retired_next = shard->retired_entries;
+            shard->retired_entries = entry;
+            entry = next;
+        }
+    }
+    old_buckets->retired_next = shard->retired_buckets;
+    shard->retired_buckets = old_buckets;
+    atomic_store_explicit(&(shard->key_count), 0, memory_order_relaxed);
+    lock_free_reclaim(map, shard);
+    pthread_mutex_unlock(&(shard->write_lock));
+    return true;
+}
+
+// frees a lock-free shard outright. No other thread may still be using the map
+static void lock_free_destroy_shard(Concurrent_shard *shard) {
+    Lock_free_buckets *buckets = atomic_load_explicit(&(shard->table), memory_order_relaxed);
+    for (size_t i = 0; i < buckets->bucket_count; i++) {
+        Lock_free_entry *entry = atomic_load_explicit(&(buckets->heads[i]), memory_order_relaxed);
+        while (entry != NULL) {
+            Lock_free_entry *next = atomic_load_explicit(&(entry->next), memory_order_relaxed);
+            lock_free_free_entry(entry);
+            entry = next;
+        }
+    }
+    free(buckets);
+    lock_free_free_retired(shard);
+    pthread_mutex_destroy(&(shard->write_lock));
+}
+
+// sets up one lock-free shard with at least desired_size buckets. True on success, else false
+static bool lock_free_init_shard(Concurrent_shard *shard, size_t desired_size) {
+    Lock_free_buckets *buckets = lock_free_new_buckets(power_of_two_bucket_count(desired_size, true, 1));
+    if (buckets == NULL) {
+        return false;
+    }
+    if (pthread_mutex_init(&(shard->write_lock), NULL) != 0) {
+        free(buckets);
+        return false;
+    }
+    shard->map = NULL;
+    atomic_init(&(shard->table), buckets);
+    atomic_init(&(shard->key_count), 0);
+    shard->retired_entries = NULL;
+    shard->retired_count = 0;
+    shard->retired_buckets = NULL;
+    return true;
+}
+
+/* CREATION AND THE hash_table_* STYLE API */
+
+// shared by both create functions. options are only used by locked shards
+static ConcurrentHashMap *concurrent_hash_table_new(size_t desired_size, DATA_TYPE key_type, size_t shard_count, const HashMap_options *options, bool lock_free_reads) {
+    if (desired_size == 0 || shard_count == 0) {
+        perror("cannot create a concurrent hash map with a size or shard count of 0!\n");
+        return NULL;
+    }
+    if (options != NULL && options->incremental_resize) {
+        perror("concurrent hash map shards cannot use incremental resizing (lookups would migrate buckets under a read lock)!\n");
+        return NULL;
+    }
+    if (options != NULL && (options->cache_capacity > 0 || options->cache_byte_capacity > 0 || options->ttl_clock != NULL)) {
+        perror("concurrent hash map shards cannot be caches or use TTLs (lookups would update or drop entries under a read lock)!\n");
+        return NULL;
+    }
+    ConcurrentHashMap *new_map = malloc(sizeof(ConcurrentHashMap));
+    if (new_map == NULL) {
+        perror("Could not malloc the concurrent hash map itself!\n");
+        return NULL;
+    }
+    if (!key_ops_for_type(key_type, &(new_map->key_ops))) {
+        printf("Must have one of the following datatypes: int, string (char *), float, double\n");
+        free(new_map);
+        return NULL;
+    }
+    new_map->key_type = key_type;
+    new_map->lock_free_reads = lock_free_reads;
+    new_map->reader_stripes = NULL;
+    atomic_init(&(new_map->epoch), 0);
+    if (lock_free_reads) {
+        new_map->reader_stripes = aligned_alloc(CONCURRENT_SHARD_ALIGNMENT, EPOCH_READER_STRIPES * sizeof(Epoch_reader_stripe));
+        if (new_map->reader_stripes == NULL || pthread_mutex_init(&(new_map->epoch_lock), NULL) != 0) {
+            perror("Could not set up the epochs of a lock-free concurrent hash map!\n");
+            free(new_map->reader_stripes);
+            free(new_map);
+            return NULL;
+        }
+        for (size_t i = 0; i < EPOCH_READER_STRIPES; i++) {
+            atomic_init(&(new_map->reader_stripes[i].active[0]), 0);
+            atomic_init(&(new_map->reader_stripes[i].active[1]), 0);
+        }
+    }
+    new_map->shard_count = power_of_two_bucket_count(shard_count, true, 1);
+    new_map->shards = aligned_alloc(CONCURRENT_SHARD_ALIGNMENT, new_map->shard_count * sizeof(Concurrent_shard));
+    if (new_map->shards == NULL) {
+        perror("Could not allocate the shards of a concurrent hash map!\n");
+        if (lock_free_reads) {
+            pthread_mutex_destroy(&(new_map->epoch_lock));
+        }
+        free(new_map->reader_stripes);
+        free(new_map);
+        return NULL;
+    }
+    size_t shard_size = desired_size / new_map->shard_count + 1;
+    for (size_t i = 0; i < new_map->shard_count; i++) {
+        bool created;
+        if (lock_free_reads) {
+            created = lock_free_init_shard(&(new_map->shards[i]), shard_size);
+        } else {
+            new_map->shards[i].map = hash_table_create_with_options(shard_size, key_type, options);
+            created = new_map->shards[i].map != NULL;
+            if (created && pthread_rwlock_init(&(new_map->shards[i].lock), NULL) != 0) {
+                hash_table_destroy(&(new_map->shards[i].map));
+                created = false;
+            }
+        }
+        if (!created) {
+            fprintf(stderr, "Could not create shard %zu of a concurrent hash map!\n", i);
+            while (i > 0) {
+                i--;
+                if (lock_free_reads) {
+                    lock_free_destroy_shard(&(new_map->shards[i]));
+                } else {
+                    pthread_rwlock_destroy(&(new_map->shards[i].lock));
+                    hash_table_destroy(&(new_map->shards[i].map));
+                }
+            }
+            if (lock_free_reads) {
+                pthread_mutex_destroy(&(new_map->epoch_lock));
+            }
+            free(new_map->shards);
+            free(new_map->reader_stripes);
+            free(new_map);
+            return NULL;
+        }
+    }
+    return new_map;
+}
+
+/* returns a new concurrent map on success, else NULL. desired_size is split between the shards and shard_count is rounded up
+   to a power of 2. The options are used for every shard (NULL for defaults), except that incremental resizing, cache_capacity,
+   cache_byte_capacity and ttl_clock are rejected: each makes lookups write to the shard (moving buckets, marking entries as
+   referenced, dropping expired entries) while other readers hold the same lock */
+ConcurrentHashMap *concurrent_hash_table_create_with_options(size_t desired_size, DATA_TYPE key_type, size_t shard_count, const HashMap_options *options) {
+    return concurrent_hash_table_new(desired_size, key_type, shard_count, options, false);
+}
+
+// returns a new concurrent map with default shard options on success, else NULL
+ConcurrentHashMap *concurrent_hash_table_create(size_t desired_size, DATA_TYPE key_type, size_t shard_count) {
+    return concurrent_hash_table_new(desired_size, key_type, shard_count, NULL, false);
+}
+
+/* returns a new concurrent map whose lookups take no locks, else NULL. Writers still lock their shard (and wait for readers
+   about once every LOCK_FREE_RETIRE_BATCH deletes/replacements and on every resize), so this suits maps that are rarely written.
+   Shards use their own chained tables, grow like a HashMap but never shrink */
+ConcurrentHashMap *concurrent_hash_table_create_lock_free_reads(size_t desired_size, DATA_TYPE key_type, size_t shard_count) {
+    return concurrent_hash_table_new(desired_size, key_type, shard_count, NULL, true);
+}
+
+// inserts or replaces a key. True on success, else false
+bool concurrent_hash_table_insert(ConcurrentHashMap *map, const Key *key, const Value *value) {
+    if (map == NULL || key == NULL || value == NULL) {
+        perror("NULL argument passed into concurrent_hash_table_insert() function!\n");
+        return false;
+    }
+    if (key->type != map->key_type) {
+        fprintf(stderr, "You cannot insert a key of type %d into a concurrent hash map that uses keys of type %d!\n", key->type, map->key_type);
+        return false;
+    }
+    if (value->type == INVALID_TYPE) {
+        perror("Invalid value type passed into concurrent_hash_table_insert()!\n");
+        return false;
+    }
+    size_t hash = mix_hash(map->key_ops.hash_func(key));
+    Concurrent_shard *shard = concurrent_shard_for_hash(map, hash);
+    if (map->lock_free_reads) {
+        return lock_free_insert(map, shard, key, value, hash);
+    }
+    pthread_rwlock_wrlock(&(shard->lock));
+    bool success = hash_table_insert(shard->map, key, value);
+    pthread_rwlock_unlock(&(shard->lock));
+    return success;
+}
+
+// copies an entry's value for the caller (strings and byte strings are duplicated). True on success, else false
+static bool concurrent_copy_value_out(Value *value_out, const Value *value) {
+    value_out->type = value->type;
+    if (!duplicate_data(value->type, &(value_out->data), &(value->data))) {
+        perror("strdup failed for value string in concurrent_hash_table_lookup()!\n");
+        return false;
+    }
+    return true;
+}
+
+/* copies the value of a key into value_out. True if the key was found, else false.
+   String values are strdup'd, so free them with delete_value() */
+bool concurrent_hash_table_lookup(ConcurrentHashMap *map, const Key *key, Value *value_out) {
+    if (map == NULL || key == NULL || value_out == NULL) {
+        perror("NULL argument passed into concurrent_hash_table_lookup() function!\n");
+        return false;
+    }
+    if (key->type != map->key_type) {
+        fprintf(stderr, "Key passed into concurrent_hash_table_lookup() has the wrong key type! Expected %d, got %d\n", map->key_type, key->type);
+        return false;
+    }
+    size_t hash = mix_hash(map->key_ops.hash_func(key));
+    Concurrent_shard *shard = concurrent_shard_for_hash(map, hash);
+    bool found = false;
+    if (map->lock_free_reads) {
+        size_t epoch = epoch_read_lock(map);
+        const Lock_free_entry *entry = lock_free_lookup(map, shard, key, hash);
+        found = (entry != NULL) && concurrent_copy_value_out(value_out, &(entry->value));
+        epoch_read_unlock(map, epoch);
+        return found;
+    }
+    pthread_rwlock_rdlock(&(shard->lock));
+    Entry *entry = hash_table_entry_lookup(shard->map, key);
+    found = (entry != NULL) && concurrent_copy_value_out(value_out, &(entry->value));
+    pthread_rwlock_unlock(&(shard->lock));
+    return found;
+}
+
+// returns true if key exists, else false
+bool concurrent_hash_table_contains(ConcurrentHashMap *map, const Key *key) {
+    if (map == NULL || key == NULL) {
+        perror("NULL argument passed into concurrent_hash_table_contains() function!\n");
+        return false;
+    }
+    if (key->type != map->key_type) {
+        fprintf(stderr, "Key passed into concurrent_hash_table_contains() has the wrong key type! Expected %d, got %d\n", map->key_type, key->type);
+        return false;
+    }
+    size_t hash = mix_hash(map->key_ops.hash_func(key));
+    Concurrent_shard *shard = concurrent_shard_for_hash(map, hash);
+    if (map->lock_free_reads) {
+        size_t epoch = epoch_read_lock(map);
+        bool found = lock_free_lookup(map, shard, key, hash) != NULL;
+        epoch_read_unlock(map, epoch);
+        return found;
+    }
+    pthread_rwlock_rdlock(&(shard->lock));
+    bool found = hash_table_contains(shard->map, key);
+    pthread_rwlock_unlock(&(shard->lock));
+    return found;
+}
+
+// returns true on deletion else false
+bool concurrent_hash_table_entry_delete(ConcurrentHashMap *map, const Key *key_to_delete) {
+    if (map == NULL || key_to_delete == NULL) {
+        perror("NULL argument passed into concurrent_hash_table_entry_delete() function!\n");
+        return false;
+    }
+    if (key_to_delete->type != map->key_type) {
+        fprintf(stderr, "Key passed into concurrent_hash_table_entry_delete() has the wrong key type! Expected %d, got %d\n", map->key_type, key_to_delete->type);
+        return false;
+    }
+    size_t hash = mix_hash(map->key_ops.hash_func(key_to_delete));
+    Concurrent_shard *shard = concurrent_shard_for_hash(map, hash);
+    if (map->lock_free_reads) {
+        return lock_free_remove(map, shard, key_to_delete, hash);
+    }
+    pthread_rwlock_wrlock(&(shard->lock));
+    bool deleted = hash_table_entry_delete(shard->map, key_to_delete);
+    pthread_rwlock_unlock(&(shard->lock));
+    return deleted;
+}
+
+// number of keys in all shards. Shards are counted one at a time, so concurrent writers can make this slightly stale
+size_t concurrent_hash_table_key_count(ConcurrentHashMap *map) {
+    if (map == NULL) {
+        perror("passed in NULL map into concurrent_hash_table_key_count() function!\n");
+        return 0;
+    }
+    size_t key_count = 0;
+    for (size_t i = 0; i < map->shard_count; i++) {
+        if (map->lock_free_reads) {
+            key_count += atomic_load_explicit(&(map->shards[i].key_count), memory_order_relaxed);
+            continue;
+        }
+        pthread_rwlock_rdlock(&(map->shards[i].lock));
+        key_count += hash_table_key_count(map->shards[i].map);
+        pthread_rwlock_unlock(&(map->shards[i].lock));
+    }
+    return key_count;
+}
+
+// removes all data from every shard (one shard at a time). True on success, else false
+bool concurrent_hash_table_clear(ConcurrentHashMap *map) {
+    if (map == NULL) {
+        perror("passed in NULL map into concurrent_hash_table_clear() function!\n");
+        return false;
+    }
+    bool success = true;
+    for (size_t i = 0; i < map->shard_count; i++) {
+        if (map->lock_free_reads) {
+            success = lock_free_clear(map, &(map->shards[i])) && success;
+            continue;
+        }
+        pthread_rwlock_wrlock(&(map->shards[i].lock));
+        success = hash_table_clear(map->shards[i].map) && success;
+        pthread_rwlock_unlock(&(map->shards[i].lock));
+    }
+    return success;
+}
+
+// Frees the whole concurrent map and sets the original pointer to NULL. No other thread may still be using it
+bool concurrent_hash_table_destroy(ConcurrentHashMap **map) {
+    if (map == NULL || *map == NULL) {
+        perror("concurrent hash map to destroy is NULL!\n");
+        return false;
+    }
+    for (size_t i = 0; i < (*map)->shard_count; i++) {
+        if ((*map)->lock_free_reads) {
+            lock_free_destroy_shard(&((*map)->shards[i]));
+            continue;
+        }
+        pthread_rwlock_destroy(&((*map)->shards[i].lock));
+        hash_table_destroy(&((*map)->shards[i].map));
+    }
+    if ((*map)->lock_free_reads) {
+        pthread_mutex_destroy(&((*map)->epoch_lock));
+    }
+    free((*map)->shards);
+    free((*map)->reader_stripes);
+    free(*map);
+    *map = NULL;
+    return true;
+}
+
+/* PARALLEL BULK BUILD AND RESIZE (for plain HashMaps)
+*  Both work on chaining maps with power of 2 buckets, where the low bits of a hash decide its bucket. That lets every thread
+*  own a disjoint set of buckets without any locking. Other maps (and small inputs) quietly take the single threaded path.
+*  Threads are started per call and joined before returning, so the map is never shared with the caller's other threads
+*/
+
+#define PARALLEL_MIN_ELEMENTS (1 << 14) // smaller batches are not worth starting threads for
+#define PARALLEL_MIN_BUCKETS (1 << 16) // smaller tables are rehashed on the calling thread
+
+// runs worker once per element of args (each arg_size bytes) on its own thread. Threads that cannot be started run inline
+static void parallel_run(size_t thread_count, void *(*worker)(void *), void *args, size_t arg_size) {
+    pthread_t *threads = malloc(thread_count * sizeof(pthread_t));
+    bool *started = calloc(thread_count, sizeof(bool));
+    for (size_t i = 0; i < thread_count; i++) {
+        void *arg = (char *)args + i * arg_size;
+        if (threads != NULL && started != NULL && pthread_create(&threads[i], NULL, worker, arg) == 0) {
+            started[i] = true;
+        } else {
+            worker(arg);
+        }
+    }
+    for (size_t i = 0; threads != NULL && started != NULL && i < thread_count; i++) {
+        if (started[i]) {
+            pthread_join(threads[i], NULL);
+        }
+    }
+    free(threads);
+    free(started);
+}
+
+// true if the map's buckets can be split between threads (see above)
+static bool parallel_supported(const HashMap *map) {
+    return map->storage_type == CHAINING_STORAGE && map->power_of_two_buckets && !map->incremental_resize && !map->cache_mode &&
+           map->tree_bin_threshold == 0; // the workers link entries into chains directly, which would leave tree bins stale
+}
+
+// the largest power of 2 that is at most thread_count (and at least 1)
+static size_t parallel_thread_count(size_t thread_count) {
+    size_t rounded = 1;
+    while (rounded * 2 <= thread_count) {
+        rounded *= 2;
+    }
+    return rounded;
+}
+
+typedef struct {
+    HashMap *map;
+    Entry **new_buckets;
+    size_t new_bucket_count;
+    size_t group_count; // the smaller of the two bucket counts
+    size_t first_group; // this thread's groups
+    size_t last_group;
+} Parallel_rehash_job;
+
+/* moves the entries of old buckets first_group, first_group + group_count, ... (up to last_group) into the new array.
+   With power of 2 counts they all land in new buckets that are congruent to their group, which no other thread touches */
+static void *parallel_rehash_worker(void *arg) {
+    Parallel_rehash_job *job = arg;
+    for (size_t group = job->first_group; group < job->last_group; group++) {
+        for (size_t i = group; i < job->map->bucket_count; i += job->group_count) {
+            Entry *current = job->map->buckets[i];
+            while (current) {
+                Entry *next_entry = current->next;
+                size_t new_index = current->hash & (job->new_bucket_count - 1);
+                current->next = job->new_buckets[new_index];
+                job->new_buckets[new_index] = current;
+                current = next_entry;
+            }
+        }
+    }
+    return NULL;
+}
+
+/* like hash_table_resize(), but the rehash of large chaining maps with power of 2 buckets is split between thread_count
+   threads. Other maps are resized on the calling thread. True on success, else false */
+bool hash_table_parallel_resize(HashMap *map, size_t new_buckets_count, size_t thread_count) {
+    if (map == NULL || new_buckets_count == 0) {
+        perror("Null map or 0 bucket count passed in to hash_table_parallel_resize() function!\n");
+        return false;
+    }
+    if (!parallel_supported(map) || thread_count < 2) {
+        return hash_table_resize(map, new_buckets_count);
+    }
+    new_buckets_count = power_of_two_bucket_count(new_buckets_count, new_buckets_count >= map->bucket_count, 1);
+    size_t group_count = (new_buckets_count < map->bucket_count) ? new_buckets_count : map->bucket_count;
+    thread_count = parallel_thread_count(thread_count);
+    size_t larger_count = (new_buckets_count > map->bucket_count) ? new_buckets_count : map->bucket_count;
+    if (new_buckets_count == map->bucket_count || larger_count < PARALLEL_MIN_BUCKETS || group_count < thread_count) {
+        return hash_table_resize(map, new_buckets_count);
+    }
+#ifdef HASHMAP_STATS
+    struct timespec start, end; // timed like storage_resize() times the other resizes
+    clock_gettime(CLOCK_MONOTONIC, &start);
+#endif
+    Entry **new_buckets = calloc(new_buckets_count, sizeof(Entry *));
+    Parallel_rehash_job *jobs = malloc(thread_count * sizeof(Parallel_rehash_job));
+    if (new_buckets == NULL || jobs == NULL) {
+        perror("Memory allocation failed while resizing hash table in hash_table_parallel_resize()!\n");
+        free(new_buckets);
+        free(jobs);
+        return false;
+    }
+    for (size_t t = 0; t < thread_count; t++) {
+        jobs[t] = (Parallel_rehash_job){map, new_buckets, new_buckets_count, group_count,
+                                        t * (group_count / thread_count), (t + 1) * (group_count / thread_count)};
+    }
+    parallel_run(thread_count, parallel_rehash_worker, jobs, sizeof(Parallel_rehash_job));
+    free(jobs);
+    free(map->buckets);
+    map->buckets = new_buckets;
+    map->bucket_count = new_buckets_count;
+#ifdef HASHMAP_STATS
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    map->counters.resizes++;
+    map->counters.resize_nanoseconds += (uint64_t)((int64_t)(end.tv_sec - start.tv_sec) * 1000000000 + (end.tv_nsec - start.tv_nsec));
+#endif
+    if (map->dirty_tracking) {
+        require_full_checkpoint(map);
+    }
+    return true;
+}
+
+// shared state of one hash_table_parallel_batch_insert() call
+typedef struct {
+    HashMap *map;
+    void *array_of_keys;
+    void *array_of_values;
+    size_t number_of_elements;
+    DATA_TYPE key_type;
+    DATA_TYPE value_type;
+    size_t thread_count; // also the number of partitions
+    size_t partition_buckets; // buckets per partition
+    size_t *hashes; // full hash of every element
+    size_t *partition_of; // partition of every element
+    size_t *offsets; // thread_count x thread_count: where thread t puts its first element of partition p in order
+    size_t *order; // element indexes grouped by partition, in input order within a partition
+    size_t *partition_starts; // thread_count + 1 boundaries into order
+} Parallel_build;
+
+typedef struct {
+    Parallel_build *build;
+    size_t index; // the input slice (hash and scatter) or partition (build) of this thread
+    HashMap *sub_map; // the partition's view of the map's buckets (build only)
+    bool success;
+} Parallel_build_job;
+
+// elements [first, last) of the input slice of a thread
+static void parallel_slice(const Parallel_build *build, size_t index, size_t *first, size_t *last) {
+    size_t slice = build->number_of_elements / build->thread_count;
+    *first = index * slice;
+    *last = (index + 1 == build->thread_count) ? build->number_of_elements : *first + slice;
+}
+
+// hashes one input slice and counts how many of its elements fall into each partition
+static void *parallel_hash_worker(void *arg) {
+    Parallel_build_job *job = arg;
+    Parallel_build *build = job->build;
+    size_t first, last;
+    parallel_slice(build, job->index, &first, &last);
+    size_t *counts = build->offsets + job->index * build->thread_count;
+    for (size_t i = first; i < last; i++) {
+        Key key = {.type = build->key_type, .data = raw_array_data(build->array_of_keys, i, build->key_type)};
+        build->hashes[i] = key_hash(build->map, &key);
+        build->partition_of[i] = bucket_index(build->map, build->hashes[i], build->map->bucket_count) / build->partition_buckets;
+        counts[build->partition_of[i]]++;
+    }
+    return NULL;
+}
+
+// writes the element indexes of one input slice into their partitions' parts of order
+static void *parallel_scatter_worker(void *arg) {
+    Parallel_build_job *job = arg;
+    Parallel_build *build = job->build;
+    size_t first, last;
+    parallel_slice(build, job->index, &first, &last);
+    size_t *offsets = build->offsets + job->index * build->thread_count;
+    for (size_t i = first; i < last; i++) {
+        build->order[offsets[build->partition_of[i]]++] = i;
+    }
+    return NULL;
+}
+
+// inserts the elements of one partition through a sub map that owns only that partition's buckets
+static void *parallel_build_worker(void *arg) {
+    Parallel_build_job *job = arg;
+    Parallel_build *build = job->build;
+    job->success = true;
+    for (size_t k = build->partition_starts[job->index]; k < build->partition_starts[job->index + 1]; k++) {
+        size_t i = build->order[k];
+        Key key = {.type = build->key_type, .data = raw_array_data(build->array_of_keys, i, build->key_type)};
+        Value value = {.type = build->value_type, .data = raw_array_data(build->array_of_values, i, build->value_type)};
+        size_t key_count = job->sub_map->key_count;
+        if (!job->sub_map->storage_ops.insert(job->sub_map, &key, &value, build->hashes[i])) {
+            fprintf(stderr, "Failed insertion for element %zu in hash_table_parallel_batch_insert() function!\n", i);
+            job->success = false;
+            return NULL;
+        }
+        HASHMAP_COUNT(job->sub_map, inserts, job->sub_map->key_count > key_count);
+        HASHMAP_COUNT(job->sub_map, updates, job->sub_map->key_count == key_count);
+    }
+    return NULL;
+}
+
+/* hands everything a partition's sub map allocated (and counted) over to the map and frees the sub map itself.
+   owned_strings is summed with wrap around, so replaced strings freed through the sub map cancel out */
+static void parallel_absorb_sub_map(HashMap *map, HashMap *sub_map) {
+    map->key_count += sub_map->key_count;
+    map->owned_strings += sub_map->owned_strings;
+#ifdef HASHMAP_STATS
+    map->counters.inserts += sub_map->counters.inserts;
+    map->counters.updates += sub_map->counters.updates;
+#endif
+    if (sub_map->slabs != NULL) {
+        Entry_slab *last_slab = sub_map->slabs;
+        while (last_slab->next != NULL) {
+            last_slab = last_slab->next;
+        }
+        last_slab->next = map->slabs;
+        map->slabs = sub_map->slabs;
+    }
+    if (sub_map->string_arena != NULL) {
+        String_arena_chunk *last_chunk = sub_map->string_arena;
+        while (last_chunk->next != NULL) {
+            last_chunk = last_chunk->next;
+        }
+        last_chunk->next = map->string_arena;
+        map->string_arena = sub_map->string_arena;
+    }
+    free(sub_map);
+}
+
+/* like hash_table_batch_insert(), but split over thread_count threads: the input is hashed in parallel, partitioned by
+   which bucket range it lands in, and every thread then inserts one partition into buckets no other thread touches.
+   Needs a chaining map with power of 2 buckets (no incremental resizing, not a cache), otherwise (or for small batches) this is a
+   plain hash_table_batch_insert(). Uses two extra size_t per element while building. True on success, else false */
+bool hash_table_parallel_batch_insert(HashMap *map, void *array_of_keys, void *array_of_values, size_t number_of_elements, const DATA_TYPE key_type, const DATA_TYPE value_type, size_t thread_count) {
+    if (map == NULL || !parallel_supported(map) || thread_count < 2 || number_of_elements < PARALLEL_MIN_ELEMENTS) {
+        return hash_table_batch_insert(map, array_of_keys, array_of_values, number_of_elements, key_type, value_type);
+    }
+    if (array_of_keys == NULL || array_of_values == NULL) {
+        perror("passed in NULL arrays into hash_table_parallel_batch_insert() function!\n");
+        return false;
+    }
+    if (key_type != map->key_type) {
+        fprintf(stderr, "key type mismatch in hash_table_parallel_batch_insert() function! Expected %d, got %d\n", map->key_type, key_type);
+        return false;
+    }
+    if (map->value_type != INVALID_TYPE && value_type != map->value_type) {
+        fprintf(stderr, "value type mismatch in hash_table_parallel_batch_insert() function! Expected %d, got %d\n", map->value_type, value_type);
+        return false;
+    }
+    if (!is_raw_array_type(value_type)) {
+        fprintf(stderr, "Invalid value type %d passed into hash_table_parallel_batch_insert() function!\n", value_type);
+        return false;
+    }
+    // grow once for the whole batch (see hash_table_batch_insert())
+    size_t needed_buckets = buckets_for_keys(map, map->key_count + number_of_elements);
+    if (needed_buckets > map->bucket_count && !hash_table_parallel_resize(map, needed_buckets, thread_count)) {
+        perror("could not grow the hash map for hash_table_parallel_batch_insert()!\n");
+        return false;
+    }
+    thread_count = parallel_thread_count(thread_count);
+    if (thread_count > map->bucket_count) {
+        thread_count = map->bucket_count;
+    }
+
+    Parallel_build build = {map, array_of_keys, array_of_values, number_of_elements, key_type, value_type, thread_count,
+                            map->bucket_count / thread_count, NULL, NULL, NULL, NULL, NULL};
+    build.hashes = malloc(number_of_elements * sizeof(size_t));
+    build.partition_of = malloc(number_of_elements * sizeof(size_t));
+    build.offsets = calloc(thread_count * thread_count, sizeof(size_t));
+    build.partition_starts = malloc((thread_count + 1) * sizeof(size_t));
+    Parallel_build_job *jobs = calloc(thread_count, sizeof(Parallel_build_job));
+    bool success = build.hashes != NULL && build.partition_of != NULL && build.offsets != NULL && build.partition_starts != NULL && jobs != NULL;
+    if (!success) {
+        perror("Could not allocate the work arrays of hash_table_parallel_batch_insert()!\n");
+    }
+    for (size_t t = 0; success && t < thread_count; t++) {
+        jobs[t] = (Parallel_build_job){&build, t, NULL, true};
+    }
+    if (success) {
+        parallel_run(thread_count, parallel_hash_worker, jobs, sizeof(Parallel_build_job));
+        // turn the per slice counts into offsets: partitions one after the other, slices in input order inside each
+        size_t position = 0;
+        for (size_t p = 0; p < thread_count; p++) {
+            build.partition_starts[p] = position;
+            for (size_t t = 0; t < thread_count; t++) {
+                size_t count = build.offsets[t * thread_count + p];
+                build.offsets[t * thread_count + p] = position;
+                position += count;
+            }
+        }
+        build.partition_starts[thread_count] = position;
+        build.order = malloc(number_of_elements * sizeof(size_t));
+        success = build.order != NULL;
+    }
+    if (success) {
+        parallel_run(thread_count, parallel_scatter_worker, jobs, sizeof(Parallel_build_job));
+        HashMap_options sub_options = {.use_entry_slab = map->use_entry_slab, .use_string_arena = map->use_string_arena,
+                                       .borrow_strings = map->borrow_strings, .power_of_two_buckets = true,
+                                       .custom_key_ops = &(map->key_ops), .seeded_hashing = map->seeded_hashing,
+                                       .hash_seed = {map->hash_seed[0], map->hash_seed[1]}, .min_load_factor = map->min_load_factor,
+                                       .max_load_factor = map->max_load_factor}; // so a sub map never outgrows its slice
+        for (size_t t = 0; t < thread_count; t++) {
+            // each sub map borrows its slice of the bucket array, including the entries already there
+            jobs[t].sub_map = hash_table_create_with_options(build.partition_buckets, key_type, &sub_options);
+            if (jobs[t].sub_map == NULL) {
+                success = false;
+                break;
+            }
+            free(jobs[t].sub_map->buckets);
+            jobs[t].sub_map->buckets = map->buckets + t * build.partition_buckets;
+            jobs[t].sub_map->bucket_count = build.partition_buckets;
+        }
+        if (success) {
+            parallel_run(thread_count, parallel_build_worker, jobs, sizeof(Parallel_build_job));
+        }
+        for (size_t t = 0; t < thread_count && jobs[t].sub_map != NULL; t++) {
+            success = success && jobs[t].success;
+            parallel_absorb_sub_map(map, jobs[t].sub_map);
+        }
+        if (map->dirty_tracking) {
+            require_full_checkpoint(map); // the sub maps did not mark the buckets they changed
+        }
+    }
+    free(build.hashes);
+    free(build.partition_of);
+    free(build.offsets);
+    free(build.partition_starts);
+    free(build.order);
+    free(jobs);
+    return success;
+}
+
+#endif /* HASHMAP_IMPLEMENTATION */
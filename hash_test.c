@@ -1,7 +1,1495 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include "hashmap.h"
+#include "concurrent_hashmap.h"
+#include "hashmap_snapshot.h"
+#include "typed_hashmap.h"
+
+HASHMAP_DECLARE(int_map, int, int, typed_hash_int, typed_eq_int)
+HASHMAP_DECLARE_PACKED(packed_int_map, int, int, typed_hash_int, typed_eq_int)
+HASHMAP_DECLARE(string_map, const char *, void *, typed_hash_string, typed_eq_string)
+
+static uint64_t ticking_milliseconds = 0;
+
+// a ttl_clock that moves on by a millisecond every time it is read
+static uint64_t ticking_clock(void) {
+    return ++ticking_milliseconds;
+}
+
+// inserts, looks up and deletes enough keys to force growing and shrinking with the given map options
+bool test_map_options(HashMap_options options, const char *name) {
+    HashMap *map = hash_table_create_with_options(5, INTEGER_TYPE, &options);
+    if (!map) {
+        printf("Failed to create hash map for %s!\n", name);
+        return false;
+    }
+    bool passed = true;
+    char buffer[20];
+    for (int i = 0; i < 1000; i++) {
+        sprintf(buffer, "value %d", i);
+        Key key = to_key(&i, INTEGER_TYPE);
+        Value value = to_value(buffer, STRING_TYPE);
+        passed = passed && hash_table_insert(map, &key, &value);
+        delete_value(value);
+    }
+    // replacing values must not add keys
+    for (int i = 0; i < 1000; i += 2) {
+        Key key = to_key(&i, INTEGER_TYPE);
+        Value value = to_value(&i, INTEGER_TYPE);
+        passed = passed && hash_table_insert(map, &key, &value);
+    }
+    passed = passed && (hash_table_key_count(map) == 1000);
+    for (int i = 0; i < 1000; i += 3) {
+        Key key = to_key(&i, INTEGER_TYPE);
+        passed = passed && hash_table_entry_delete(map, &key);
+    }
+    for (int i = -10; i < 1010; i++) {
+        Key key = to_key(&i, INTEGER_TYPE);
+        Entry *found = hash_table_entry_lookup(map, &key);
+        bool should_exist = (i >= 0 && i < 1000 && i % 3 != 0);
+        if ((found != NULL) != should_exist) {
+            passed = false;
+        } else if (found && i % 2 == 0) {
+            passed = passed && (found->value.type == INTEGER_TYPE && found->value.data.integer == i);
+        } else if (found) {
+            sprintf(buffer, "value %d", i);
+            passed = passed && (found->value.type == STRING_TYPE && strcmp(found->value.data.string, buffer) == 0);
+        }
+    }
+    // the batched lookup has to agree with single lookups, hits and misses alike
+    int batch_keys[1020];
+    Entry *batch_results[1020];
+    for (int i = 0; i < 1020; i++) {
+        batch_keys[i] = i - 10;
+    }
+    size_t batch_found = hash_table_batch_lookup(map, batch_keys, 1020, INTEGER_TYPE, batch_results);
+    passed = passed && (batch_found == hash_table_key_count(map));
+    for (int i = 0; i < 1020; i++) {
+        Key key = to_key(&(batch_keys[i]), INTEGER_TYPE);
+        passed = passed && (batch_results[i] == hash_table_entry_lookup(map, &key));
+    }
+    // a key given several times is decided once, even when its TTL runs out while the batch is being looked up
+    if (options.storage_type == CHAINING_STORAGE) {
+        HashMap_options ticking_options = options;
+        ticking_options.ttl_clock = ticking_clock;
+        HashMap *ticking = hash_table_create_with_options(5, INTEGER_TYPE, &ticking_options);
+        int seven = 7, repeated[4] = {7, 7, 7, 7};
+        Key seven_key = to_key(&seven, INTEGER_TYPE);
+        Value seven_value = to_value(&seven, INTEGER_TYPE);
+        passed = passed && ticking && hash_table_insert_with_ttl(ticking, &seven_key, &seven_value, 2);
+        size_t repeated_found = ticking ? hash_table_batch_lookup(ticking, repeated, 4, INTEGER_TYPE, batch_results) : 0;
+        for (int i = 0; ticking && i < 4; i++) {
+            passed = passed && (batch_results[i] == batch_results[0]);
+        }
+        passed = passed && (repeated_found == ((batch_results[0] != NULL) ? 4 : 0));
+        passed = passed && (batch_results[0] == NULL || batch_results[0]->value.data.integer == 7);
+        if (ticking) {
+            hash_table_destroy(&ticking);
+        }
+    }
+    // the iterator visits every entry once, and lookups in the middle of it must not disturb it
+    HashMap_iterator iterator;
+    size_t iterated = 0;
+    long long key_sum = 0, expected_sum = 0;
+    hash_table_iter_init(&iterator, map);
+    for (const Entry *entry = hash_table_iter_next(&iterator); entry; entry = hash_table_iter_next(&iterator)) {
+        passed = passed && (hash_table_entry_lookup(map, &(entry->key)) == entry);
+        key_sum += entry->key.data.integer;
+        iterated++;
+    }
+    for (int i = 0; i < 1000; i++) {
+        expected_sum += (i % 3 != 0) ? i : 0;
+    }
+    passed = passed && (iterated == hash_table_key_count(map)) && (key_sum == expected_sum);
+    passed = passed && (hash_table_iter_next(&iterator) == NULL);
+    hash_table_iter_init(&iterator, map);
+    passed = passed && (hash_table_iter_next(&iterator) != NULL);
+    hash_table_iter_end(&iterator);
+    Value *values = get_hash_table_values(map);
+    for (size_t i = 0; values && i < hash_table_key_count(map); i++) {
+        delete_value(values[i]);
+    }
+    free(values);
+    // deleting almost everything should shrink the table
+    for (int i = 0; i < 1000; i++) {
+        Key key = to_key(&i, INTEGER_TYPE);
+        hash_table_entry_delete(map, &key);
+    }
+    passed = passed && (hash_table_key_count(map) == 0);
+    // refill and clear to check that clearing leaves a usable map
+    for (int i = 0; i < 100; i++) {
+        Key key = to_key(&i, INTEGER_TYPE);
+        Value value = to_value(i % 2 ? "odd" : "even", STRING_TYPE);
+        passed = passed && hash_table_insert(map, &key, &value);
+        delete_value(value);
+    }
+    passed = passed && hash_table_clear(map) && (hash_table_key_count(map) == 0);
+    for (int i = 0; i < 100; i++) {
+        Key key = to_key(&i, INTEGER_TYPE);
+        Value value = to_value(&i, INTEGER_TYPE);
+        passed = passed && hash_table_insert(map, &key, &value);
+    }
+    passed = passed && (hash_table_key_count(map) == 100);
+    hash_table_destroy(&map);
+
+    // string keys go through the string copying (and arena) paths
+    map = hash_table_create_with_options(4, STRING_TYPE, &options);
+    if (!map) {
+        printf("Failed to create string keyed hash map for %s!\n", name);
+        return false;
+    }
+    for (int i = 0; i < 300; i++) {
+        sprintf(buffer, "key %d", i);
+        Key key = {.type = STRING_TYPE, .data.string = buffer};
+        Value value = {.type = STRING_TYPE, .data.string = buffer};
+        passed = passed && hash_table_insert(map, &key, &value);
+    }
+    for (int i = 0; i < 300; i += 2) {
+        sprintf(buffer, "key %d", i);
+        Key key = {.type = STRING_TYPE, .data.string = buffer};
+        passed = passed && hash_table_entry_delete(map, &key);
+    }
+    for (int i = 0; i < 310; i++) {
+        sprintf(buffer, "key %d", i);
+        Key key = {.type = STRING_TYPE, .data.string = buffer};
+        Entry *found = hash_table_entry_lookup(map, &key);
+        bool should_exist = (i < 300 && i % 2 == 1);
+        passed = passed && ((found != NULL) == should_exist);
+        passed = passed && (!found || strcmp(found->value.data.string, buffer) == 0);
+    }
+    passed = passed && (hash_table_key_count(map) == 150);
+    hash_table_destroy(&map);
+
+    // a map with its value type fixed refuses every other type
+    options.fixed_value_type = true;
+    options.value_type = INTEGER_TYPE;
+    map = hash_table_create_with_options(4, INTEGER_TYPE, &options);
+    int one = 1, batch_values[3] = {1, 2, 3};
+    Key key = to_key(&one, INTEGER_TYPE);
+    Value int_value = to_value(&one, INTEGER_TYPE);
+    Value string_value = {.type = STRING_TYPE, .data.string = "one"};
+    passed = passed && map && hash_table_insert(map, &key, &int_value) && !hash_table_insert(map, &key, &string_value);
+    passed = passed && map && hash_table_batch_insert(map, batch_values, batch_values, 3, INTEGER_TYPE, INTEGER_TYPE);
+    passed = passed && map && !hash_table_batch_insert(map, batch_values, (char *[]){"a", "b", "c"}, 3, INTEGER_TYPE, STRING_TYPE);
+    passed = passed && map && (hash_table_key_count(map) == 3);
+    hash_table_destroy(&map);
+    printf("%s test: %s\n", name, passed ? "passed" : "FAILED");
+    return passed;
+}
+
+#define CONCURRENT_TEST_THREADS 4
+#define CONCURRENT_TEST_KEYS_PER_THREAD 5000
+
+typedef struct {
+    ConcurrentHashMap *map;
+    int thread_index;
+    bool passed;
+} Concurrent_test_args;
+
+// every thread inserts its own range of keys, reads them back, deletes half and reads the keys of the other threads
+static void *concurrent_test_worker(void *arg) {
+    Concurrent_test_args *args = arg;
+    int first = args->thread_index * CONCURRENT_TEST_KEYS_PER_THREAD;
+    int last = first + CONCURRENT_TEST_KEYS_PER_THREAD;
+    char buffer[20];
+    args->passed = true;
+    for (int i = first; i < last; i++) {
+        sprintf(buffer, "value %d", i);
+        Key key = to_key(&i, INTEGER_TYPE);
+        Value value = to_value(buffer, STRING_TYPE);
+        args->passed = args->passed && concurrent_hash_table_insert(args->map, &key, &value);
+        delete_value(value);
+    }
+    for (int i = first; i < last; i++) {
+        sprintf(buffer, "value %d", i);
+        Key key = to_key(&i, INTEGER_TYPE);
+        Value found;
+        if (!concurrent_hash_table_lookup(args->map, &key, &found)) {
+            args->passed = false;
+            continue;
+        }
+        args->passed = args->passed && (found.type == STRING_TYPE && strcmp(found.data.string, buffer) == 0);
+        delete_value(found);
+    }
+    for (int i = first; i < last; i += 2) {
+        Key key = to_key(&i, INTEGER_TYPE);
+        args->passed = args->passed && concurrent_hash_table_entry_delete(args->map, &key);
+    }
+    // keys of other threads may or may not be there yet, this only has to be safe
+    for (int i = 0; i < CONCURRENT_TEST_THREADS * CONCURRENT_TEST_KEYS_PER_THREAD; i += 7) {
+        Key key = to_key(&i, INTEGER_TYPE);
+        concurrent_hash_table_contains(args->map, &key);
+    }
+    return NULL;
+}
+
+static uint64_t fake_milliseconds = 1000;
+
+static uint64_t fake_clock(void) {
+    return fake_milliseconds;
+}
+
+// hammers a sharded map from several threads at once
+bool test_concurrent_map(bool lock_free_reads, const char *name) {
+    ConcurrentHashMap *map = lock_free_reads ? concurrent_hash_table_create_lock_free_reads(16, INTEGER_TYPE, 8)
+                                             : concurrent_hash_table_create(16, INTEGER_TYPE, 8);
+    if (!map) {
+        printf("Failed to create %s!\n", name);
+        return false;
+    }
+    pthread_t threads[CONCURRENT_TEST_THREADS];
+    Concurrent_test_args args[CONCURRENT_TEST_THREADS];
+    bool passed = true;
+    for (int t = 0; t < CONCURRENT_TEST_THREADS; t++) {
+        args[t] = (Concurrent_test_args){.map = map, .thread_index = t, .passed = false};
+        if (pthread_create(&threads[t], NULL, concurrent_test_worker, &args[t]) != 0) {
+            printf("Failed to start concurrent test thread %d!\n", t);
+            return false;
+        }
+    }
+    for (int t = 0; t < CONCURRENT_TEST_THREADS; t++) {
+        pthread_join(threads[t], NULL);
+        passed = passed && args[t].passed;
+    }
+    passed = passed && (concurrent_hash_table_key_count(map) == CONCURRENT_TEST_THREADS * CONCURRENT_TEST_KEYS_PER_THREAD / 2);
+    for (int i = 0; i < CONCURRENT_TEST_THREADS * CONCURRENT_TEST_KEYS_PER_THREAD; i++) {
+        Key key = to_key(&i, INTEGER_TYPE);
+        passed = passed && (concurrent_hash_table_contains(map, &key) == (i % 2 != 0));
+    }
+    passed = passed && concurrent_hash_table_clear(map) && (concurrent_hash_table_key_count(map) == 0);
+    concurrent_hash_table_destroy(&map);
+
+    // shard options that make lookups write to the shard are refused
+    HashMap_options cache = {.cache_capacity = 100};
+    HashMap_options ttl = {.ttl_clock = fake_clock};
+    passed = passed && !concurrent_hash_table_create_with_options(16, INTEGER_TYPE, 8, &cache);
+    passed = passed && !concurrent_hash_table_create_with_options(16, INTEGER_TYPE, 8, &ttl);
+    printf("%s test: %s\n", name, passed ? "passed" : "FAILED");
+    return passed;
+}
+
+// builds a large map with several threads on top of some existing keys and checks it against what a serial build holds
+bool test_parallel_build(HashMap_options options, const char *name) {
+    const int count = 100000;
+    HashMap *map = hash_table_create_with_options(5, STRING_TYPE, &options);
+    int *values = malloc(count * sizeof(int));
+    char **keys = malloc(count * sizeof(char *));
+    if (!map || !values || !keys) {
+        printf("Failed to set up %s!\n", name);
+        hash_table_destroy(&map);
+        free(values);
+        free(keys);
+        return false;
+    }
+    bool passed = true;
+    char buffer[20];
+    // keys already in the map get replaced, the last copy of a duplicated key wins
+    for (int i = 0; i < 1000; i++) {
+        sprintf(buffer, "key %d", i);
+        Key key = to_key(buffer, STRING_TYPE);
+        Value value = to_value("old", STRING_TYPE);
+        passed = passed && hash_table_insert(map, &key, &value);
+        delete_key(key);
+        delete_value(value);
+    }
+    for (int i = 0; i < count; i++) {
+        sprintf(buffer, "key %d", i % (count - 100));
+        keys[i] = strdup(buffer);
+        values[i] = i;
+    }
+    passed = passed && hash_table_parallel_batch_insert(map, keys, values, count, STRING_TYPE, INTEGER_TYPE, 4);
+    passed = passed && (hash_table_key_count(map) == (size_t)(count - 100));
+    // the threads count their inserts and updates like one batch insert would
+    HashMap_stats stats;
+    passed = passed && hash_table_get_stats(map, &stats);
+    passed = passed && (!stats.counters_enabled || (stats.counters.inserts == (size_t)(count - 100) && stats.counters.updates == 1100));
+    size_t resizes = stats.counters.resizes;
+    uint64_t resize_nanoseconds = stats.counters.resize_nanoseconds;
+    for (int i = 0; i < count - 100; i++) {
+        Key key = {.type = STRING_TYPE, .data.string = keys[i]};
+        Entry *found = hash_table_entry_lookup(map, &key);
+        int expected = (i < 100) ? i + count - 100 : i;
+        passed = passed && found && found->value.type == INTEGER_TYPE && found->value.data.integer == expected;
+    }
+    // rehash down and back up on several threads
+    passed = passed && hash_table_parallel_resize(map, (1 << 17), 4) && hash_table_parallel_resize(map, (1 << 20), 4);
+    passed = passed && hash_table_get_stats(map, &stats);
+    passed = passed && (!stats.counters_enabled || (stats.counters.resizes == resizes + 2 && stats.counters.resize_nanoseconds > resize_nanoseconds));
+    for (int i = 0; i < count - 100; i += 7) {
+        Key key = {.type = STRING_TYPE, .data.string = keys[i]};
+        passed = passed && hash_table_contains(map, &key);
+        passed = passed && hash_table_entry_delete(map, &key);
+    }
+    for (int i = 0; i < count; i++) {
+        free(keys[i]);
+    }
+    free(keys);
+    free(values);
+    hash_table_destroy(&map);
+    printf("%s test: %s\n", name, passed ? "passed" : "FAILED");
+    return passed;
+}
+
+// saves a map with mixed value types, maps the image back in and checks every key (and a few misses) against the map
+bool test_snapshot(HashMap_options options, DATA_TYPE key_type, const char *name) {
+    const char *path = "hash_test_snapshot.bin";
+    HashMap *map = hash_table_create_with_options(5, key_type, &options);
+    if (!map) {
+        printf("Failed to create hash map for %s!\n", name);
+        return false;
+    }
+    bool passed = true;
+    char buffer[20];
+    for (int i = 0; i < 2000; i++) {
+        sprintf(buffer, "key %d", i);
+        Key key = (key_type == STRING_TYPE) ? to_key(buffer, STRING_TYPE) : to_key(&i, INTEGER_TYPE);
+        double as_double = i / 4.0;
+        Value value = (i % 3 == 0) ? to_value(buffer, STRING_TYPE) : (i % 3 == 1) ? to_value(&i, INTEGER_TYPE) : to_value(&as_double, DOUBLE_TYPE);
+        passed = passed && hash_table_insert(map, &key, &value);
+        delete_key(key);
+        delete_value(value);
+    }
+    passed = passed && hash_table_save(map, path);
+    MappedHashMap *mapped = hash_table_open_mmap(path);
+    passed = passed && mapped && (mapped_hash_table_key_count(mapped) == hash_table_key_count(map));
+    for (int i = -5; mapped && i < 2005; i++) {
+        sprintf(buffer, "key %d", i);
+        Key key = (key_type == STRING_TYPE) ? (Key){.type = STRING_TYPE, .data.string = buffer} : (Key){.type = INTEGER_TYPE, .data.integer = i};
+        Entry *expected = hash_table_entry_lookup(map, &key);
+        Value found;
+        bool was_found = mapped_hash_table_lookup(mapped, &key, &found);
+        if ((expected != NULL) != was_found || was_found != mapped_hash_table_contains(mapped, &key)) {
+            passed = false;
+        } else if (was_found && found.type != expected->value.type) {
+            passed = false;
+        } else if (was_found && found.type == STRING_TYPE) {
+            passed = passed && strcmp(found.data.string, expected->value.data.string) == 0;
+        } else if (was_found && found.type == INTEGER_TYPE) {
+            passed = passed && found.data.integer == expected->value.data.integer;
+        } else if (was_found) {
+            passed = passed && found.data.double_value == expected->value.data.double_value;
+        }
+    }
+    if (mapped) {
+        hash_table_close_mmap(&mapped);
+    }
+    // anything that is not an image must be rejected
+    FILE *file = fopen(path, "wb");
+    if (file) {
+        fputs("definitely not a hash map snapshot", file);
+        fclose(file);
+        passed = passed && (hash_table_open_mmap(path) == NULL);
+    }
+    remove(path);
+    hash_table_destroy(&map);
+    printf("%s test: %s\n", name, passed ? "passed" : "FAILED");
+    return passed;
+}
+
+#define SCAN_TEST_KEYS 2000
+
+static void scan_test_mark(const Entry *entry, void *context) {
+    int *times_seen = context;
+    if (entry->key.data.integer < SCAN_TEST_KEYS) {
+        times_seen[entry->key.data.integer]++;
+    }
+}
+
+// walks a map with a scan cursor while it keeps growing (and then shrinking) between steps
+bool test_scan(HashMap_options options, const char *name) {
+    HashMap *map = hash_table_create_with_options(16, INTEGER_TYPE, &options);
+    int *times_seen = calloc(SCAN_TEST_KEYS, sizeof(int));
+    if (!map || !times_seen) {
+        printf("Failed to create hash map for the %s test!\n", name);
+        return false;
+    }
+    bool passed = true;
+    for (int i = 0; i < SCAN_TEST_KEYS; i++) {
+        Key key = to_key(&i, INTEGER_TYPE);
+        Value value = to_value(&i, INTEGER_TYPE);
+        passed = passed && hash_table_insert(map, &key, &value);
+    }
+    // the first SCAN_TEST_KEYS keys stay for the whole walk, so all of them must be seen
+    int extra = SCAN_TEST_KEYS;
+    size_t calls = 0;
+    size_t cursor = 0;
+    do {
+        cursor = hash_table_scan(map, cursor, 8, scan_test_mark, times_seen);
+        calls++;
+        for (int i = 0; i < 50 && calls < 200; i++, extra++) {
+            Key key = to_key(&extra, INTEGER_TYPE);
+            Value value = to_value(&extra, INTEGER_TYPE);
+            passed = passed && hash_table_insert(map, &key, &value);
+        }
+        for (int i = 0; i < 100 && calls >= 200 && extra > SCAN_TEST_KEYS; i++) {
+            extra--;
+            Key key = to_key(&extra, INTEGER_TYPE);
+            passed = passed && hash_table_entry_delete(map, &key);
+        }
+    } while (cursor != 0 && calls < 1000000);
+    for (int i = 0; i < SCAN_TEST_KEYS; i++) {
+        passed = passed && (times_seen[i] > 0);
+    }
+    // scans need buckets taken from hash bits, anything else is refused
+    HashMap *modulo = hash_table_create(16, INTEGER_TYPE);
+    passed = passed && modulo && (hash_table_scan(modulo, 0, 8, scan_test_mark, times_seen) == 0);
+    hash_table_destroy(&modulo);
+    free(times_seen);
+    hash_table_destroy(&map);
+    printf("%s test: %s\n", name, passed ? "passed" : "FAILED");
+    return passed;
+}
+
+// the macro generated maps: growth, replacing, deleting (with back shifting) and iteration
+bool test_typed_maps(void) {
+    int_map *ints = int_map_create(2);
+    string_map *strings = string_map_create(0);
+    if (!ints || !strings) {
+        printf("Failed to create the typed maps!\n");
+        return false;
+    }
+    bool passed = true;
+    for (int i = 0; i < 10000; i++) {
+        passed = passed && int_map_insert(ints, i, i * 2);
+    }
+    for (int i = 0; i < 10000; i += 2) {
+        passed = passed && int_map_insert(ints, i, -i);
+    }
+    for (int i = 0; i < 10000; i += 3) {
+        passed = passed && int_map_delete(ints, i);
+    }
+    passed = passed && !int_map_delete(ints, 0) && (int_map_count(ints) == 10000 - 3334);
+    for (int i = -10; i < 10010; i++) {
+        int *value = int_map_lookup(ints, i);
+        bool should_exist = (i >= 0 && i < 10000 && i % 3 != 0);
+        passed = passed && ((value != NULL) == should_exist) && (int_map_contains(ints, i) == should_exist);
+        passed = passed && (!value || *value == ((i % 2 == 0) ? -i : i * 2));
+    }
+    size_t position = 0, iterated = 0;
+    int key, value;
+    while (int_map_next(ints, &position, &key, &value)) {
+        passed = passed && (key % 3 != 0) && (*int_map_lookup(ints, key) == value);
+        iterated++;
+    }
+    passed = passed && (iterated == int_map_count(ints));
+    // the packed layout has to behave the same while using half the memory
+    packed_int_map *packed = packed_int_map_create(2);
+    passed = passed && packed;
+    for (int i = 0; packed && i < 10000; i++) {
+        passed = passed && packed_int_map_insert(packed, i, i * 2);
+    }
+    for (int i = 0; packed && i < 10000; i += 3) {
+        passed = passed && packed_int_map_delete(packed, i);
+    }
+    for (int i = -10; packed && i < 10010; i++) {
+        int *packed_value = packed_int_map_lookup(packed, i);
+        int *value = int_map_lookup(ints, i);
+        passed = passed && ((packed_value != NULL) == (value != NULL)) && (!value || *packed_value == i * 2);
+    }
+    passed = passed && packed && (packed_int_map_count(packed) == int_map_count(ints));
+    passed = passed && packed && (packed_int_map_memory_usage(packed) * 3 < int_map_memory_usage(ints) * 2);
+    packed_int_map_destroy(&packed);
+    int_map_clear(ints);
+    passed = passed && (int_map_count(ints) == 0) && !int_map_contains(ints, 1);
+    // counting through get_or_insert, including the growth it triggers
+    for (int i = 0; i < 30000; i++) {
+        bool inserted;
+        int *count = int_map_get_or_insert(ints, i % 1000, 0, &inserted);
+        passed = passed && count && (inserted == (i < 1000));
+        (*count)++;
+    }
+    passed = passed && (int_map_count(ints) == 1000) && (*int_map_lookup(ints, 999) == 30);
+    int_map_clear(ints);
+
+    // string keys are compared by contents, not by pointer
+    char *words[] = {"alpha", "beta", "gamma", "delta", "epsilon"};
+    for (size_t i = 0; i < 5; i++) {
+        passed = passed && string_map_insert(strings, words[i], &(words[i]));
+    }
+    char buffer[20];
+    strcpy(buffer, "gamma");
+    void **found = string_map_lookup(strings, buffer);
+    passed = passed && found && (*found == &(words[2]));
+    passed = passed && string_map_delete(strings, buffer) && !string_map_contains(strings, "gamma");
+    passed = passed && (string_map_count(strings) == 4) && string_map_contains(strings, "epsilon");
+
+    int_map_destroy(&ints);
+    string_map_destroy(&strings);
+    passed = passed && (ints == NULL) && (strings == NULL);
+    printf("typed maps test: %s\n", passed ? "passed" : "FAILED");
+    return passed;
+}
+
+static void double_integer(Value *value, void *context) {
+    (void)context;
+    value->data.integer *= 2;
+}
+
+static void turn_into_float(Value *value, void *context) {
+    value->type = FLOAT_TYPE;
+    value->data.float_value = *(float *)context;
+}
+
+// counts keys through in-table value pointers, then changes the counts in place with update callbacks
+bool test_get_or_insert(HashMap_options options, const char *name) {
+    HashMap *map = hash_table_create_with_options(4, INTEGER_TYPE, &options);
+    HashMap *strings = hash_table_create_with_options(4, STRING_TYPE, &options);
+    if (!map || !strings) {
+        printf("Failed to create hash map for the %s test!\n", name);
+        return false;
+    }
+    bool passed = true;
+    int zero = 0;
+    int expected[1500] = {0};
+    Value initial = to_value(&zero, INTEGER_TYPE);
+    // 7 and 1500 share no factors, so the first 1500 rounds see every key once
+    for (int i = 0; i < 20000; i++) {
+        int key_data = (i * 7) % 1500;
+        expected[key_data]++;
+        Key key = to_key(&key_data, INTEGER_TYPE);
+        bool inserted;
+        Value *count = hash_table_get_or_insert(map, &key, &initial, &inserted);
+        passed = passed && count && (inserted == (i < 1500));
+        if (count) {
+            count->data.integer++;
+        }
+    }
+    passed = passed && (map->key_count == 1500);
+    for (int i = 0; i < 1500; i++) {
+        Key key = to_key(&i, INTEGER_TYPE);
+        passed = passed && hash_table_update(map, &key, double_integer, NULL);
+        Entry *found = hash_table_entry_lookup(map, &key);
+        passed = passed && found && (found->value.data.integer == 2 * expected[i]);
+    }
+    int missing = -1;
+    Key missing_key = to_key(&missing, INTEGER_TYPE);
+    float new_value = 1.5f;
+    Key first_key = to_key(&zero, INTEGER_TYPE);
+    passed = passed && !hash_table_update(map, &missing_key, double_integer, NULL) && !hash_table_contains(map, &missing_key);
+    passed = passed && !hash_table_update(map, &first_key, turn_into_float, &new_value);
+    Entry *first = hash_table_entry_lookup(map, &first_key);
+    passed = passed && first && (first->value.type == INTEGER_TYPE);
+    Key word = to_key("word", STRING_TYPE);
+    Value text = to_value("text", STRING_TYPE);
+    passed = passed && !hash_table_get_or_insert(map, &word, &text, NULL) && (map->key_count == 1500);
+
+    // string values are copied in on the first call only, and later calls hand back the same copy
+    Value *stored = hash_table_get_or_insert(strings, &word, &text, NULL);
+    passed = passed && stored && (stored->data.string != text.data.string) && (strcmp(stored->data.string, "text") == 0);
+    bool inserted = true;
+    Value other = to_value("other", STRING_TYPE);
+    passed = passed && (hash_table_get_or_insert(strings, &word, &other, &inserted) == stored) && !inserted;
+    passed = passed && (strcmp(stored->data.string, "text") == 0);
+    delete_value(other);
+    delete_value(text);
+    delete_key(word);
+    hash_table_destroy(&map);
+    hash_table_destroy(&strings);
+    printf("%s test: %s\n", name, passed ? "passed" : "FAILED");
+    return passed;
+}
+
+static bool keep_not_multiple(const Entry *entry, void *context) {
+    return entry->key.data.integer % *(int *)context != 0;
+}
+
+static bool keep_short_strings(const Entry *entry, void *context) {
+    return strlen(entry->key.data.string) <= *(size_t *)context;
+}
+
+// purges most of a map with one batch delete (which shrinks once at the end), then sweeps it with retain
+bool test_batch_delete_and_retain(HashMap_options options, const char *name) {
+    HashMap *map = hash_table_create_with_options(16, INTEGER_TYPE, &options);
+    HashMap *strings = hash_table_create_with_options(16, STRING_TYPE, &options);
+    int *keys = malloc(6000 * sizeof(int));
+    if (!map || !strings || !keys) {
+        printf("Failed to create hash map for the %s test!\n", name);
+        return false;
+    }
+    bool passed = true;
+    for (int i = 0; i < 6000; i++) {
+        keys[i] = i;
+    }
+    passed = passed && hash_table_batch_insert(map, keys, keys, 6000, INTEGER_TYPE, INTEGER_TYPE);
+    size_t full_bucket_count = map->bucket_count;
+    // everything but the first 500 keys
+    passed = passed && hash_table_batch_delete(map, keys + 500, 5500, INTEGER_TYPE, true);
+    passed = passed && (map->key_count == 500) && (map->bucket_count < full_bucket_count);
+    passed = passed && (get_hash_table_load_factor(map) >= MIN_LOAD_FACTOR);
+    passed = passed && !hash_table_batch_delete(map, keys + 499, 2, INTEGER_TYPE, true) && (map->key_count == 499);
+    passed = passed && hash_table_batch_delete(map, keys + 1000, 10, INTEGER_TYPE, false);
+
+    int divisor = 3;
+    passed = passed && (hash_table_retain(map, keep_not_multiple, &divisor) == 167) && (map->key_count == 332);
+    for (int i = -5; i < 1000; i++) {
+        Key key = to_key(&i, INTEGER_TYPE);
+        Entry *found = hash_table_entry_lookup(map, &key);
+        bool should_exist = (i >= 0 && i < 499 && i % 3 != 0);
+        passed = passed && ((found != NULL) == should_exist) && (!found || found->value.data.integer == i);
+    }
+    divisor = 1;
+    passed = passed && (hash_table_retain(map, keep_not_multiple, &divisor) == 332) && (map->key_count == 0);
+    passed = passed && (hash_table_retain(map, keep_not_multiple, &divisor) == 0);
+
+    // owned strings are freed by the sweep (the leak checker notices if they are not)
+    char *words[] = {"a", "bb", "ccc", "dddd", "ee", "f", "ggggg", "hh"};
+    passed = passed && hash_table_batch_insert(strings, words, keys, 8, STRING_TYPE, INTEGER_TYPE);
+    size_t longest = 2;
+    passed = passed && (hash_table_retain(strings, keep_short_strings, &longest) == 3) && (strings->key_count == 5);
+    Key kept = to_key("hh", STRING_TYPE);
+    Key swept = to_key("ccc", STRING_TYPE);
+    passed = passed && hash_table_contains(strings, &kept) && !hash_table_contains(strings, &swept);
+    delete_key(kept);
+    delete_key(swept);
+    free(keys);
+    hash_table_destroy(&map);
+    hash_table_destroy(&strings);
+    printf("%s test: %s\n", name, passed ? "passed" : "FAILED");
+    return passed;
+}
+
+// a bounded cache under key churn: hot keys survive, the limits hold after every insert and the table stops growing
+bool test_cache(HashMap_options options, const char *name) {
+    options.cache_capacity = 100;
+    HashMap *map = hash_table_create_with_options(16, INTEGER_TYPE, &options);
+    options.cache_capacity = 0;
+    options.cache_byte_capacity = 40 * (sizeof(Entry) + 16);
+    HashMap *strings = hash_table_create_with_options(16, STRING_TYPE, &options);
+    if (!map || !strings) {
+        printf("Failed to create hash map for the %s test!\n", name);
+        return false;
+    }
+    bool passed = true;
+    size_t bucket_count = 0;
+    for (int i = 0; i < 20000; i++) {
+        Key key = to_key(&i, INTEGER_TYPE);
+        Value value = to_value(&i, INTEGER_TYPE);
+        passed = passed && hash_table_insert(map, &key, &value) && (map->key_count <= 100);
+        // keys below 10 are looked up all the time, so the CLOCK hand keeps giving them a second chance
+        int hot = i % 10;
+        Key hot_key = to_key(&hot, INTEGER_TYPE);
+        passed = passed && (i < 10 || hash_table_contains(map, &hot_key));
+        if (i == 1000) {
+            bucket_count = map->bucket_count;
+        }
+    }
+    HashMap_cache_stats stats = hash_table_cache_stats(map);
+    passed = passed && (stats.entries == 100) && (stats.evictions == 19900) && (stats.hits == 19990) && (stats.misses == 0);
+    passed = passed && (map->bucket_count == bucket_count);
+    int newest = 19999;
+    Key newest_key = to_key(&newest, INTEGER_TYPE);
+    passed = passed && hash_table_contains(map, &newest_key);
+    // batch lookups count as hits and misses of the cache too
+    int batch_keys[3] = {0, 19999, -1};
+    Entry *batch_results[3];
+    passed = passed && (hash_table_batch_lookup(map, batch_keys, 3, INTEGER_TYPE, batch_results) == 2);
+    stats = hash_table_cache_stats(map);
+    passed = passed && (stats.hits == 19993) && (stats.misses == 1) && batch_results[0] && batch_results[0]->referenced;
+
+    char buffer[32];
+    for (int i = 0; i < 2000; i++) {
+        snprintf(buffer, sizeof(buffer), "key %d%s", i, (i % 3 == 0) ? " with a longer tail" : "");
+        Key key = to_key(buffer, STRING_TYPE);
+        Value value = to_value(buffer, STRING_TYPE);
+        passed = passed && hash_table_insert(strings, &key, &value);
+        passed = passed && (hash_table_cache_stats(strings).bytes <= options.cache_byte_capacity);
+        delete_key(key);
+        delete_value(value);
+    }
+    // the running byte count has to match what the entries hold
+    size_t counted = 0;
+    HashMap_iterator iterator;
+    hash_table_iter_init(&iterator, strings);
+    for (const Entry *entry = hash_table_iter_next(&iterator); entry != NULL; entry = hash_table_iter_next(&iterator)) {
+        counted += sizeof(Entry) + strlen(entry->key.data.string) + 1 + strlen(entry->value.data.string) + 1;
+    }
+    stats = hash_table_cache_stats(strings);
+    passed = passed && (counted == stats.bytes) && (stats.entries > 20) && (stats.evictions == 2000 - stats.entries);
+    passed = passed && hash_table_clear(strings) && (hash_table_cache_stats(strings).bytes == 0);
+    // plain maps never evict and report nothing
+    HashMap *plain = hash_table_create(16, INTEGER_TYPE);
+    passed = passed && plain && (hash_table_cache_stats(plain).hits == 0);
+    hash_table_destroy(&plain);
+    hash_table_destroy(&map);
+    hash_table_destroy(&strings);
+    printf("%s test: %s\n", name, passed ? "passed" : "FAILED");
+    return passed;
+}
+
+// TTL entries on a clock the test moves by hand: lazy expiry on lookup, timer wheel reclamation in slices, long TTLs
+bool test_ttl(HashMap_options options, const char *name) {
+    options.ttl_clock = fake_clock;
+    fake_milliseconds = 1000;
+    HashMap *map = hash_table_create_with_options(16, INTEGER_TYPE, &options);
+    if (!map) {
+        printf("Failed to create hash map for the %s test!\n", name);
+        return false;
+    }
+    bool passed = true;
+    for (int i = 0; i < 1100; i++) {
+        Key key = to_key(&i, INTEGER_TYPE);
+        Value value = to_value(&i, INTEGER_TYPE);
+        // the last 100 keys never expire
+        passed = passed && ((i < 1000) ? hash_table_insert_with_ttl(map, &key, &value, 100 + (uint64_t)i) : hash_table_insert(map, &key, &value));
+    }
+    fake_milliseconds += 50;
+    passed = passed && (hash_table_expire(map, 100000) == 0) && (map->key_count == 1100);
+    // lazy: the lookup itself deletes an expired key
+    fake_milliseconds += 60;
+    int first = 0;
+    Key first_key = to_key(&first, INTEGER_TYPE);
+    passed = passed && !hash_table_contains(map, &first_key) && (map->key_count == 1099);
+    // so does a batch lookup, for every expired key it is given (keys 1 to 10 are due by now, 1050 never is)
+    int batch_keys[11] = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 1050};
+    Entry *batch_results[11];
+    passed = passed && (hash_table_batch_lookup(map, batch_keys, 11, INTEGER_TYPE, batch_results) == 1) && (map->key_count == 1089);
+    passed = passed && (batch_results[0] == NULL) && (batch_results[10] != NULL) && (batch_results[10]->value.data.integer == 1050);
+    // a plain insert makes an entry permanent again
+    int kept = 999;
+    Key kept_key = to_key(&kept, INTEGER_TYPE);
+    passed = passed && hash_table_insert(map, &kept_key, &(Value){.type = INTEGER_TYPE, .data.integer = -1});
+
+    fake_milliseconds += 5000;
+    size_t calls = 0, reclaimed = 0;
+    for (size_t step; (step = hash_table_expire(map, 64)) > 0 || map->key_count > 101; calls++) {
+        passed = passed && (step <= 64);
+        reclaimed += step;
+        if (calls > 10000) {
+            passed = false;
+            break;
+        }
+    }
+    passed = passed && (reclaimed == 988) && (map->key_count == 101) && (calls > 10) && hash_table_contains(map, &kept_key);
+    passed = passed && (map->bucket_count < 1100); // reclaiming gave memory back
+
+    // a TTL longer than the wheel reaches is parked at the top level and placed again until it is due
+    int late = -5;
+    Key late_key = to_key(&late, INTEGER_TYPE);
+    uint64_t ten_hours = 10ULL * 3600 * 1000;
+    passed = passed && hash_table_insert_with_ttl(map, &late_key, &(Value){.type = INTEGER_TYPE, .data.integer = late}, ten_hours);
+    fake_milliseconds += ten_hours - 1;
+    passed = passed && (hash_table_expire(map, (size_t)-1) == 0) && hash_table_contains(map, &late_key);
+    fake_milliseconds += 1;
+    passed = passed && (hash_table_expire(map, (size_t)-1) == 1) && (map->key_count == 101);
+
+    HashMap *probing = hash_table_create_with_options(16, INTEGER_TYPE, &(HashMap_options){.storage_type = LINEAR_PROBING_STORAGE});
+    passed = passed && probing && !hash_table_insert_with_ttl(probing, &late_key, &(Value){.type = INTEGER_TYPE, .data.integer = 0}, 10);
+    hash_table_destroy(&probing);
+    hash_table_destroy(&map);
+    printf("%s test: %s\n", name, passed ? "passed" : "FAILED");
+    return passed;
+}
+
+// the counters follow every kind of operation, and the histogram accounts for every bucket or entry
+bool test_stats(HashMap_options options, const char *name) {
+    HashMap *map = hash_table_create_with_options(16, INTEGER_TYPE, &options);
+    if (!map) {
+        printf("Failed to create hash map for the %s test!\n", name);
+        return false;
+    }
+    bool passed = true;
+    for (int i = 0; i < 1000; i++) {
+        Key key = to_key(&i, INTEGER_TYPE);
+        Value value = to_value(&i, INTEGER_TYPE);
+        passed = passed && hash_table_insert(map, &key, &value);
+        passed = passed && ((i % 100 != 0) || hash_table_insert(map, &key, &value));
+    }
+    for (int i = 900; i < 1100; i++) {
+        Key key = to_key(&i, INTEGER_TYPE);
+        hash_table_contains(map, &key);
+    }
+    for (int i = 0; i < 50; i++) {
+        Key key = to_key(&i, INTEGER_TYPE);
+        passed = passed && hash_table_entry_delete(map, &key);
+    }
+    HashMap_stats stats;
+    passed = passed && hash_table_get_stats(map, &stats) && stats.counters_enabled;
+    passed = passed && (stats.counters.inserts == 1000) && (stats.counters.updates == 10) && (stats.counters.hits == 100);
+    passed = passed && (stats.counters.misses == 100) && (stats.counters.deletes == 50) && (stats.counters.resizes > 0);
+    size_t counted = 0;
+    for (size_t i = 0; i < HASHMAP_STATS_HISTOGRAM_SIZE; i++) {
+        counted += stats.length_histogram[i];
+    }
+    passed = passed && (counted == ((map->storage_type == CHAINING_STORAGE) ? map->bucket_count : map->key_count));
+    passed = passed && (stats.max_length >= 1) && (stats.mean_length >= 1.0);
+    hash_table_destroy(&map);
+
+    if (options.storage_type == CHAINING_STORAGE && !options.power_of_two_buckets) {
+        // identity hashed keys that are all multiples of the bucket count land in a single chain
+        HashMap *clustered = hash_table_create(1031, INTEGER_TYPE);
+        for (int i = 0; clustered && i < 100; i++) {
+            int key_data = i * 1031;
+            Key key = to_key(&key_data, INTEGER_TYPE);
+            Value value = to_value(&i, INTEGER_TYPE);
+            passed = passed && hash_table_insert(clustered, &key, &value);
+        }
+        passed = passed && clustered && hash_table_get_stats(clustered, &stats) && (stats.max_length == 100);
+        passed = passed && (stats.length_histogram[0] == 1030) && (stats.length_histogram[HASHMAP_STATS_HISTOGRAM_SIZE - 1] == 1);
+        hash_table_destroy(&clustered);
+    }
+    printf("%s test: %s\n", name, passed ? "passed" : "FAILED");
+    return passed;
+}
+
+bool test_memory_and_sizing(HashMap_options options, const char *name) {
+    HashMap *map = hash_table_create_with_options(16, STRING_TYPE, &options);
+    if (!map) {
+        printf("Failed to create hash map for the %s test!\n", name);
+        return false;
+    }
+    bool passed = true;
+    HashMap_memory memory;
+    size_t empty_total = hash_table_memory_usage(map, &memory);
+    passed = passed && (empty_total == memory.total) && (memory.map == sizeof(HashMap)) && (memory.strings == 0);
+
+    // after reserving, the whole ingest goes in without a single resize
+    passed = passed && hash_table_reserve(map, 5000);
+    size_t reserved_buckets = map->bucket_count;
+    HashMap_stats stats;
+    passed = passed && hash_table_get_stats(map, &stats);
+    size_t resizes = stats.counters.resizes;
+    size_t string_bytes = 0;
+    char buffer[32];
+    for (int i = 0; i < 5000; i++) {
+        snprintf(buffer, sizeof(buffer), "key number %d", i);
+        string_bytes += strlen(buffer) + 1;
+        Key key = {.type = STRING_TYPE, .data.string = buffer};
+        Value value = to_value(&i, INTEGER_TYPE);
+        passed = passed && hash_table_insert(map, &key, &value);
+    }
+    passed = passed && (map->bucket_count == reserved_buckets) && hash_table_get_stats(map, &stats) && (stats.counters.resizes == resizes);
+    passed = passed && hash_table_reserve(map, 10) && (map->bucket_count == reserved_buckets); // reserving never shrinks
+
+    size_t full_total = hash_table_memory_usage(map, &memory);
+    passed = passed && (memory.total == memory.map + memory.table + memory.entries + memory.strings + memory.bookkeeping + memory.allocator_overhead);
+    passed = passed && (full_total > empty_total) && (memory.strings >= string_bytes);
+    passed = passed && (memory.entries + memory.table >= 5000 * sizeof(Entry));
+
+    // deleting most keys only shrinks in 3/4 steps, shrink_to_fit goes all the way down
+    for (int i = 100; i < 5000; i++) {
+        snprintf(buffer, sizeof(buffer), "key number %d", i);
+        Key key = {.type = STRING_TYPE, .data.string = buffer};
+        passed = passed && hash_table_entry_delete(map, &key);
+    }
+    passed = passed && hash_table_shrink_to_fit(map) && (map->key_count == 100);
+    passed = passed && (get_hash_table_load_factor(map) <= map->max_load_factor) && (map->bucket_count <= 1024);
+    size_t fitted_buckets = map->bucket_count;
+    passed = passed && hash_table_shrink_to_fit(map) && (map->bucket_count == fitted_buckets); // already as small as it gets
+    for (int i = 0; i < 100; i++) {
+        snprintf(buffer, sizeof(buffer), "key number %d", i);
+        Key key = {.type = STRING_TYPE, .data.string = buffer};
+        Entry *entry = hash_table_entry_lookup(map, &key);
+        passed = passed && entry && (entry->value.data.integer == i);
+    }
+    passed = passed && (hash_table_memory_usage(map, NULL) < full_total);
+    hash_table_destroy(&map);
+
+    // a chained map can be run at several keys per bucket, and shrinks only once it is almost empty
+    if (options.storage_type == CHAINING_STORAGE) {
+        HashMap_options dense_options = options;
+        dense_options.max_load_factor = 4.0f;
+        dense_options.min_load_factor = 0.01f;
+        HashMap *dense = hash_table_create_with_options(16, INTEGER_TYPE, &dense_options);
+        float highest_load_factor = 0;
+        for (int i = 0; dense && i < 2000; i++) {
+            Key key = to_key(&i, INTEGER_TYPE);
+            Value value = to_value(&i, INTEGER_TYPE);
+            passed = passed && hash_table_insert(dense, &key, &value);
+            float load_factor = get_hash_table_load_factor(dense);
+            highest_load_factor = (load_factor > highest_load_factor) ? load_factor : highest_load_factor;
+        }
+        passed = passed && dense && (highest_load_factor > 2.0f) && (highest_load_factor <= 4.0f);
+        size_t dense_buckets = dense ? dense->bucket_count : 0;
+        for (int i = 0; dense && i < 1900; i++) {
+            Key key = to_key(&i, INTEGER_TYPE);
+            passed = passed && hash_table_entry_delete(dense, &key);
+        }
+        passed = passed && dense && (dense->bucket_count == dense_buckets); // 100 keys is still above 1% of the buckets
+        hash_table_destroy(&dense);
+    }
+    // max has to leave room for min, and open addressing needs empty slots
+    HashMap_options bad_options = options;
+    bad_options.min_load_factor = 0.5f;
+    bad_options.max_load_factor = 0.75f;
+    passed = passed && (hash_table_create_with_options(16, INTEGER_TYPE, &bad_options) == NULL);
+    bad_options.min_load_factor = 0;
+    bad_options.max_load_factor = 1.5f;
+    HashMap *overloaded = hash_table_create_with_options(16, INTEGER_TYPE, &bad_options);
+    passed = passed && ((overloaded == NULL) == (options.storage_type != CHAINING_STORAGE));
+    if (overloaded) {
+        hash_table_destroy(&overloaded);
+    }
+    printf("%s test: %s\n", name, passed ? "passed" : "FAILED");
+    return passed;
+}
+
+// adds the incoming count to the existing one, keeping the merged map's entry (see Merge_func)
+static bool merge_sum_counts(Value *existing, const Value *incoming, void *context) {
+    (*(int *)context)++;
+    existing->data.integer += incoming->data.integer;
+    return false;
+}
+
+// sums like merge_sum_counts() until the context runs out, then breaks the rules by turning the value into a float
+static bool merge_sum_then_retype(Value *existing, const Value *incoming, void *context) {
+    if ((*(int *)context)-- <= 0) {
+        existing->type = FLOAT_TYPE;
+        return false;
+    }
+    existing->data.integer += incoming->data.integer;
+    return false;
+}
+
+// a map of string keys "key <i>" for first <= i < last, all mapped to value
+static HashMap *set_algebra_map(const HashMap_options *options, int first, int last, int value) {
+    HashMap *map = hash_table_create_with_options(64, STRING_TYPE, options);
+    char buffer[32];
+    for (int i = first; map && i < last; i++) {
+        snprintf(buffer, sizeof(buffer), "key %d", i);
+        Key key = {.type = STRING_TYPE, .data.string = buffer};
+        Value count = to_value(&value, INTEGER_TYPE);
+        if (!hash_table_insert(map, &key, &count)) {
+            hash_table_destroy(&map);
+        }
+    }
+    return map;
+}
+
+// the value stored for "key <i>", or -1 if the map does not have it
+static int set_algebra_value(const HashMap *map, int i) {
+    char buffer[32];
+    snprintf(buffer, sizeof(buffer), "key %d", i);
+    Key key = {.type = STRING_TYPE, .data.string = buffer};
+    Entry *entry = hash_table_entry_lookup(map, &key);
+    return entry ? entry->value.data.integer : -1;
+}
+
+// merges, merge moves, intersections and differences, both between maps of one layout and with a plain chained map
+bool test_set_algebra(HashMap_options options, const char *name) {
+    HashMap_options plain = {0};
+    HashMap *left = set_algebra_map(&options, 0, 1000, 1);
+    HashMap *right = set_algebra_map(&options, 500, 1500, 2);
+    HashMap *other_layout = set_algebra_map(&plain, 500, 1500, 2);
+    if (!left || !right || !other_layout) {
+        printf("Failed to create hash maps for the %s test!\n", name);
+        return false;
+    }
+    bool passed = true;
+    int conflicts = 0;
+    passed = passed && hash_table_merge(left, right, merge_sum_counts, &conflicts);
+    passed = passed && (conflicts == 500) && (left->key_count == 1500) && (right->key_count == 1000);
+    passed = passed && (set_algebra_value(left, 0) == 1) && (set_algebra_value(left, 700) == 3) && (set_algebra_value(left, 1499) == 2);
+    passed = passed && (set_algebra_value(right, 700) == 2); // the source is left as it was
+    passed = passed && hash_table_merge(left, left, NULL, NULL) && (left->key_count == 1500);
+
+    // without a callback the source's values win
+    passed = passed && hash_table_merge(left, other_layout, NULL, NULL) && (left->key_count == 1500);
+    passed = passed && (set_algebra_value(left, 700) == 2) && (set_algebra_value(left, 100) == 1);
+
+    HashMap *intersection = set_algebra_map(&options, 0, 1000, 1);
+    HashMap *difference = set_algebra_map(&options, 0, 1000, 1);
+    passed = passed && intersection && difference;
+    passed = passed && (hash_table_intersect(intersection, right) == 500) && (intersection->key_count == 500);
+    passed = passed && (set_algebra_value(intersection, 499) == -1) && (set_algebra_value(intersection, 500) == 1);
+    passed = passed && (hash_table_difference(difference, other_layout) == 500) && (difference->key_count == 500);
+    passed = passed && (set_algebra_value(difference, 499) == 1) && (set_algebra_value(difference, 500) == -1);
+    passed = passed && (hash_table_intersect(difference, difference) == 0) && (hash_table_difference(intersection, intersection) == 500);
+    passed = passed && (intersection->key_count == 0) && (hash_table_intersect(difference, intersection) == 500);
+    hash_table_destroy(&intersection);
+    hash_table_destroy(&difference);
+
+    // a discarded source hands its entries over (spliced when the layouts allow it), then is destroyed
+    HashMap *moved_into = set_algebra_map(&options, 0, 1000, 1);
+    HashMap *discarded = set_algebra_map(&options, 500, 1500, 2);
+    conflicts = 0;
+    passed = passed && moved_into && discarded && hash_table_merge_move(moved_into, &discarded, merge_sum_counts, &conflicts);
+    passed = passed && (discarded == NULL) && (conflicts == 500) && moved_into && (moved_into->key_count == 1500);
+    passed = passed && (set_algebra_value(moved_into, 10) == 1) && (set_algebra_value(moved_into, 999) == 3) && (set_algebra_value(moved_into, 1000) == 2);
+    HashMap *replacing = set_algebra_map(&plain, 900, 1100, 7);
+    passed = passed && replacing && hash_table_merge_move(moved_into, &replacing, NULL, NULL) && (replacing == NULL);
+    passed = passed && moved_into && (moved_into->key_count == 1500) && (set_algebra_value(moved_into, 950) == 7);
+    for (int i = 0; moved_into && i < 1500; i++) {
+        int expected = (i >= 900 && i < 1100) ? 7 : ((i < 500) ? 1 : ((i < 1000) ? 3 : 2));
+        passed = passed && (set_algebra_value(moved_into, i) == expected);
+    }
+    if (discarded) {
+        hash_table_destroy(&discarded);
+    }
+    hash_table_destroy(&moved_into);
+
+    // a failing merge move leaves the source whole, so either map can be destroyed first
+    moved_into = set_algebra_map(&options, 0, 1000, 1);
+    discarded = set_algebra_map(&options, 500, 1500, 2);
+    int allowed_conflicts = 40;
+    passed = passed && moved_into && discarded && !hash_table_merge_move(moved_into, &discarded, merge_sum_then_retype, &allowed_conflicts);
+    passed = passed && discarded && (discarded->key_count == 1000) && (set_algebra_value(discarded, 1499) == 2);
+    if (discarded) {
+        hash_table_destroy(&discarded);
+    }
+    passed = passed && moved_into && (moved_into->key_count >= 1000) && (moved_into->key_count < 1500);
+    for (int i = 0; moved_into && i < 1500; i++) {
+        int value = set_algebra_value(moved_into, i); // copying merges stop where they fail, new keys included
+        passed = passed && ((i < 500) ? (value == 1) : ((i < 1000) ? (value == 1 || value == 3) : (value == 2 || value == -1)));
+    }
+    if (moved_into) {
+        hash_table_destroy(&moved_into);
+    }
+
+    // maps with different key types cannot be combined
+    HashMap *int_keys = hash_table_create(16, INTEGER_TYPE);
+    passed = passed && int_keys && !hash_table_merge(int_keys, right, NULL, NULL) && (hash_table_intersect(int_keys, right) == 0);
+    hash_table_destroy(&int_keys);
+    hash_table_destroy(&left);
+    hash_table_destroy(&right);
+    hash_table_destroy(&other_layout);
+    printf("%s test: %s\n", name, passed ? "passed" : "FAILED");
+    return passed;
+}
+
+// a growing in-memory buffer that dumps are written to and restored from
+typedef struct {
+    unsigned char *data;
+    size_t size;
+    size_t capacity;
+    size_t read_position;
+} Dump_buffer;
+
+static bool dump_buffer_write(const void *data, size_t size, void *context) {
+    Dump_buffer *buffer = context;
+    if (buffer->size + size > buffer->capacity) {
+        size_t capacity = (buffer->size + size) * 2;
+        unsigned char *grown = realloc(buffer->data, capacity);
+        if (!grown) {
+            return false;
+        }
+        buffer->data = grown;
+        buffer->capacity = capacity;
+    }
+    memcpy(buffer->data + buffer->size, data, size);
+    buffer->size += size;
+    return true;
+}
+
+static bool dump_buffer_read(void *data, size_t size, void *context) {
+    Dump_buffer *buffer = context;
+    if (buffer->read_position + size > buffer->size) {
+        return false;
+    }
+    memcpy(data, buffer->data + buffer->read_position, size);
+    buffer->read_position += size;
+    return true;
+}
+
+// true if both maps hold the same keys with the same values
+static bool maps_match(const HashMap *a, const HashMap *b) {
+    if (hash_table_key_count(a) != hash_table_key_count(b)) {
+        return false;
+    }
+    Key *keys = get_hash_table_keys(a);
+    bool match = true;
+    for (size_t i = 0; keys && i < hash_table_key_count(a); i++) {
+        Entry *in_a = hash_table_entry_lookup(a, &keys[i]);
+        Entry *in_b = hash_table_entry_lookup(b, &keys[i]);
+        if (!in_b || in_a->value.type != in_b->value.type) {
+            match = false;
+        } else if (in_a->value.type == STRING_TYPE) {
+            match = match && strcmp(in_a->value.data.string, in_b->value.data.string) == 0;
+        } else {
+            match = match && in_a->value.data.integer == in_b->value.data.integer;
+        }
+        delete_key(keys[i]);
+    }
+    free(keys);
+    return match;
+}
+
+// 16 byte keys used through CUSTOM_TYPE hooks
+typedef struct {
+    unsigned char bytes[16];
+} Test_uuid;
+
+static int live_uuid_copies = 0;
+
+static size_t hash_uuid(const Key *key) {
+    return hash_bytes(key->data.custom, sizeof(Test_uuid));
+}
+
+static int cmp_uuid(const Key *a, const Key *b) {
+    return memcmp(a->data.custom, b->data.custom, sizeof(Test_uuid));
+}
+
+static void *clone_uuid(const void *data) {
+    Test_uuid *copy = malloc(sizeof(Test_uuid));
+    if (copy) {
+        memcpy(copy, data, sizeof(Test_uuid));
+        live_uuid_copies++;
+    }
+    return copy;
+}
+
+static void destroy_uuid(void *data) {
+    free(data);
+    live_uuid_copies--;
+}
+
+static Test_uuid make_uuid(int seed) {
+    Test_uuid uuid;
+    for (int i = 0; i < 16; i++) {
+        uuid.bytes[i] = (unsigned char)(seed * 31 + i * (seed >> 8));
+    }
+    memcpy(uuid.bytes, &seed, sizeof(seed));
+    return uuid;
+}
+
+// struct keys stored through caller supplied hash/compare/clone/destroy hooks
+bool test_custom_keys(HashMap_options options, const char *name) {
+    Key_ops uuid_ops = {.hash_func = hash_uuid, .cmp_func = cmp_uuid, .clone_func = clone_uuid, .destroy_func = destroy_uuid};
+    bool passed = (hash_table_create_with_options(4, CUSTOM_TYPE, &options) == NULL); // hooks are required
+    options.custom_key_ops = &uuid_ops;
+    HashMap *map = hash_table_create_with_options(4, CUSTOM_TYPE, &options);
+    if (!map) {
+        printf("Failed to create hash map for %s!\n", name);
+        return false;
+    }
+    for (int i = 0; i < 2000; i++) {
+        Test_uuid uuid = make_uuid(i); // the map keeps its own copy, this one goes out of scope
+        Key key = {.type = CUSTOM_TYPE, .data.custom = &uuid};
+        Value value = to_value(&i, INTEGER_TYPE);
+        passed = passed && hash_table_insert(map, &key, &value);
+    }
+    // replacing a value keeps the stored key, so no extra copies appear
+    Test_uuid first = make_uuid(0);
+    Key first_key = {.type = CUSTOM_TYPE, .data.custom = &first};
+    Value replacement = to_value("zero", STRING_TYPE);
+    passed = passed && hash_table_insert(map, &first_key, &replacement) && (live_uuid_copies == 2000);
+    delete_value(replacement);
+    for (int i = 0; i < 2000; i += 2) {
+        Test_uuid uuid = make_uuid(i);
+        Key key = {.type = CUSTOM_TYPE, .data.custom = &uuid};
+        passed = passed && hash_table_entry_delete(map, &key);
+    }
+    passed = passed && (live_uuid_copies == 1000) && (hash_table_key_count(map) == 1000);
+    for (int i = 0; i < 2010; i++) {
+        Test_uuid uuid = make_uuid(i);
+        Key key = {.type = CUSTOM_TYPE, .data.custom = &uuid};
+        Entry *found = hash_table_entry_lookup(map, &key);
+        bool should_exist = (i < 2000 && i % 2 == 1);
+        passed = passed && ((found != NULL) == should_exist) && (!found || found->value.data.integer == i);
+        passed = passed && (!found || found->key.data.custom != &uuid);
+    }
+    // batch inserts take an array of pointers to the keys
+    Test_uuid batch[3] = {make_uuid(5000), make_uuid(5001), make_uuid(5002)};
+    void *batch_keys[3] = {&batch[0], &batch[1], &batch[2]};
+    int batch_values[3] = {1, 2, 3};
+    passed = passed && hash_table_batch_insert(map, batch_keys, batch_values, 3, CUSTOM_TYPE, INTEGER_TYPE);
+    passed = passed && (live_uuid_copies == 1003);
+    Dump_buffer dump = {0};
+    passed = passed && !hash_table_dump(map, dump_buffer_write, &dump);
+    passed = passed && hash_table_clear(map) && (live_uuid_copies == 0);
+    for (int i = 0; i < 10; i++) {
+        Test_uuid uuid = make_uuid(i);
+        Key key = {.type = CUSTOM_TYPE, .data.custom = &uuid};
+        Value value = to_value(&i, INTEGER_TYPE);
+        passed = passed && hash_table_insert(map, &key, &value);
+    }
+    hash_table_destroy(&map);
+    passed = passed && (live_uuid_copies == 0);
+    printf("%s test: %s\n", name, passed ? "passed" : "FAILED");
+    return passed;
+}
+
+// a custom hash that sends every key into the same bucket, the worst case tree bins are there for
+static size_t hash_uuid_colliding(const Key *key) {
+    (void)key;
+    return 42;
+}
+
+// seeded hashing spreads keys picked to collide, and tree bins keep lookups fast in chains that collide anyway (options is that map's)
+bool test_hash_flooding(HashMap_options options, const char *name) {
+    bool passed = true;
+    HashMap_options seeded = {.seeded_hashing = true, .hash_seed = {0x0706050403020100ULL, 0x0f0e0d0c0b0a0908ULL}};
+    HashMap *reference = hash_table_create_with_options(16, STRING_TYPE, &seeded);
+    Key empty_key = {.type = STRING_TYPE, .data.string = ""};
+    passed = passed && reference && hash_table_insert(reference, &empty_key, &(Value){.type = INTEGER_TYPE, .data.integer = 1});
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__ && SIZE_MAX == UINT64_MAX
+    Entry *empty_entry = hash_table_entry_lookup(reference, &empty_key);
+    passed = passed && empty_entry && (empty_entry->hash == 0xabac0158050fc4dcULL); // SipHash-1-3 of no bytes under key 00..0f
+#endif
+    // a random seed hashes differently, the same seed hashes the same and lets the maps be merged in lockstep
+    HashMap *random_seed = hash_table_create_with_options(16, STRING_TYPE, &(HashMap_options){.seeded_hashing = true});
+    HashMap *same_seed = hash_table_create_with_options(16, STRING_TYPE, &seeded);
+    passed = passed && random_seed && same_seed && (random_seed->hash_seed[0] != 0 || random_seed->hash_seed[1] != 0);
+    char buffer[32];
+    size_t same_hashes = 0;
+    for (int i = 0; random_seed && same_seed && i < 200; i++) {
+        snprintf(buffer, sizeof(buffer), "flood %d", i);
+        Key key = {.type = STRING_TYPE, .data.string = buffer};
+        Value value = to_value(&i, INTEGER_TYPE);
+        passed = passed && hash_table_insert(random_seed, &key, &value) && hash_table_insert(i < 100 ? reference : same_seed, &key, &value);
+        passed = passed && (hash_table_entry_lookup(random_seed, &key) != NULL);
+    }
+    for (int i = 0; random_seed && same_seed && i < 200; i++) {
+        snprintf(buffer, sizeof(buffer), "flood %d", i);
+        Key key = {.type = STRING_TYPE, .data.string = buffer};
+        Entry *from_random = hash_table_entry_lookup(random_seed, &key);
+        Entry *from_seeded = hash_table_entry_lookup(i < 100 ? reference : same_seed, &key);
+        same_hashes += (from_random && from_seeded && from_random->hash == from_seeded->hash);
+    }
+    passed = passed && (same_hashes < 5) && hash_table_merge(reference, same_seed, NULL, NULL) && (reference->key_count == 201);
+    hash_table_destroy(&same_seed);
+    hash_table_destroy(&random_seed);
+    hash_table_destroy(&reference);
+
+    // multiples of the bucket count all land in one chain of an identity hashed map, but spread once the map is seeded
+    HashMap_stats stats;
+    HashMap *clustered = hash_table_create(1031, INTEGER_TYPE);
+    HashMap *spread = hash_table_create_with_options(1031, INTEGER_TYPE, &(HashMap_options){.seeded_hashing = true});
+    for (int i = 0; clustered && spread && i < 100; i++) {
+        int key_data = i * 1031;
+        Key key = to_key(&key_data, INTEGER_TYPE);
+        Value value = to_value(&i, INTEGER_TYPE);
+        passed = passed && hash_table_insert(clustered, &key, &value) && hash_table_insert(spread, &key, &value);
+    }
+    passed = passed && clustered && hash_table_get_stats(clustered, &stats) && (stats.max_length == 100);
+    passed = passed && spread && hash_table_get_stats(spread, &stats) && (stats.max_length < 8);
+    hash_table_destroy(&clustered);
+    hash_table_destroy(&spread);
+
+    /* a hash that collides for every key: one chain holding everything, indexed by its tree bin. The tree sorts by cmp_func()
+       then, so cmp_uuid() has to be a total order: antisymmetric and transitive over the keys used below */
+    for (int i = 0; i + 2 < 2000; i += 97) {
+        Test_uuid uuids[3] = {make_uuid(i), make_uuid(i + 1), make_uuid(i + 2)};
+        Key a = {.type = CUSTOM_TYPE, .data.custom = &uuids[0]};
+        Key b = {.type = CUSTOM_TYPE, .data.custom = &uuids[1]};
+        Key c = {.type = CUSTOM_TYPE, .data.custom = &uuids[2]};
+        int ab = cmp_uuid(&a, &b), bc = cmp_uuid(&b, &c), ac = cmp_uuid(&a, &c);
+        passed = passed && (cmp_uuid(&a, &a) == 0) && ((ab < 0) == (cmp_uuid(&b, &a) > 0)) && (ab != 0);
+        passed = passed && !(ab < 0 && bc < 0 && ac >= 0) && !(ab > 0 && bc > 0 && ac <= 0);
+    }
+    Key_ops colliding_ops = {.hash_func = hash_uuid_colliding, .cmp_func = cmp_uuid, .clone_func = clone_uuid, .destroy_func = destroy_uuid};
+    options.custom_key_ops = &colliding_ops;
+    HashMap *treed = hash_table_create_with_options(16, CUSTOM_TYPE, &options);
+    passed = passed && treed;
+    for (int i = 0; treed && i < 2000; i++) {
+        Test_uuid uuid = make_uuid(i);
+        Key key = {.type = CUSTOM_TYPE, .data.custom = &uuid};
+        Value value = to_value(&i, INTEGER_TYPE);
+        passed = passed && hash_table_insert(treed, &key, &value);
+        passed = passed && ((i % 500 != 0) || hash_table_insert(treed, &key, &value)); // replacing keeps one entry
+    }
+    passed = passed && treed && (treed->key_count == 2000) && (treed->tree_node_count == 2000);
+    for (int i = 0; treed && i < 2000; i += 2) {
+        Test_uuid uuid = make_uuid(i);
+        Key key = {.type = CUSTOM_TYPE, .data.custom = &uuid};
+        passed = passed && hash_table_entry_delete(treed, &key);
+    }
+    for (int i = 0; treed && i < 2100; i++) {
+        Test_uuid uuid = make_uuid(i);
+        Key key = {.type = CUSTOM_TYPE, .data.custom = &uuid};
+        Entry *entry = hash_table_entry_lookup(treed, &key);
+        passed = passed && ((i % 2 == 1 && i < 2000) ? (entry && entry->value.data.integer == i) : (entry == NULL));
+    }
+    passed = passed && treed && (treed->key_count == 1000) && (treed->tree_node_count == 1000);
+    passed = passed && hash_table_get_stats(treed, &stats) && (stats.max_length == 1000);
+    size_t walked = 0;
+    HashMap_iterator iterator;
+    hash_table_iter_init(&iterator, treed);
+    while (hash_table_iter_next(&iterator) != NULL) {
+        walked++;
+    }
+    passed = passed && (walked == 1000);
+    passed = passed && hash_table_clear(treed) && (treed->tree_node_count == 0) && (live_uuid_copies == 0);
+    if (treed) {
+        hash_table_destroy(&treed);
+    }
+
+    // tree bins index chains of the current bucket array, so they cannot be combined with an incremental resize
+    HashMap_options invalid = {.tree_bin_threshold = 8, .incremental_resize = true};
+    passed = passed && (hash_table_create_with_options(16, INTEGER_TYPE, &invalid) == NULL);
+    invalid = (HashMap_options){.tree_bin_threshold = 8, .storage_type = SWISS_STORAGE};
+    passed = passed && (hash_table_create_with_options(16, INTEGER_TYPE, &invalid) == NULL);
+    printf("%s test: %s\n", name, passed ? "passed" : "FAILED");
+    return passed;
+}
+
+// byte string keys with embedded zeros, looked up straight out of a larger buffer and round tripped through a dump
+bool test_byte_keys(HashMap_options options, const char *name) {
+    HashMap *map = hash_table_create_with_options(4, BYTES_TYPE, &options);
+    HashMap *restored = hash_table_create_with_options(4, BYTES_TYPE, &options);
+    if (!map || !restored) {
+        printf("Failed to create hash maps for %s!\n", name);
+        return false;
+    }
+    // a fake packet: field i is the 6 bytes at offset 8 * i, with zeros all over the place
+    unsigned char packet[8000] = {0};
+    for (int i = 0; i < 1000; i++) {
+        packet[8 * i + 1] = (unsigned char)(i & 0xFF);
+        packet[8 * i + 3] = (unsigned char)(i >> 8);
+        packet[8 * i + 5] = (unsigned char)(i % 5);
+    }
+    bool passed = true;
+    for (int i = 0; i < 1000; i++) {
+        Bytes field = {.data = packet + 8 * i, .length = 6};
+        Key key = {.type = BYTES_TYPE, .data.bytes = &field};
+        Value value = {.type = BYTES_TYPE, .data.bytes = &field}; // values can be byte strings too
+        passed = passed && hash_table_insert(map, &key, &value);
+    }
+    // the same bytes with a different length are a different key
+    Bytes shorter = {.data = packet, .length = 5};
+    Key shorter_key = {.type = BYTES_TYPE, .data.bytes = &shorter};
+    passed = passed && !hash_table_contains(map, &shorter_key);
+    Value int_value = {.type = INTEGER_TYPE, .data.integer = 5};
+    passed = passed && hash_table_insert(map, &shorter_key, &int_value) && (hash_table_key_count(map) == 1001);
+    for (int i = 0; i < 1000; i++) {
+        Bytes field = {.data = packet + 8 * i, .length = 6};
+        Key key = {.type = BYTES_TYPE, .data.bytes = &field};
+        Entry *found = hash_table_entry_lookup(map, &key);
+        passed = passed && found && (found->key.data.bytes->data != field.data) && (found->value.type == BYTES_TYPE) &&
+                 (found->value.data.bytes->length == 6) && (memcmp(found->value.data.bytes->data, packet + 8 * i, 6) == 0);
+    }
+    for (int i = 0; i < 1000; i += 2) {
+        Bytes field = {.data = packet + 8 * i, .length = 6};
+        Key key = {.type = BYTES_TYPE, .data.bytes = &field};
+        passed = passed && hash_table_entry_delete(map, &key);
+    }
+    Dump_buffer dump = {0};
+    passed = passed && hash_table_dump(map, dump_buffer_write, &dump) && hash_table_restore(restored, dump_buffer_read, &dump);
+    passed = passed && (hash_table_key_count(restored) == 501);
+    Key *keys = get_hash_table_keys(map);
+    for (size_t i = 0; keys && i < hash_table_key_count(map); i++) {
+        Entry *in_map = hash_table_entry_lookup(map, &keys[i]);
+        Entry *in_restored = hash_table_entry_lookup(restored, &keys[i]);
+        passed = passed && in_restored && (in_restored->value.type == in_map->value.type);
+        passed = passed && (in_map->value.type != BYTES_TYPE || (in_restored->value.data.bytes->length == in_map->value.data.bytes->length &&
+                 memcmp(in_restored->value.data.bytes->data, in_map->value.data.bytes->data, in_map->value.data.bytes->length) == 0));
+        delete_key(keys[i]);
+    }
+    free(keys);
+    free(dump.data);
+    hash_table_destroy(&map);
+    hash_table_destroy(&restored);
+    printf("%s test: %s\n", name, passed ? "passed" : "FAILED");
+    return passed;
+}
+
+// maps that borrow the caller's strings, and moves that hand malloc'd strings over to the map
+bool test_borrowed_and_moved_strings(HashMap_options options, const char *name) {
+    bool passed = true;
+    // string literals would crash free(), so the borrowing map must never free what it is given
+    char *words[] = {"red", "green", "blue", "cyan", "magenta", "yellow"};
+    HashMap_options borrowing = options;
+    borrowing.borrow_strings = true;
+    HashMap *map = hash_table_create_with_options(4, STRING_TYPE, &borrowing);
+    passed = passed && ((map != NULL) != options.use_string_arena); // borrowing and an arena do not mix
+    for (size_t i = 0; map && i < 6; i++) {
+        Key key = {.type = STRING_TYPE, .data.string = words[i]};
+        Value value = {.type = STRING_TYPE, .data.string = words[5 - i]};
+        passed = passed && hash_table_insert(map, &key, &value);
+    }
+    char buffer[20];
+    strcpy(buffer, "blue");
+    Key lookup_key = {.type = STRING_TYPE, .data.string = buffer};
+    Entry *found = map ? hash_table_entry_lookup(map, &lookup_key) : NULL;
+    passed = passed && (!map || (found && (found->key.data.string == words[2]) && (found->value.data.string == words[3])));
+    passed = passed && (!map || (hash_table_entry_delete(map, &lookup_key) && hash_table_batch_insert(map, words, words, 6, STRING_TYPE, STRING_TYPE)));
+    Key moved_key = to_key("grey", STRING_TYPE);
+    Value moved_value = to_value("grey", STRING_TYPE);
+    passed = passed && (!map || !hash_table_insert_move(map, &moved_key, &moved_value)); // nothing would ever free them
+    Dump_buffer dump = {0};
+    passed = passed && (!map || (hash_table_dump(map, dump_buffer_write, &dump) && !hash_table_restore(map, dump_buffer_read, &dump)));
+    if (map) {
+        hash_table_destroy(&map);
+    }
+
+    // moved strings become the map's own copies
+    map = hash_table_create_with_options(4, STRING_TYPE, &options);
+    passed = passed && map;
+    char *moved_pointer = moved_key.data.string;
+    passed = passed && map && hash_table_insert_move(map, &moved_key, &moved_value);
+    passed = passed && (moved_key.data.string == NULL) && (moved_value.data.string == NULL);
+    lookup_key.data.string = "grey";
+    found = map ? hash_table_entry_lookup(map, &lookup_key) : NULL;
+    passed = passed && found && (strcmp(found->value.data.string, "grey") == 0);
+    passed = passed && found && (options.use_string_arena || found->key.data.string == moved_pointer);
+    // moving a key that is already there keeps the old key and frees the moved one
+    for (int i = 0; map && i < 200; i++) {
+        sprintf(buffer, "key %d", i % 50);
+        Key key = to_key(buffer, STRING_TYPE);
+        Value value = to_value(buffer, STRING_TYPE);
+        passed = passed && hash_table_insert_move(map, &key, &value);
+        delete_key(key); // does nothing after a move
+        delete_value(value);
+    }
+    passed = passed && map && (hash_table_key_count(map) == 51);
+    delete_key(moved_key);
+    delete_value(moved_value);
+    free(dump.data);
+    hash_table_destroy(&map);
+    printf("%s test: %s\n", name, passed ? "passed" : "FAILED");
+    return passed;
+}
+
+// full dumps, then checkpoints of only the buckets that changed, replayed into copies of the map
+bool test_dump_and_checkpoints(void) {
+    HashMap *source = hash_table_create(5, INTEGER_TYPE);
+    HashMap *copy = hash_table_create_with_options(16, INTEGER_TYPE, &(HashMap_options){.storage_type = SWISS_STORAGE});
+    HashMap *replica = hash_table_create(5, INTEGER_TYPE);
+    if (!source || !copy || !replica) {
+        printf("Failed to create hash maps for the dump test!\n");
+        return false;
+    }
+    bool passed = true;
+    char buffer[20];
+    for (int i = 0; i < 5000; i++) {
+        sprintf(buffer, "value %d", i);
+        Key key = to_key(&i, INTEGER_TYPE);
+        Value value = (i % 2) ? to_value(buffer, STRING_TYPE) : to_value(&i, INTEGER_TYPE);
+        passed = passed && hash_table_insert(source, &key, &value);
+        delete_value(value);
+    }
+    // a full dump replaces whatever the target held
+    int stale = -1;
+    Key stale_key = to_key(&stale, INTEGER_TYPE);
+    Value stale_value = to_value(&stale, INTEGER_TYPE);
+    passed = passed && hash_table_insert(copy, &stale_key, &stale_value);
+    Dump_buffer dump = {0};
+    passed = passed && hash_table_dump(source, dump_buffer_write, &dump);
+    passed = passed && hash_table_restore(copy, dump_buffer_read, &dump) && maps_match(source, copy);
+
+    // the first checkpoint is full, the next one only has the changes
+    Dump_buffer first = {0}, second = {0};
+    passed = passed && hash_table_enable_dirty_tracking(source);
+    passed = passed && hash_table_checkpoint(source, dump_buffer_write, &first);
+    passed = passed && hash_table_restore(replica, dump_buffer_read, &first) && maps_match(source, replica);
+    for (int i = 5000; i < 5010; i++) {
+        Key key = to_key(&i, INTEGER_TYPE);
+        Value value = to_value("new", STRING_TYPE);
+        passed = passed && hash_table_insert(source, &key, &value);
+        delete_value(value);
+    }
+    for (int i = 0; i < 100; i += 20) {
+        Key key = to_key(&i, INTEGER_TYPE);
+        Value value = to_value("replaced", STRING_TYPE);
+        passed = passed && hash_table_insert(source, &key, &value);
+        delete_value(value);
+    }
+    for (int i = 1; i < 50; i += 7) {
+        Key key = to_key(&i, INTEGER_TYPE);
+        passed = passed && hash_table_entry_delete(source, &key);
+    }
+    passed = passed && hash_table_checkpoint(source, dump_buffer_write, &second);
+    passed = passed && (second.size * 20 < first.size);
+    passed = passed && hash_table_restore(replica, dump_buffer_read, &second) && maps_match(source, replica);
+
+    free(dump.data);
+    free(first.data);
+    free(second.data);
+    hash_table_destroy(&source);
+    hash_table_destroy(&copy);
+    hash_table_destroy(&replica);
+    printf("dump and checkpoint test: %s\n", passed ? "passed" : "FAILED");
+    return passed;
+}
 
 int main() {
     printf("Start of main test....\n");
@@ -56,6 +1544,80 @@ int main() {
     hash_table_print(map);
     hash_table_debug_print(map);
     hash_table_destroy(&map);
+
+    printf("\ntesting every storage layout...\n");
+    if (!test_map_options((HashMap_options){.storage_type = CHAINING_STORAGE}, "chaining") ||
+        !test_map_options((HashMap_options){.storage_type = LINEAR_PROBING_STORAGE}, "linear probing") ||
+        !test_map_options((HashMap_options){.storage_type = ROBIN_HOOD_STORAGE}, "robin hood") ||
+        !test_map_options((HashMap_options){.storage_type = SWISS_STORAGE}, "swiss table") ||
+        !test_map_options((HashMap_options){.use_entry_slab = true}, "chaining with entry slabs") ||
+        !test_map_options((HashMap_options){.use_string_arena = true}, "chaining with a string arena") ||
+        !test_map_options((HashMap_options){.use_entry_slab = true, .use_string_arena = true}, "chaining with entry slabs and a string arena") ||
+        !test_map_options((HashMap_options){.storage_type = SWISS_STORAGE, .use_string_arena = true}, "swiss table with a string arena") ||
+        !test_map_options((HashMap_options){.power_of_two_buckets = true}, "chaining with power of 2 buckets") ||
+        !test_map_options((HashMap_options){.storage_type = LINEAR_PROBING_STORAGE, .power_of_two_buckets = true}, "linear probing with power of 2 slots") ||
+        !test_map_options((HashMap_options){.storage_type = ROBIN_HOOD_STORAGE, .power_of_two_buckets = true}, "robin hood with power of 2 slots") ||
+        !test_map_options((HashMap_options){.incremental_resize = true}, "chaining with incremental resizing") ||
+        !test_map_options((HashMap_options){.incremental_resize = true, .power_of_two_buckets = true, .use_entry_slab = true}, "chaining with incremental resizing, power of 2 buckets and slabs")) {
+        return EXIT_FAILURE;
+    }
+    if (!test_concurrent_map(false, "concurrent map") || !test_concurrent_map(true, "concurrent map with lock-free reads") ||
+        !test_parallel_build((HashMap_options){.power_of_two_buckets = true}, "parallel build") ||
+        !test_parallel_build((HashMap_options){.power_of_two_buckets = true, .use_entry_slab = true, .use_string_arena = true}, "parallel build with slabs and a string arena") ||
+        !test_parallel_build((HashMap_options){.storage_type = SWISS_STORAGE}, "parallel build fallback (swiss table)") ||
+        !test_snapshot((HashMap_options){.storage_type = CHAINING_STORAGE}, STRING_TYPE, "snapshot of string keys") ||
+        !test_snapshot((HashMap_options){.storage_type = SWISS_STORAGE, .use_string_arena = true}, INTEGER_TYPE, "snapshot of a swiss table") ||
+        !test_scan((HashMap_options){.power_of_two_buckets = true}, "scan") ||
+        !test_scan((HashMap_options){.power_of_two_buckets = true, .incremental_resize = true}, "scan during incremental resizing") ||
+        !test_dump_and_checkpoints() || !test_typed_maps() ||
+        !test_custom_keys((HashMap_options){.storage_type = CHAINING_STORAGE}, "custom keys") ||
+        !test_custom_keys((HashMap_options){.storage_type = SWISS_STORAGE}, "custom keys in a swiss table") ||
+        !test_custom_keys((HashMap_options){.storage_type = ROBIN_HOOD_STORAGE}, "custom keys with robin hood") ||
+        !test_custom_keys((HashMap_options){.use_entry_slab = true, .power_of_two_buckets = true}, "custom keys in entry slabs") ||
+        !test_byte_keys((HashMap_options){.storage_type = CHAINING_STORAGE}, "byte string keys") ||
+        !test_byte_keys((HashMap_options){.storage_type = SWISS_STORAGE, .use_string_arena = true}, "byte string keys in a swiss table with a string arena") ||
+        !test_byte_keys((HashMap_options){.storage_type = ROBIN_HOOD_STORAGE}, "byte string keys with robin hood") ||
+        !test_borrowed_and_moved_strings((HashMap_options){.use_entry_slab = true}, "borrowed and moved strings") ||
+        !test_borrowed_and_moved_strings((HashMap_options){.storage_type = SWISS_STORAGE}, "borrowed and moved strings in a swiss table") ||
+        !test_borrowed_and_moved_strings((HashMap_options){.use_string_arena = true}, "moved strings with a string arena") ||
+        !test_get_or_insert((HashMap_options){.storage_type = CHAINING_STORAGE}, "get or insert") ||
+        !test_get_or_insert((HashMap_options){.storage_type = LINEAR_PROBING_STORAGE}, "get or insert with linear probing") ||
+        !test_get_or_insert((HashMap_options){.storage_type = ROBIN_HOOD_STORAGE, .power_of_two_buckets = true}, "get or insert with robin hood") ||
+        !test_get_or_insert((HashMap_options){.storage_type = SWISS_STORAGE, .use_string_arena = true}, "get or insert in a swiss table with a string arena") ||
+        !test_get_or_insert((HashMap_options){.incremental_resize = true, .use_entry_slab = true}, "get or insert during incremental resizing") ||
+        !test_batch_delete_and_retain((HashMap_options){.storage_type = CHAINING_STORAGE}, "batch delete and retain") ||
+        !test_batch_delete_and_retain((HashMap_options){.storage_type = LINEAR_PROBING_STORAGE}, "batch delete and retain with linear probing") ||
+        !test_batch_delete_and_retain((HashMap_options){.storage_type = ROBIN_HOOD_STORAGE}, "batch delete and retain with robin hood") ||
+        !test_batch_delete_and_retain((HashMap_options){.storage_type = SWISS_STORAGE, .use_string_arena = true}, "batch delete and retain in a swiss table") ||
+        !test_batch_delete_and_retain((HashMap_options){.incremental_resize = true, .power_of_two_buckets = true}, "batch delete and retain during incremental resizing") ||
+        !test_cache((HashMap_options){.storage_type = CHAINING_STORAGE}, "cache") ||
+        !test_cache((HashMap_options){.use_entry_slab = true, .power_of_two_buckets = true}, "cache in entry slabs") ||
+        !test_cache((HashMap_options){.storage_type = LINEAR_PROBING_STORAGE}, "cache with linear probing") ||
+        !test_cache((HashMap_options){.storage_type = ROBIN_HOOD_STORAGE}, "cache with robin hood") ||
+        !test_cache((HashMap_options){.storage_type = SWISS_STORAGE}, "cache in a swiss table") ||
+        !test_cache((HashMap_options){.incremental_resize = true}, "cache during incremental resizing") ||
+        !test_ttl((HashMap_options){.storage_type = CHAINING_STORAGE}, "ttl") ||
+        !test_ttl((HashMap_options){.use_entry_slab = true, .power_of_two_buckets = true}, "ttl in entry slabs") ||
+        !test_ttl((HashMap_options){.incremental_resize = true}, "ttl during incremental resizing") ||
+        !test_stats((HashMap_options){.storage_type = CHAINING_STORAGE}, "stats") ||
+        !test_stats((HashMap_options){.storage_type = ROBIN_HOOD_STORAGE}, "stats with robin hood") ||
+        !test_stats((HashMap_options){.storage_type = SWISS_STORAGE}, "stats in a swiss table") ||
+        !test_memory_and_sizing((HashMap_options){.storage_type = CHAINING_STORAGE}, "memory and sizing") ||
+        !test_memory_and_sizing((HashMap_options){.use_entry_slab = true, .use_string_arena = true}, "memory and sizing with slabs and an arena") ||
+        !test_memory_and_sizing((HashMap_options){.storage_type = LINEAR_PROBING_STORAGE, .power_of_two_buckets = true}, "memory and sizing with linear probing") ||
+        !test_memory_and_sizing((HashMap_options){.storage_type = ROBIN_HOOD_STORAGE}, "memory and sizing with robin hood") ||
+        !test_memory_and_sizing((HashMap_options){.storage_type = SWISS_STORAGE}, "memory and sizing in a swiss table") ||
+        !test_set_algebra((HashMap_options){.storage_type = CHAINING_STORAGE}, "set algebra") ||
+        !test_set_algebra((HashMap_options){.use_entry_slab = true, .use_string_arena = true}, "set algebra with slabs and an arena") ||
+        !test_set_algebra((HashMap_options){.power_of_two_buckets = true, .incremental_resize = true}, "set algebra during incremental resizing") ||
+        !test_set_algebra((HashMap_options){.storage_type = ROBIN_HOOD_STORAGE}, "set algebra with robin hood") ||
+        !test_set_algebra((HashMap_options){.storage_type = SWISS_STORAGE}, "set algebra in a swiss table") ||
+        !test_set_algebra((HashMap_options){.seeded_hashing = true, .tree_bin_threshold = 8}, "set algebra with seeded hashing and tree bins") ||
+        !test_hash_flooding((HashMap_options){.tree_bin_threshold = 8}, "hash flooding") ||
+        !test_hash_flooding((HashMap_options){.tree_bin_threshold = 8, .use_entry_slab = true, .power_of_two_buckets = true}, "hash flooding in entry slabs") ||
+        !test_hash_flooding((HashMap_options){.tree_bin_threshold = 4, .seeded_hashing = true}, "hash flooding with seeded hashing")) {
+        return EXIT_FAILURE;
+    }
     return 0;
     
 
@@ -0,0 +1,8 @@
+/* The compiled library (libhashmap, see the makefile): the definitions of hashmap.h, concurrent_hashmap.h and
+*  hashmap_snapshot.h in one translation unit, since they share the implementation's internal helpers.
+*  Programs linking it only include the headers
+*/
+#define HASHMAP_IMPLEMENTATION
+#include "hashmap.h"
+#include "concurrent_hashmap.h"
+#include "hashmap_snapshot.h"
@@ -5,15 +5,32 @@
 /* A library for flexible hashmaps that can support any combination of keys and values as long as they are valid options of the  DATA_TYPE enum 
 *  ALL KEYS MUST HAVE THE SAME DATATYPE FOR ANY SINGLE HASHMAP. However, values can be any valid datatype in the same hashmap
 *  Hash maps will resize dynamically depending on the load factor when insertions/deletions occur, so the user does not need to worry about resizing
+*
+*  This header declares the API. The definitions are compiled in where HASHMAP_IMPLEMENTATION is defined before it is
+*  included: either link libhashmap (hashmap.c, `make lib`), or define it in exactly one .c file of the program to use the
+*  headers as single header libraries. That file must also be the one including concurrent_hashmap.h and
+*  hashmap_snapshot.h with the define if those are used, since they share the implementation's internal helpers.
+*  HASHMAP_STATS changes the layout of HashMap, so the library and everything using it must be built with the same setting
 */
 
 #include <stdio.h> // printing
 #include <stdlib.h> // malloc and free
 #include <stdbool.h> // function definitions
 #include <string.h> // strdup mostly
+#include <stdint.h> // fixed width integers for hash mixing
+#include <time.h> // the monotonic clock TTL deadlines are measured on
 
+// SIMD compares for scanning swiss table control bytes 16 at a time (there is a portable fallback)
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+// the default thresholds of shrinking and growing (see HashMap_options.min_load_factor and max_load_factor)
 #define MIN_LOAD_FACTOR (0.125)
 #define MAX_LOAD_FACTOR (0.75)
+#define SWISS_MAX_LOAD_FACTOR (0.875) // full + deleted slots a swiss table allows before it is rebuilt
 
 // potential data types we can have
 typedef enum {
@@ -21,18 +38,28 @@ typedef enum {
     STRING_TYPE,
     FLOAT_TYPE,
     DOUBLE_TYPE,
-    CUSTOM_TYPE, // not used here
+    CUSTOM_TYPE, // keys described by caller supplied hooks (see Key_ops and HashMap_options.custom_key_ops)
+    BYTES_TYPE, // a run of bytes with an explicit length that may contain zeros (see Bytes)
     // this is only for when we return structs that have DATA_TYPES and there was an error (see to_key() and to_value())
     INVALID_TYPE = -1 
 } DATA_TYPE;
 
 
+/* the data of a BYTES_TYPE datapoint. Keys and values passed in can point into any buffer (a network packet, say): the map
+   copies the descriptor and the bytes into one block of its own, and every copy handed out is such a block (one free()) */
+typedef struct {
+    const void *data;
+    size_t length;
+} Bytes;
+
 // a datapoint can be any type but only ever one of them
 typedef union {
     int integer;
     char *string;
     float float_value;
     double double_value;
+    void *custom; // CUSTOM_TYPE: whatever the map's Key_ops hooks understand
+    Bytes *bytes; // BYTES_TYPE
 } Data;
 
 /* KEY and VALUE structs */
@@ -53,24 +80,388 @@ typedef struct {
 typedef struct Entry {
     Key key;
     Value value;
-    struct Entry *next; // For handling collisions via chaining (linked list)
+    size_t hash; // key_ops.hash_func() of the key, computed once at insertion and reused by resizes and comparisons
+    struct Entry *next; // For handling collisions via chaining (linked list). Unused by open addressing storage
+    uint64_t expires_at : 63; // ttl_clock() time the entry expires at (see hash_table_insert_with_ttl()), 0 if it never does
+    uint64_t referenced : 1; // CLOCK bit of cache maps: set by lookups and value replacements, cleared as the eviction hand passes
 } Entry;
 
+// a block of chained entries handed out by a map's slab allocator (see HashMap_options)
+typedef struct Entry_slab {
+    struct Entry_slab *next; // the previously allocated (smaller) slab
+    size_t capacity; // how many entries fit in this slab
+    size_t used; // entries handed out from this slab so far
+    Entry entries[];
+} Entry_slab;
+
+// a block of string bytes in a map's append-only string arena (see HashMap_options)
+typedef struct String_arena_chunk {
+    struct String_arena_chunk *next; // the previously filled chunk
+    size_t capacity; // bytes available in this chunk
+    size_t used; // bytes handed out so far
+    char bytes[];
+} String_arena_chunk;
+
+/* a node of a tree bin: an AVL tree ordered by (hash, key) that indexes the entries of one long chain, so looking a key up
+   in it takes O(log n) comparisons (see HashMap_options.tree_bin_threshold). The chain itself stays a linked list */
+typedef struct Tree_node {
+    Entry *entry;
+    Entry *previous; // the entry before this one in the chain, NULL for the bucket's head (so it can be unlinked in O(1))
+    struct Tree_node *left;
+    struct Tree_node *right;
+    int height; // of the subtree rooted here, 1 for a leaf
+} Tree_node;
+
 // a struct for each hash map that stores the functions we will use (depends on key type)
 typedef struct {
     size_t (*hash_func)(const Key *key); // hash functions will take any key
-    int (*cmp_func)(const Key *a, const Key *b); // comparison operations will take any two keys OF THE SAME TYPE
+    /* comparison operations will take any two keys OF THE SAME TYPE and return 0 when they are equal. Maps with tree bins
+       also sort colliding keys by it, so there it has to be a total order (negative, 0 or positive like strcmp) */
+    int (*cmp_func)(const Key *a, const Key *b);
+    /* CUSTOM_TYPE keys only, NULL for the built in types. clone_func makes the copy of key.data.custom the map stores
+       (NULL: the map stores the caller's pointer as is) and destroy_func frees a stored copy when its key leaves the map
+       (NULL: nothing is freed). With clone_func NULL and destroy_func set the map takes ownership of inserted keys */
+    void *(*clone_func)(const void *data);
+    void (*destroy_func)(void *data);
 } Key_ops;
 
-// HashMap structure definition
+// the ways a hash map can lay out its entries in memory. Chosen once when the map is created
+typedef enum {
+    CHAINING_STORAGE, // an array of buckets, each one a linked list of malloc'd entries (the default)
+    LINEAR_PROBING_STORAGE, // open addressing: entries live inline in one contiguous array, collisions probe the next slot
+    ROBIN_HOOD_STORAGE, // open addressing like linear probing, but entries far from their home slot displace closer ones
+    SWISS_STORAGE // open addressing with 1 byte control tags per slot, scanned 16 slots at a time. Bucket counts become powers of 2
+} STORAGE_TYPE;
+
+struct HashMap;
+
+// decides which entries hash_table_retain() keeps (true keeps the entry). Must not insert into or delete from the map
+typedef bool (*Retain_func)(const Entry *entry, void *context);
+
+// a struct for each hash map that stores the functions implementing its storage layout (depends on storage type)
+typedef struct {
+    // inserts or replaces, does not check the load factor. hash is key_hash() of the key
+    bool (*insert)(struct HashMap *map, const Key *key, const Value *value, size_t hash);
+    Entry *(*lookup)(const struct HashMap *map, const Key *key, size_t hash); // hash is key_hash() of the key
+    bool (*remove)(struct HashMap *map, const Key *key); // does not check the load factor
+    bool (*resize)(struct HashMap *map, size_t new_bucket_count);
+    void (*clear)(struct HashMap *map); // frees every entry but keeps the bucket/slot arrays
+    // walks all entries: start with *position = 0 and previous = NULL, then pass back the last returned entry. NULL when done
+    Entry *(*next_entry)(const struct HashMap *map, size_t *position, const Entry *previous);
+    // deletes every entry keep() rejects in one pass over the storage, returns how many. Does not check the load factor
+    size_t (*retain)(struct HashMap *map, Retain_func keep, void *context);
+} Storage_ops;
+
+// optional settings for hash_table_create_with_options(). A zero-initialized struct gives the same map as hash_table_create()
+typedef struct {
+    STORAGE_TYPE storage_type; // memory layout of the entries (see enum)
+    bool use_entry_slab; // carve chained entries out of large slabs instead of one malloc per key (chaining storage only)
+    /* copy key and value strings into one append-only arena instead of strdup'ing each one. Replaced or deleted strings
+       are only reclaimed by hash_table_clear()/hash_table_destroy(), so this suits maps that mostly grow */
+    bool use_string_arena;
+    /* store key and value strings (and byte strings) as the caller's pointers: nothing is copied on insert or freed on
+       delete/destroy, so they must stay valid for as long as their entries are in the map. Cannot be combined with use_string_arena */
+    bool borrow_strings;
+    /* round bucket counts to powers of 2 and index with a bitmask instead of a modulus. Hashes are mixed first so keys
+       with patterns in their low bits (like sequential ints) still spread. Swiss storage always does this */
+    bool power_of_two_buckets;
+    /* resize by keeping the old and new bucket arrays side by side and migrating a few buckets on every insert, lookup
+       and delete, instead of rehashing everything at once (chaining storage only) */
+    bool incremental_resize;
+    /* fix the type of every value to value_type at creation, the way key_type is fixed. Inserting any other type fails.
+       (For int -> int style maps without any per entry type tags at all see HASHMAP_DECLARE_PACKED in typed_hashmap.h) */
+    bool fixed_value_type;
+    DATA_TYPE value_type; // only read when fixed_value_type is set
+    const Key_ops *custom_key_ops; // hash/compare/clone/destroy hooks, required for CUSTOM_TYPE keys (ignored otherwise)
+    /* cache mode: once inserting a new key would go past either limit, entries are evicted with the CLOCK policy (entries
+       that were looked up since the hand last passed them get a second chance). 0 means no limit, both 0 is a normal map.
+       cache_byte_capacity counts sizeof(Entry) per entry plus the strings and byte strings the map holds copies of
+       (with use_string_arena the copies of evicted strings are only reclaimed by hash_table_clear()) */
+    size_t cache_capacity;
+    size_t cache_byte_capacity;
+    uint64_t (*ttl_clock)(void); // current time in milliseconds for TTLs (NULL uses the monotonic clock)
+    /* the table doubles once an insert takes the load factor (keys per bucket) past max_load_factor, and deletes shrink it
+       in steps of 3/4 while it is below min_load_factor. 0 picks MIN_LOAD_FACTOR/MAX_LOAD_FACTOR. Chaining can go past 1,
+       open addressing must stay below 1 (swiss tables below SWISS_MAX_LOAD_FACTOR), and max has to be at least twice
+       min so that a shrink is not undone by the next insert */
+    float min_load_factor;
+    float max_load_factor;
+    /* hash flooding resistance for keys from untrusted sources: keys are hashed with SipHash-1-3 under the 128 bit key
+       hash_seed (picked at random from /dev/urandom when it is all zeros), so nobody can predict which keys collide.
+       Strings and byte strings are hashed byte by byte, the other types through their hash_func(). Dumps, checkpoints and
+       snapshots never contain hashes, so they restore into maps seeded differently (or not at all). Maps given the same
+       seed can be merged in lockstep (see hash_table_merge()) */
+    bool seeded_hashing;
+    uint64_t hash_seed[2];
+    /* chaining only (without incremental_resize): a chain that grows past this many entries gets a tree bin, like Java's
+       HashMap, bounding lookups in buckets that many keys collide in to O(log n) comparisons. 0 never makes any. Around 8
+       keeps the trees to chains that only collisions or a bad hash produce. Resizes rebuild the trees of the new chains.
+       CUSTOM_TYPE keys need a cmp_func that is a total order, not just an equality test (see Key_ops) */
+    size_t tree_bin_threshold;
+} HashMap_options;
+
+#define TTL_WHEEL_LEVELS 4
+#define TTL_WHEEL_BITS 6
+#define TTL_WHEEL_SLOTS (1 << TTL_WHEEL_BITS) // slots per level. Each level's slots span 64 times those of the level below
+
+// a pending expiry: the entries with this hash are checked once the deadline has passed
 typedef struct {
-    Entry **buckets; // pointer to list of buckets
+    size_t hash;
+    uint64_t deadline;
+} Ttl_timer;
+
+typedef struct {
+    Ttl_timer *timers;
+    size_t count;
+    size_t capacity;
+} Ttl_wheel_slot;
+
+/* hierarchical timer wheel of a map with TTL entries: level 0 has one slot per millisecond, and the timers of a higher
+   level slot are spread over the level below when the wheel reaches it */
+typedef struct {
+    Ttl_wheel_slot slots[TTL_WHEEL_LEVELS][TTL_WHEEL_SLOTS];
+    uint64_t time; // the level 0 slot handled next (ttl_clock() milliseconds)
+} Ttl_wheel;
+
+/* what the hot paths count when the library is compiled with -DHASHMAP_STATS (see hash_table_get_stats()). The define
+   changes the layout of HashMap, so every file including this header has to agree on it */
+typedef struct {
+    size_t inserts; // keys added by inserts
+    size_t updates; // inserts that replaced the value of a key already in the map
+    size_t hits; // lookups that found their key (get_or_insert and update included)
+    size_t misses;
+    size_t deletes; // entries deleted by hash_table_entry_delete(), hash_table_batch_delete() and hash_table_retain()
+    size_t resizes; // rehashes of the whole table, including the ones storages do on their own
+    uint64_t resize_nanoseconds; // time spent in them (incremental resizes only count the start)
+} HashMap_counters;
+
+// HashMap structure definition
+typedef struct HashMap {
+    Entry **buckets; // pointer to list of buckets (chaining storage only)
+    Entry *slots; // inline array of bucket_count entries (open addressing storage only)
+    size_t *probe_distances; // per slot: 0 if empty, else 1 + distance from the slot the key hashes to (linear probing/Robin Hood only)
+    signed char *control_bytes; // per slot: empty/deleted marker or 7 bits of the key's hash (swiss storage only)
+    size_t deleted_slots; // slots marked as deleted that still lengthen probes (swiss storage only)
     size_t bucket_count; // how many buckets can be filled at most
+    float min_load_factor; // deletes shrink the table below this load factor (see HashMap_options)
+    float max_load_factor; // inserts grow the table past this load factor
     Key_ops key_ops; // the two functions we will be using for hasing/comparison
     DATA_TYPE key_type; // the type of key the hash map has (see enum)
+    DATA_TYPE value_type; // the type every value must have, INVALID_TYPE if values can have any type (see HashMap_options)
+    STORAGE_TYPE storage_type; // how entries are laid out (see enum)
+    bool power_of_two_buckets; // bucket_count is always a power of 2, indexes come from masking the mixed hash
+    Storage_ops storage_ops; // the functions implementing the storage layout
     size_t key_count; // number of keys currently in the table
+    size_t owned_strings; // strdup'd strings and cloned custom keys the entries own (clearing a slab map owning none skips the walk)
+    bool use_entry_slab; // chained entries come from the slabs below instead of malloc
+    Entry_slab *slabs; // most recent (largest) slab first
+    Entry *free_entries; // nodes of deleted entries waiting to be reused, linked through next
+    bool use_string_arena; // key/value strings are copied into the arena below instead of being strdup'd
+    String_arena_chunk *string_arena; // most recent chunk first
+    bool borrow_strings; // strings and byte strings are the caller's, never copied or freed (see HashMap_options)
+    bool adopt_data; // set during hash_table_insert_move(): the caller's malloc'd strings are taken over instead of copied
+    bool incremental_resize; // resizes migrate entries a few buckets at a time (see HashMap_options)
+    Entry **old_buckets; // bucket array being migrated away from, NULL when no incremental resize is in progress
+    size_t old_bucket_count; // size of old_buckets
+    size_t rehash_index; // old buckets below this index have already been migrated
+    size_t rehash_pauses; // iterators and scans in progress. Lookups do not migrate buckets while this is non-zero
+    bool dirty_tracking; // changes are tracked for hash_table_checkpoint() (see hash_table_enable_dirty_tracking())
+    uint64_t *dirty_buckets; // one bit per bucket changed since the last checkpoint. NULL means the next checkpoint is full
+    Key *deleted_keys; // copies of the keys deleted since the last checkpoint
+    size_t deleted_key_count;
+    size_t deleted_key_capacity;
+    bool cache_mode; // entries are evicted to stay within cache_capacity/cache_byte_capacity (see HashMap_options)
+    size_t cache_capacity; // most entries a cache map holds, 0 for no limit
+    size_t cache_byte_capacity; // most bytes a cache map's entries hold, 0 for no limit
+    size_t cache_bytes; // bytes the entries of a cache map hold right now (kept up to date in cache maps only)
+    size_t cache_hand; // next_entry() position the CLOCK hand continues from
+    size_t cache_hits; // lookups of a cache map that found their key
+    size_t cache_misses;
+    size_t cache_evictions;
+    uint64_t (*ttl_clock)(void); // milliseconds that TTL deadlines are measured in (see HashMap_options)
+    Ttl_wheel *ttl_wheel; // timers of the TTL entries, NULL until the first hash_table_insert_with_ttl()
+    bool seeded_hashing; // keys are hashed with SipHash-1-3 under hash_seed (see HashMap_options)
+    uint64_t hash_seed[2];
+    size_t tree_bin_threshold; // chains longer than this get a tree bin, 0 if none ever do (see HashMap_options)
+    Tree_node **tree_bins; // per bucket: the root of its tree bin, or NULL. The array is NULL until the first tree bin
+    size_t tree_node_count; // nodes in all the tree bins
+#ifdef HASHMAP_STATS
+    HashMap_counters counters;
+#endif
 } HashMap;
 
+/* adds amount to one of the map's counters when statistics are compiled in, and compiles to nothing otherwise (amount
+   must not have side effects). Lookups take const maps, the counters are not part of what the map holds. The add is a
+   relaxed atomic because readers sharing a concurrent map's read lock all count their hits and misses at once */
+#ifdef HASHMAP_STATS
+#define HASHMAP_COUNT(map, counter, amount) ((void)__atomic_fetch_add(&(((HashMap *)(map))->counters.counter), (amount), __ATOMIC_RELAXED))
+#else
+#define HASHMAP_COUNT(map, counter, amount) ((void)(amount))
+#endif
+
+#define HASHMAP_STATS_HISTOGRAM_SIZE 16 // lengths counted one by one, the last one also counts everything longer
+
+// the counters plus the shape of the table, see hash_table_get_stats()
+typedef struct {
+    bool counters_enabled; // false (and the counters all 0) unless compiled with -DHASHMAP_STATS
+    HashMap_counters counters;
+    /* chaining: how many buckets have a chain of i entries. Open addressing: how many entries sit i slots into their probe
+       sequence (1 is the home slot). Swiss tables: how many entries sit in the i-th group of their probe sequence */
+    size_t length_histogram[HASHMAP_STATS_HISTOGRAM_SIZE];
+    size_t max_length; // longest chain, probe or group sequence
+    double mean_length; // average length a lookup of a key in the map walks (entries per chain for chaining)
+} HashMap_stats;
+
+/* where the memory of a map goes, in bytes (see hash_table_memory_usage()). Data cloned by the hooks of CUSTOM_TYPE keys is
+   not counted, the map cannot see its size */
+typedef struct {
+    size_t map; // the HashMap itself
+    size_t table; // the bucket or slot arrays with their per slot metadata (both bucket arrays during an incremental resize)
+    size_t entries; // chained entries, or the whole entry slabs with use_entry_slab. Open addressing entries are in table
+    size_t strings; // copies of key and value strings and byte strings, or the whole arena with use_string_arena
+    size_t bookkeeping; // checkpoint dirty bits and deleted keys, TTL timers
+    size_t allocator_overhead; // estimated malloc headers and rounding of all of the above
+    size_t total; // the sum of the above
+} HashMap_memory;
+
+// counters of a cache map (see hash_table_cache_stats())
+typedef struct {
+    size_t hits;
+    size_t misses;
+    size_t evictions;
+    size_t entries;
+    size_t bytes; // what cache_byte_capacity is compared against
+} HashMap_cache_stats;
+
+// receives the next size bytes of a dump (see hash_table_dump()). Returning false aborts the dump
+typedef bool (*Dump_write_func)(const void *data, size_t size, void *context);
+// must fill data with exactly the next size bytes of a dump (see hash_table_restore()). False at the end of the data or on errors
+typedef bool (*Dump_read_func)(void *data, size_t size, void *context);
+
+// walks the entries of a map in place without allocating (see hash_table_iter_init()). Meant to live on the caller's stack
+typedef struct {
+    const HashMap *map;
+    size_t position; // where the storage's next_entry() continues from
+    const Entry *current; // the entry returned last, NULL before the first hash_table_iter_next()
+    bool finished; // the walk ended (or hash_table_iter_end() was called) and the map no longer counts this iterator
+} HashMap_iterator;
+
+// called by hash_table_scan() for every entry it visits. Must not insert into or delete from the map
+typedef void (*Scan_func)(const Entry *entry, void *context);
+
+// called by hash_table_update() with the value stored for the key, to change it in place
+typedef void (*Update_func)(Value *value, void *context);
+
+/* settles a key both maps of hash_table_merge() hold. existing is the destination's value and can be changed in place (its
+   type must stay the same, like with Update_func), incoming is the source's. Return true to replace existing with incoming */
+typedef bool (*Merge_func)(Value *existing, const Value *incoming, void *context);
+
+/* HASHING AND SIZING HELPERS (inline everywhere, the typed maps of typed_hashmap.h use them too) */
+
+#define HASH_MULTIPLIER_1 (0xa0761d6478bd642fULL) // odd 64 bit constants with well spread bits (from wyhash)
+#define HASH_MULTIPLIER_2 (0xe7037ed1a0b428dbULL)
+
+// multiplies two 64 bit numbers and folds the 128 bit product into 64 bits, so every input bit affects every output bit
+static inline uint64_t folded_multiply(uint64_t a, uint64_t b) {
+#if defined(__SIZEOF_INT128__)
+    __uint128_t product = (__uint128_t)a * b;
+    return (uint64_t)product ^ (uint64_t)(product >> 64);
+#else
+    uint64_t a_low = (uint32_t)a, a_high = a >> 32, b_low = (uint32_t)b, b_high = b >> 32;
+    uint64_t low_low = a_low * b_low, low_high = a_low * b_high, high_low = a_high * b_low, high_high = a_high * b_high;
+    uint64_t middle = (low_low >> 32) + (uint32_t)low_high + (uint32_t)high_low;
+    uint64_t low = (middle << 32) | (uint32_t)low_low;
+    uint64_t high = high_high + (low_high >> 32) + (high_low >> 32) + (middle >> 32);
+    return low ^ high;
+#endif
+}
+
+/* finalizes a raw hash so that its low bits depend on all of its bits. Used whenever bucket indexes are taken with a
+   bitmask, since hash_int/hash_float/hash_double only return the key's own bits */
+static inline size_t mix_hash(size_t hash) {
+    return (size_t)folded_multiply((uint64_t)hash ^ HASH_MULTIPLIER_1, HASH_MULTIPLIER_2);
+}
+
+// rounds a requested bucket count (up or down) to a power of 2 that is at least minimum
+static inline size_t power_of_two_bucket_count(size_t requested, bool round_up, size_t minimum) {
+    size_t bucket_count = minimum;
+    while (bucket_count < requested) {
+        bucket_count *= 2;
+    }
+    if (!round_up && bucket_count > requested && bucket_count > minimum) {
+        bucket_count /= 2;
+    }
+    return bucket_count;
+}
+
+/* THE API (each function is documented at its definition below) */
+
+float get_hash_table_load_factor(const HashMap *map);
+size_t hash_bytes(const void *data, size_t length);
+size_t hash_int(const Key *key);
+size_t hash_string(const Key *key);
+size_t hash_float(const Key *key);
+size_t hash_double(const Key *key);
+size_t hash_byte_string(const Key *key);
+int cmp_int(const Key *a, const Key *b);
+int cmp_string(const Key *a, const Key *b);
+int cmp_byte_string(const Key *a, const Key *b);
+int cmp_float(const Key *a, const Key *b);
+int cmp_double(const Key *a, const Key *b);
+HashMap *hash_table_create_with_options(size_t desired_size, DATA_TYPE key_type, const HashMap_options *options);
+HashMap *hash_table_create(size_t desired_size, DATA_TYPE key_type);
+bool hash_table_resize(HashMap *map, size_t new_buckets_count);
+bool hash_table_reserve(HashMap *map, size_t key_count);
+bool hash_table_shrink_to_fit(HashMap *map);
+HashMap_cache_stats hash_table_cache_stats(const HashMap *map);
+bool hash_table_insert(HashMap *map, const Key *key, const Value *value);
+bool hash_table_insert_move(HashMap *map, Key *key, Value *value);
+bool hash_table_insert_with_ttl(HashMap *map, const Key *key, const Value *value, uint64_t ttl_milliseconds);
+Value *hash_table_get_or_insert(HashMap *map, const Key *key, const Value *default_value, bool *inserted);
+bool hash_table_update(HashMap *map, const Key *key, Update_func callback, void *context);
+Entry *hash_table_entry_lookup(const HashMap *map, const Key *key_to_search_for);
+bool hash_table_contains(const HashMap *map, const Key *key);
+bool hash_table_entry_delete(HashMap *map, const Key *key_to_delete);
+size_t hash_table_retain(HashMap *map, Retain_func keep, void *context);
+size_t hash_table_expire(HashMap *map, size_t budget);
+bool hash_table_merge(HashMap *destination, const HashMap *source, Merge_func conflict, void *context);
+bool hash_table_merge_move(HashMap *destination, HashMap **source, Merge_func conflict, void *context);
+size_t hash_table_intersect(HashMap *map, const HashMap *other);
+size_t hash_table_difference(HashMap *map, const HashMap *other);
+bool hash_table_destroy(HashMap **map);
+bool hash_table_clear(HashMap *map);
+void hash_table_print(const HashMap *map);
+Key *get_hash_table_keys(const HashMap *map);
+Value *get_hash_table_values(const HashMap *map);
+void hash_table_iter_init(HashMap_iterator *iterator, const HashMap *map);
+void hash_table_iter_end(HashMap_iterator *iterator);
+const Entry *hash_table_iter_next(HashMap_iterator *iterator);
+size_t hash_table_scan(const HashMap *map, size_t cursor, size_t bucket_budget, Scan_func callback, void *context);
+Key *convert_array_to_keys(void *array, size_t number_of_elements, const DATA_TYPE type);
+Value *convert_array_to_values(void *array, size_t number_of_elements, const DATA_TYPE type);
+Key to_key(const void *generic_pointer, const DATA_TYPE type);
+Value to_value(const void *generic_pointer, const DATA_TYPE type);
+void delete_key(Key key_to_delete);
+void delete_value(Value value_to_delete);
+bool hash_table_batch_insert(HashMap *map, void *array_of_keys, void *array_of_values, size_t number_of_elements, const DATA_TYPE key_type, const DATA_TYPE value_type);
+size_t hash_table_batch_lookup(const HashMap *map, void *array_of_keys, size_t number_of_elements, const DATA_TYPE key_type, Entry **results);
+bool hash_table_batch_delete(HashMap *map, void *array_of_keys, size_t number_of_elements, const DATA_TYPE key_type, const bool strict_mode);
+bool hash_table_dump(const HashMap *map, Dump_write_func write, void *context);
+bool hash_table_enable_dirty_tracking(HashMap *map);
+bool hash_table_checkpoint(HashMap *map, Dump_write_func write, void *context);
+bool hash_table_restore(HashMap *map, Dump_read_func read, void *context);
+size_t hash_table_key_count(const HashMap *map);
+DATA_TYPE hash_table_get_key_type(const HashMap *map);
+size_t hash_table_memory_usage(const HashMap *map, HashMap_memory *breakdown);
+bool hash_table_get_stats(const HashMap *map, HashMap_stats *stats);
+void hash_table_debug_print(const HashMap *map);
+void hash_table_info_print(const HashMap *map);
+
+#endif /* HASHMAP_H */
+
+#if defined(HASHMAP_IMPLEMENTATION) && !defined(HASHMAP_IMPLEMENTATION_INCLUDED)
+#define HASHMAP_IMPLEMENTATION_INCLUDED
+
 // returns current load factor (how much space is being used)
 float get_hash_table_load_factor(const HashMap *map) {
     if (map == NULL) {
@@ -84,22 +475,78 @@ float get_hash_table_load_factor(const HashMap *map) {
 
 /* NOTE: THESE FUNCTIONS ASSUME THE POINTERS ARE VALID */
 
+// hashes a run of bytes 8 at a time
+size_t hash_bytes(const void *data, size_t length) {
+    const unsigned char *bytes = (const unsigned char *)data;
+    uint64_t hash = HASH_MULTIPLIER_2 ^ (uint64_t)length;
+    size_t remaining = length;
+    while (remaining >= sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, bytes, sizeof(uint64_t));
+        hash = folded_multiply(hash ^ word, HASH_MULTIPLIER_1);
+        bytes += sizeof(uint64_t);
+        remaining -= sizeof(uint64_t);
+    }
+    if (remaining > 0) {
+        uint64_t word = 0;
+        memcpy(&word, bytes, remaining);
+        hash = folded_multiply(hash ^ word, HASH_MULTIPLIER_1);
+    }
+    return (size_t)folded_multiply(hash, HASH_MULTIPLIER_2);
+}
+
+#define SIPHASH_ROTATE(x, bits) (((x) << (bits)) | ((x) >> (64 - (bits))))
+#define SIPHASH_ROUND(v0, v1, v2, v3) do { \
+    v0 += v1; v1 = SIPHASH_ROTATE(v1, 13); v1 ^= v0; v0 = SIPHASH_ROTATE(v0, 32); \
+    v2 += v3; v3 = SIPHASH_ROTATE(v3, 16); v3 ^= v2; \
+    v0 += v3; v3 = SIPHASH_ROTATE(v3, 21); v3 ^= v0; \
+    v2 += v1; v1 = SIPHASH_ROTATE(v1, 17); v1 ^= v2; v2 = SIPHASH_ROTATE(v2, 32); \
+} while (0)
+
+/* SipHash-1-3 (one compression round per 8 byte word, three finalization rounds) of a run of bytes under a 128 bit key:
+   a keyed hash whose collisions cannot be found without knowing the key. Words are read in the machine's byte order, so
+   big endian machines get different (but just as strong) hashes than the reference vectors */
+static uint64_t siphash_1_3(const uint64_t key[2], const void *data, size_t length) {
+    uint64_t v0 = 0x736f6d6570736575ULL ^ key[0];
+    uint64_t v1 = 0x646f72616e646f6dULL ^ key[1];
+    uint64_t v2 = 0x6c7967656e657261ULL ^ key[0];
+    uint64_t v3 = 0x7465646279746573ULL ^ key[1];
+    const unsigned char *bytes = (const unsigned char *)data;
+    size_t remaining = length;
+    while (remaining >= sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, bytes, sizeof(uint64_t));
+        v3 ^= word;
+        SIPHASH_ROUND(v0, v1, v2, v3);
+        v0 ^= word;
+        bytes += sizeof(uint64_t);
+        remaining -= sizeof(uint64_t);
+    }
+    // the last word holds the leftover bytes and the length's low byte at the top
+    uint64_t last = 0;
+    memcpy(&last, bytes, remaining);
+    last |= (uint64_t)length << 56;
+    v3 ^= last;
+    SIPHASH_ROUND(v0, v1, v2, v3);
+    v0 ^= last;
+    v2 ^= 0xff;
+    SIPHASH_ROUND(v0, v1, v2, v3);
+    SIPHASH_ROUND(v0, v1, v2, v3);
+    SIPHASH_ROUND(v0, v1, v2, v3);
+    return v0 ^ v1 ^ v2 ^ v3;
+}
+
 size_t hash_int(const Key *key) {
     return key->data.integer;
 }
 
+// strlen() is vectorized by the C library, after that the bytes are hashed a word at a time
 size_t hash_string(const Key *key) {
-    size_t hash = 5381;
-    char *str = key->data.string;
-    while (*str) {
-        hash = ((hash << 5) + hash) + *str;
-        str++;
-    }
-    return hash;
+    return hash_bytes(key->data.string, strlen(key->data.string));
 }
 
 size_t hash_float(const Key *key) {
-    size_t hash;
+    size_t hash = 0; // only the low sizeof(float) bytes are copied over
     memcpy(&hash, &key->data.float_value, sizeof(float));
     return hash;
 }
@@ -110,6 +557,10 @@ size_t hash_double(const Key *key) {
     return hash;
 }
 
+size_t hash_byte_string(const Key *key) {
+    return hash_bytes(key->data.bytes->data, key->data.bytes->length);
+}
+
 /* COMPARISON FUNCTIONS */
 /* NOTE: THESE FUNCTIONS ASSUME THE POINTERS ARE VALID */
 
@@ -121,6 +572,14 @@ int cmp_string(const Key *a, const Key *b) {
     return strcmp(a->data.string, b->data.string);
 }
 
+// byte strings of different lengths are never equal, so memcmp only runs on candidates of the right length
+int cmp_byte_string(const Key *a, const Key *b) {
+    if (a->data.bytes->length != b->data.bytes->length) {
+        return (a->data.bytes->length < b->data.bytes->length) ? -1 : 1;
+    }
+    return memcmp(a->data.bytes->data, b->data.bytes->data, a->data.bytes->length);
+}
+
 #define FLOAT_EPSILON 1e-6
 int cmp_float(const Key *a, const Key *b) {
     float diff = a->data.float_value - b->data.float_value;
@@ -179,336 +638,2618 @@ int cmp_double(const Key *a, const Key *b) {
 //     return;
 // }
 
-// returns the hash map structure itself on success, else NULL. The map itself is stored on the heap
-HashMap *hash_table_create(size_t desired_size, DATA_TYPE key_type) {
-    if (desired_size == 0) {
-        perror("Error in hash_table_create() function: cannot create a hash map with a size of 0\n");
-        return NULL;
-    }
-    HashMap *new_map = malloc(sizeof(HashMap));
-    if (new_map == NULL) {
-        perror("Could not malloc the hash map itself in hash_table_init() function!\n");
-        return NULL;
-    }
+/* STRING ARENA (see HashMap_options) */
 
-    new_map->bucket_count = desired_size;
-    new_map->buckets = (Entry **)calloc(desired_size, sizeof(Entry *));
-    if (new_map->buckets == NULL) {
-        free(new_map);
-        perror("new hash map buckets array could not be calloc'd in hash_table_create() function!\n");
-        return NULL;
-    }
-    new_map->key_type = key_type;
-    switch (key_type) {
-        case INTEGER_TYPE:
-            new_map->key_ops.hash_func = hash_int;
-            new_map->key_ops.cmp_func = cmp_int;
-        break;
-        case STRING_TYPE:
-            new_map->key_ops.hash_func = hash_string;
-            new_map->key_ops.cmp_func = cmp_string;
-        break;
-        case FLOAT_TYPE:
-            new_map->key_ops.hash_func = hash_float;
-            new_map->key_ops.cmp_func = cmp_float;
-        break;
-        case DOUBLE_TYPE:
-            new_map->key_ops.hash_func = hash_double;
-            new_map->key_ops.cmp_func = cmp_double;
-        break;
-        default:
-            printf("Must have one of the following datatypes: int, string (char *), float, double\n");
-            free(new_map->buckets);
-            new_map->buckets = NULL;
-            free(new_map);
+#define STRING_ARENA_CHUNK_SIZE 65536 // bytes per arena chunk (longer strings get a chunk of their own)
+
+// hands out size bytes of the map's arena, aligned to alignment (a power of 2). NULL on failure
+static void *arena_allocate(HashMap *map, size_t size, size_t alignment) {
+    String_arena_chunk *chunk = map->string_arena;
+    size_t start = (chunk == NULL) ? 0 : (chunk->used + alignment - 1) & ~(alignment - 1);
+    size_t needed = size;
+    if (chunk == NULL || start > chunk->capacity || chunk->capacity - start < needed) {
+        size_t capacity = (needed > STRING_ARENA_CHUNK_SIZE) ? needed : STRING_ARENA_CHUNK_SIZE;
+        String_arena_chunk *new_chunk = (String_arena_chunk *)malloc(sizeof(String_arena_chunk) + capacity);
+        if (new_chunk == NULL) {
+            perror("Could not malloc a new string arena chunk!\n");
             return NULL;
+        }
+        new_chunk->capacity = capacity;
+        new_chunk->used = 0;
+        new_chunk->next = chunk;
+        map->string_arena = new_chunk;
+        chunk = new_chunk;
+        start = 0;
     }
-    new_map->key_count = 0;
-    return new_map;
+    chunk->used = start + needed;
+    return chunk->bytes + start;
 }
 
-// a function that increases/decreases the size of the hashMap
-bool hash_table_resize(HashMap *map, size_t new_buckets_count) {
-    // printf("INVOKED RESIZE HERE\n");
-    if (map == NULL ) {
-        perror("Null map passed in to hash_table_resize() function!\n");
-        return false;
-    }
-    if (new_buckets_count == 0) {
-        perror("cannot resize a hash map to have 0 buckets!\n");
-        return false;
+// appends a copy of the string to the map's arena. NULL on failure
+static char *arena_store_string(HashMap *map, const char *string) {
+    size_t length = strlen(string);
+    char *stored = arena_allocate(map, length + 1, 1);
+    if (stored != NULL) {
+        memcpy(stored, string, length + 1);
     }
+    return stored;
+}
 
-    // Allocate a new bucket array with the new size
-    Entry **new_buckets = calloc(new_buckets_count, sizeof(Entry *));
-    if (new_buckets == NULL) {
-        perror("Memory allocation failed while resizing hash table in hash_table_resize()!\n");
-        return false;
+// frees every arena chunk at once (all arena strings become invalid)
+static void free_string_arena(HashMap *map) {
+    String_arena_chunk *chunk = map->string_arena;
+    while (chunk != NULL) {
+        String_arena_chunk *next_chunk = chunk->next;
+        free(chunk);
+        chunk = next_chunk;
     }
+    map->string_arena = NULL;
+}
 
-    // Rehash each entry into the new bucket array
-    for (size_t i = 0; i < map->bucket_count; i++) {
-        Entry *current = map->buckets[i];
-        while (current) {
-            Entry *next_entry = current->next; // Save next pointer before moving
-
-            // Compute new bucket index
-            size_t new_index = map->key_ops.hash_func(&(current->key)) % new_buckets_count;
-
-            // Insert entry into new bucket array
-            current->next = new_buckets[new_index];
-            new_buckets[new_index] = current;
+/* BYTE STRINGS (BYTES_TYPE) */
 
-            // Move to the next entry in the old bucket
-            current = next_entry;
-        }
+// lays out a copy of the bytes right after the descriptor in block (which needs sizeof(Bytes) + length bytes)
+static Bytes *bytes_fill_block(void *block, const void *data, size_t length) {
+    Bytes *copy = (Bytes *)block;
+    unsigned char *stored = (unsigned char *)(copy + 1);
+    if (length > 0) {
+        memcpy(stored, data, length);
     }
+    copy->data = stored;
+    copy->length = length;
+    return copy;
+}
 
-    // Free the old bucket array (but not the entries, as they were moved to the new block)
-    free(map->buckets);
+// copies a byte string into one malloc'd block, descriptor first, so a single free() releases both. NULL on failure
+static Bytes *bytes_duplicate(const Bytes *source) {
+    void *block = malloc(sizeof(Bytes) + source->length);
+    return (block == NULL) ? NULL : bytes_fill_block(block, source->data, source->length);
+}
 
-    // Update the hashmap with new bucket array and size
-    map->buckets = new_buckets;
-    map->bucket_count = new_buckets_count;
-    return true;
+// true for the types whose data points at memory every copy owns (strings and byte strings)
+static bool type_owns_memory(DATA_TYPE type) {
+    return type == STRING_TYPE || type == BYTES_TYPE;
 }
 
-// this function doubles as an update function since it replaces key data if the key is already present
-bool hash_table_insert(HashMap *map, const Key *key, const Value *value) {
-    if (map == NULL) {
-        perror("Map is NULL in hash table insert function!\n");
-        return false;
-    }
-    if (key == NULL || value == NULL) {
-        if (!key) {
-            perror("Passed in NULL key to hash_table_insert() function!\n");
-        } else {
-            perror("Passed in NULL value to hash_table_insert() function!\n");
-        }
-        return false;
+// copies a datapoint, duplicating the memory of strings and byte strings with malloc. True on success, else false
+static bool duplicate_data(DATA_TYPE type, Data *destination, const Data *source) {
+    if (type == STRING_TYPE) {
+        destination->string = strdup(source->string);
+        return destination->string != NULL;
     }
-    if (key->type != map->key_type) {
-        fprintf(stderr, "You cannot insert a key of type %d into a hash map that uses keys of type %d!\n", key->type, map->key_type);
-        return false;
+    if (type == BYTES_TYPE) {
+        destination->bytes = bytes_duplicate(source->bytes);
+        return destination->bytes != NULL;
     }
-    if (map->bucket_count == 0) {
-        perror("cannot insert into a map with 0 buckets!\n");
-        return false;
+    *destination = *source;
+    return true;
+}
+
+// frees the memory of a datapoint made by duplicate_data() (nothing for types that own none)
+static void free_data(DATA_TYPE type, Data data) {
+    if (type == STRING_TYPE) {
+        free(data.string);
+    } else if (type == BYTES_TYPE) {
+        free(data.bytes);
     }
-    // make sure that the hash fits in the table with modulus
-    size_t hash = map->key_ops.hash_func(key);
-    hash = hash % (map->bucket_count);
+}
 
-    if (map->buckets == NULL) {
-        perror("Hash table is uninitialized!\n");
-        return false;   
+/* ENTRY DATA HELPERS */
+
+// copies a string the map will own, either with strdup or into the string arena. NULL on failure
+static char *copy_owned_string(HashMap *map, const char *string) {
+    if (map->use_string_arena) {
+        return arena_store_string(map, string);
     }
-    Entry *current = (map->buckets)[hash];
-    while (current != NULL) {
-        // case where we already have this exact key in the hashmap -- replace the data!
-        if (map->key_ops.cmp_func(&(current->key), key) == 0) {
-            // we already have an exact match of keys in this case, so no need to replace the key data
-            if (current->value.type == STRING_TYPE) {
-                // free the old string that was malloc'd if the value was a string
-                free(current->value.data.string);
-                current->value.data.string = NULL;
-            }
-            if(value->type == STRING_TYPE) {
-                current->value.data.string = strdup(value->data.string);
-                if (current->value.data.string == NULL) {
-                    perror("strdup() failed to malloc a new string in hash_table_insert() function!\n");
-                    return false;
-                }
-            } else {
-                // safe to copy structs if there are no pointers
-                current->value = *value;
-            }
-            // make sure the new type of the value is correct if it changed
-            current->value.type = value->type;
-            return true;
-        }
-        current = current->next;
+    char *copy = (char *)strdup(string);
+    if (copy != NULL) {
+        (map->owned_strings)++;
     }
+    return copy;
+}
 
-    // Key not found, add a new entry
-    Entry *new_node = (Entry *)malloc(sizeof(Entry));
-    if (new_node == NULL) {
-        perror("Could not malloc a new node for hash table insertion!\n");
-        return false;
+// copies a byte string the map will own, with malloc or into the string arena. NULL on failure
+static Bytes *copy_owned_bytes(HashMap *map, const Bytes *bytes) {
+    if (map->use_string_arena) {
+        void *block = arena_allocate(map, sizeof(Bytes) + bytes->length, sizeof(void *));
+        return (block == NULL) ? NULL : bytes_fill_block(block, bytes->data, bytes->length);
+    }
+    Bytes *copy = bytes_duplicate(bytes);
+    if (copy != NULL) {
+        (map->owned_strings)++;
     }
-    // copy key type
-    new_node->key.type = key->type;
+    return copy;
+}
 
-    // strings should be copied with strdup, other datatypes can just be copied directly
-    if (key->type == STRING_TYPE) {
-        new_node->key.data.string = (char *)strdup(key->data.string);
-        if (new_node->key.data.string == NULL) {
-            perror("strdup failed for key string data in hash_table_insert()!\n");
-            free(new_node);
+/* copies key or value data the map will own (strings and byte strings are duplicated). Borrowing maps keep the caller's
+   pointers and hash_table_insert_move() hands its blocks over as they are. True on success, else false */
+static bool copy_owned_data(HashMap *map, DATA_TYPE type, Data *destination, const Data *source) {
+    if (type_owns_memory(type) && (map->borrow_strings || map->adopt_data)) {
+        *destination = *source;
+        if (map->adopt_data) {
+            (map->owned_strings)++;
+        }
+        return true;
+    }
+    if (type == STRING_TYPE) {
+        destination->string = copy_owned_string(map, source->string);
+        if (destination->string == NULL) {
+            perror("strdup failed for string data!\n");
+            return false;
+        }
+    } else if (type == BYTES_TYPE) {
+        destination->bytes = copy_owned_bytes(map, source->bytes);
+        if (destination->bytes == NULL) {
+            perror("Could not copy byte string data!\n");
             return false;
         }
     } else {
-        new_node->key.data = key->data;
+        *destination = *source;
     }
+    return true;
+}
 
-    // Copy value type and data
-    new_node->value.type = value->type;
-    if (value->type == STRING_TYPE) {
-        new_node->value.data.string = (char *)strdup(value->data.string);
-        if (new_node->value.data.string == NULL) {
-            perror("strdup failed for value string data!\n");
-            free(new_node->key.data.string); // Free key string
-            free(new_node);
+// copies a key into an entry that the map will own (strings are duplicated, custom keys cloned). True on success, else false
+static bool copy_key_data(HashMap *map, Key *destination, const Key *source) {
+    destination->type = source->type;
+    if (source->type == CUSTOM_TYPE) {
+        destination->data.custom = source->data.custom;
+        if (map->key_ops.clone_func != NULL && !map->adopt_data && (destination->data.custom = map->key_ops.clone_func(source->data.custom)) == NULL) {
+            perror("clone_func failed for custom key data!\n");
             return false;
         }
-    } else {
-        new_node->value.data = value->data;
+        if (map->key_ops.destroy_func != NULL) {
+            (map->owned_strings)++;
+        }
+        return true;
     }
+    return copy_owned_data(map, source->type, &(destination->data), &(source->data));
+}
 
-    new_node->next = map->buckets[hash];
-    map->buckets[hash] = new_node;
-    (map->key_count)++;
-    float load_factor = get_hash_table_load_factor(map);
-    if (load_factor > MAX_LOAD_FACTOR) {
-        hash_table_resize(map, (map->bucket_count) * 2);
-    }
-    return true;
+// copies a value into an entry that the map will own (strings are duplicated). True on success, else false
+static bool copy_value_data(HashMap *map, Value *destination, const Value *source) {
+    destination->type = source->type;
+    return copy_owned_data(map, source->type, &(destination->data), &(source->data));
 }
 
-// return pointer to the entry if success, else NULL
-Entry *hash_table_entry_lookup(const HashMap *map, const Key *key_to_search_for) {
-    if (map == NULL) {
-        perror("HashMap is NULL\n");
-        return NULL;
-    }
-    if (map->bucket_count == 0) {  // Edge case: No buckets in the map
-        return NULL;
-    }
-    if (key_to_search_for == NULL) {
-        perror("Key passed into hash_table_entry_lookup() is NULL!\n");
-        return NULL;
-    }
-    if (key_to_search_for->type != map->key_type) {
-        fprintf(stderr, "Key passed into hash_table_entry_lookup() has the wrong key type! Expected %d, got %d\n", map->key_type, key_to_search_for->type);
-        return NULL;
+// frees a string or byte string owned by the map (arena copies are only reclaimed when the whole arena is, borrowed ones never)
+static void free_owned_block(HashMap *map, void *block) {
+    if (map->use_string_arena || map->borrow_strings) {
+        return;
     }
+    free(block);
+    (map->owned_strings)--;
+}
 
-    size_t hash = map->key_ops.hash_func(key_to_search_for);
-    hash = hash % (map->bucket_count);
+// frees the data of a key owned by the map
+static void free_key_data(HashMap *map, Key *key) {
+    if (type_owns_memory(key->type)) {
+        free_owned_block(map, (key->type == STRING_TYPE) ? (void *)key->data.string : (void *)key->data.bytes);
+        key->data.string = NULL;
+    } else if (key->type == CUSTOM_TYPE && map->key_ops.destroy_func != NULL) {
+        map->key_ops.destroy_func(key->data.custom);
+        key->data.custom = NULL;
+        (map->owned_strings)--;
+    }
+}
 
-    Entry *current = (map->buckets)[hash];
-    while (current != NULL) {
-        if (map->key_ops.cmp_func(&(current->key), key_to_search_for) == 0) {
-            return current;
-        }
-        current = current->next;
+// frees the data of a value owned by the map
+static void free_value_data(HashMap *map, Value *value) {
+    if (type_owns_memory(value->type)) {
+        free_owned_block(map, (value->type == STRING_TYPE) ? (void *)value->data.string : (void *)value->data.bytes);
+        value->data.string = NULL;
     }
-    return NULL;
 }
 
-// returns true if key exists, else false
-bool hash_table_contains(const HashMap *map, const Key *key) {
-    if (!map) {
-        perror("passed in NULL hashmap into hash_table_contains() function!\n");
-        return false;
+// bytes of string or byte string data a map holds a copy of (borrowed data and custom keys count as nothing)
+static size_t held_data_bytes(const HashMap *map, DATA_TYPE type, Data data) {
+    if (map->borrow_strings) {
+        return 0;
     }
-    if (!key) {
-        perror("passed in NULL key into hash_table_contains() function!\n");
-        return false;
+    if (type == STRING_TYPE) {
+        return strlen(data.string) + 1;
     }
-    return (hash_table_entry_lookup(map, key) != NULL);
+    if (type == BYTES_TYPE) {
+        return sizeof(Bytes) + data.bytes->length;
+    }
+    return 0;
 }
 
-// returns true on deletion else false.
-bool hash_table_entry_delete(HashMap *map, const Key *key_to_delete) {
-    if (map == NULL) {
-        perror("HashMap is NULL\n");
+// what an entry with this key and value counts for against cache_byte_capacity
+static size_t cache_entry_bytes(const HashMap *map, const Key *key, const Value *value) {
+    return sizeof(Entry) + held_data_bytes(map, key->type, key->data) + held_data_bytes(map, value->type, value->data);
+}
+
+// fills in the key, value and full key hash of a new entry. On failure nothing is left allocated
+static bool fill_entry(HashMap *map, Entry *entry, const Key *key, const Value *value, size_t hash) {
+    if (!copy_key_data(map, &(entry->key), key)) {
         return false;
     }
-    if (map->bucket_count == 0) {  // Edge case: No buckets in the map
+    entry->hash = hash;
+    if (!copy_value_data(map, &(entry->value), value)) {
+        free_key_data(map, &(entry->key));
         return false;
     }
-    if (key_to_delete == NULL) {
-        perror("Key to delete in hash_table_entry_delete() is NULL!\n");
-        return false;
+    entry->referenced = false; // only a later lookup earns a second chance, so keys used once are evicted first
+    entry->expires_at = 0;
+    if (map->cache_mode) {
+        map->cache_bytes += cache_entry_bytes(map, key, value);
     }
-    if (key_to_delete->type != map->key_type) {
-        fprintf(stderr, "Key passed into hash_table_entry_delete() has the wrong key type! Expected %d, got %d\n", map->key_type, key_to_delete->type);
+    return true;
+}
+
+// replaces the value of an entry that is already in the map (the key stays the same)
+static bool replace_entry_value(HashMap *map, Entry *entry, const Value *value) {
+    Value new_value;
+    if (!copy_value_data(map, &new_value, value)) {
         return false;
     }
-
-    size_t hash = map->key_ops.hash_func(key_to_delete);
-    hash = hash % map->bucket_count;  // Ensure valid index
-
-    Entry *current = map->buckets[hash];
-    Entry *prev = NULL;
-
-    while (current != NULL) {
-        // Compare the current entry's key with the key to delete
-        if (map->key_ops.cmp_func(&(current->key), key_to_delete) == 0) {
-            // Key matched, proceed to delete
-            if (current->key.type == STRING_TYPE) {
-                free(current->key.data.string);
-            }
-            if (current->value.type == STRING_TYPE) {
-                free(current->value.data.string);
-            }
-
-            // If the key to delete is at the head of the list
-            if (prev == NULL) {
-                map->buckets[hash] = current->next;
-            } else {
-                prev->next = current->next;
-            }
-
-            free(current);  // Free the entry itself
-            (map->key_count)--; // decrement key count
-            
-            float load_factor = get_hash_table_load_factor(map);
-            // do not want to reduce the hash map size below 10
-            if ((load_factor < MIN_LOAD_FACTOR && ((map->bucket_count) >= 20))) {
-                hash_table_resize(map, (map->bucket_count * 3) / 4);
-            }
-            return true;    // Successfully deleted
-        }
-        prev = current;
-        current = current->next;
+    if (map->cache_mode) {
+        map->cache_bytes += held_data_bytes(map, new_value.type, new_value.data);
+        map->cache_bytes -= held_data_bytes(map, entry->value.type, entry->value.data);
     }
-
-    return false;  // Key not found in the hash table
+    // free the old string that was malloc'd if the value was a string
+    free_value_data(map, &(entry->value));
+    entry->value = new_value;
+    entry->referenced = true;
+    entry->expires_at = 0; // a plain insert makes the entry permanent again (hash_table_insert_with_ttl() sets a new TTL)
+    return true;
 }
 
-// Frees the entire hashMap and sets the original pointer to NULL
-bool hash_table_destroy(HashMap **map) {
-    if (map == NULL || *map == NULL) {
-        perror("HashMap to destroy is NULL!\n");
-        return false;
+// frees any strings (and custom key data) owned by an entry, but not the entry itself
+static void free_entry_data(HashMap *map, Entry *entry) {
+    if (map->cache_mode) {
+        map->cache_bytes -= cache_entry_bytes(map, &(entry->key), &(entry->value));
     }
+    free_key_data(map, &(entry->key));
+    free_value_data(map, &(entry->value));
+}
+
+// the bits a non-string datapoint is stored as in dumps and snapshots (strings are written separately)
+static uint64_t data_to_bits(DATA_TYPE type, Data data) {
+    uint64_t bits = 0;
+    switch (type) {
+        case INTEGER_TYPE:
+            bits = (uint64_t)(int64_t)data.integer;
+        break;
+        case FLOAT_TYPE:
+            memcpy(&bits, &(data.float_value), sizeof(float));
+        break;
+        case DOUBLE_TYPE:
+            memcpy(&bits, &(data.double_value), sizeof(double));
+        break;
+        default:
+        break;
+    }
+    return bits;
+}
+
+// turns bits written by data_to_bits() back into a datapoint
+static Data data_from_bits(DATA_TYPE type, uint64_t bits) {
+    Data data = {0};
+    switch (type) {
+        case INTEGER_TYPE:
+            data.integer = (int)(int64_t)bits;
+        break;
+        case FLOAT_TYPE:
+            memcpy(&(data.float_value), &bits, sizeof(float));
+        break;
+        case DOUBLE_TYPE:
+            memcpy(&(data.double_value), &bits, sizeof(double));
+        break;
+        default:
+        break;
+    }
+    return data;
+}
+
+/* the full hash stored in entries: hash_func() of the key, mixed when the map indexes with a bitmask. Seeded maps use
+   SipHash-1-3 instead, whose output needs no mixing */
+static size_t key_hash(const HashMap *map, const Key *key) {
+    if (map->seeded_hashing) {
+        if (key->type == STRING_TYPE) {
+            return (size_t)siphash_1_3(map->hash_seed, key->data.string, strlen(key->data.string));
+        }
+        if (key->type == BYTES_TYPE) {
+            return (size_t)siphash_1_3(map->hash_seed, key->data.bytes->data, key->data.bytes->length);
+        }
+        uint64_t bits = (uint64_t)map->key_ops.hash_func(key); // the other types hash to their own bits (or the hook's hash)
+        return (size_t)siphash_1_3(map->hash_seed, &bits, sizeof(bits));
+    }
+    size_t hash = map->key_ops.hash_func(key);
+    return map->power_of_two_buckets ? mix_hash(hash) : hash;
+}
+
+// the bucket (or home slot) of a full hash in a table with the given number of buckets
+static size_t bucket_index(const HashMap *map, size_t hash, size_t bucket_count) {
+    return map->power_of_two_buckets ? (hash & (bucket_count - 1)) : (hash % bucket_count);
+}
+
+// rehashes the table with the storage's resize, timing it when statistics are compiled in
+static bool storage_resize(struct HashMap *map, size_t new_bucket_count) {
+#ifdef HASHMAP_STATS
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    bool resized = map->storage_ops.resize(map, new_bucket_count);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    map->counters.resizes += resized;
+    map->counters.resize_nanoseconds += (uint64_t)((int64_t)(end.tv_sec - start.tv_sec) * 1000000000 + (end.tv_nsec - start.tv_nsec));
+    return resized;
+#else
+    return map->storage_ops.resize(map, new_bucket_count);
+#endif
+}
+
+// the slot after index, wrapping around the end of the table
+static size_t next_slot(size_t index, size_t slot_count) {
+    return (index + 1 == slot_count) ? 0 : index + 1;
+}
+
+// true if an entry's key equals the key being searched for (hash is the full hash of that key)
+static bool entry_key_matches(const HashMap *map, const Entry *entry, const Key *key, size_t hash) {
+    // different cached hashes can never be equal keys, so most wrong candidates skip cmp_func entirely
+    if (entry->hash != hash) {
+        return false;
+    }
+    return map->key_ops.cmp_func(&(entry->key), key) == 0;
+}
+
+/* ENTRY SLAB ALLOCATOR (chaining storage only) */
+
+#define FIRST_SLAB_CAPACITY 64 // entries in the first slab of a map
+#define MAX_SLAB_CAPACITY 65536 // slabs double in size up to this many entries
+
+// returns a node for a new chained entry, either malloc'd or carved out of the map's slabs. NULL on failure
+static Entry *allocate_entry(HashMap *map) {
+    if (!map->use_entry_slab) {
+        return (Entry *)malloc(sizeof(Entry));
+    }
+    // reuse nodes of deleted entries first
+    if (map->free_entries != NULL) {
+        Entry *reused = map->free_entries;
+        map->free_entries = reused->next;
+        return reused;
+    }
+    Entry_slab *slab = map->slabs;
+    if (slab == NULL || slab->used == slab->capacity) {
+        size_t capacity = (slab == NULL) ? FIRST_SLAB_CAPACITY : slab->capacity * 2;
+        if (capacity > MAX_SLAB_CAPACITY) {
+            capacity = MAX_SLAB_CAPACITY;
+        }
+        Entry_slab *new_slab = (Entry_slab *)malloc(sizeof(Entry_slab) + capacity * sizeof(Entry));
+        if (new_slab == NULL) {
+            perror("Could not malloc a new entry slab!\n");
+            return NULL;
+        }
+        new_slab->capacity = capacity;
+        new_slab->used = 0;
+        new_slab->next = slab;
+        map->slabs = new_slab;
+        slab = new_slab;
+    }
+    return &(slab->entries[(slab->used)++]);
+}
+
+// gives back a node from allocate_entry(). Its strings must already be freed
+static void release_entry(HashMap *map, Entry *entry) {
+    if (!map->use_entry_slab) {
+        free(entry);
+        return;
+    }
+    entry->next = map->free_entries;
+    map->free_entries = entry;
+}
+
+// frees every slab at once (all entries handed out from them become invalid)
+static void free_entry_slabs(HashMap *map) {
+    Entry_slab *slab = map->slabs;
+    while (slab != NULL) {
+        Entry_slab *next_slab = slab->next;
+        free(slab);
+        slab = next_slab;
+    }
+    map->slabs = NULL;
+    map->free_entries = NULL;
+}
+
+/* DIRTY BUCKET TRACKING (chaining storage only, see hash_table_enable_dirty_tracking()) */
+
+// forgets the deleted keys logged for the next checkpoint
+static void free_deleted_keys(HashMap *map) {
+    for (size_t i = 0; i < map->deleted_key_count; i++) {
+        free_data(map->deleted_keys[i].type, map->deleted_keys[i].data);
+    }
+    free(map->deleted_keys);
+    map->deleted_keys = NULL;
+    map->deleted_key_count = 0;
+    map->deleted_key_capacity = 0;
+}
+
+// makes the next checkpoint write the whole map (after resizes, clears, or when tracking ran out of memory)
+static void require_full_checkpoint(HashMap *map) {
+    free(map->dirty_buckets);
+    map->dirty_buckets = NULL;
+    free_deleted_keys(map);
+}
+
+static void mark_bucket_dirty(HashMap *map, size_t index) {
+    if (map->dirty_buckets != NULL) {
+        map->dirty_buckets[index / 64] |= (uint64_t)1 << (index % 64);
+    }
+}
+
+// remembers a key that is about to be deleted so the next checkpoint can replay the deletion
+static void log_deleted_key(HashMap *map, const Key *key) {
+    if (map->dirty_buckets == NULL) {
+        return; // the next checkpoint is full anyway
+    }
+    if (map->deleted_key_count == map->deleted_key_capacity) {
+        size_t capacity = (map->deleted_key_capacity == 0) ? 16 : map->deleted_key_capacity * 2;
+        Key *grown = realloc(map->deleted_keys, capacity * sizeof(Key));
+        if (grown == NULL) {
+            require_full_checkpoint(map);
+            return;
+        }
+        map->deleted_keys = grown;
+        map->deleted_key_capacity = capacity;
+    }
+    Key copy = {.type = key->type};
+    if (!duplicate_data(key->type, &(copy.data), &(key->data))) {
+        require_full_checkpoint(map);
+        return;
+    }
+    map->deleted_keys[(map->deleted_key_count)++] = copy;
+}
+
+/* TREE BINS (chaining storage only, see HashMap_options.tree_bin_threshold) */
+
+// orders a key with the given full hash against the entries of a tree bin: by hash first, so cmp_func() only breaks ties
+static int tree_order(const HashMap *map, const Key *key, size_t hash, const Entry *entry) {
+    if (hash != entry->hash) {
+        return (hash < entry->hash) ? -1 : 1;
+    }
+    return map->key_ops.cmp_func(key, &(entry->key));
+}
+
+static int tree_height(const Tree_node *node) {
+    return (node == NULL) ? 0 : node->height;
+}
+
+static void tree_update_height(Tree_node *node) {
+    int left = tree_height(node->left), right = tree_height(node->right);
+    node->height = ((left > right) ? left : right) + 1;
+}
+
+static Tree_node *tree_rotate_right(Tree_node *node) {
+    Tree_node *pivot = node->left;
+    node->left = pivot->right;
+    pivot->right = node;
+    tree_update_height(node);
+    tree_update_height(pivot);
+    return pivot;
+}
+
+static Tree_node *tree_rotate_left(Tree_node *node) {
+    Tree_node *pivot = node->right;
+    node->right = pivot->left;
+    pivot->left = node;
+    tree_update_height(node);
+    tree_update_height(pivot);
+    return pivot;
+}
+
+// restores the AVL property at a node whose subtrees differ in height by at most 2, returns the subtree's new root
+static Tree_node *tree_rebalance(Tree_node *node) {
+    tree_update_height(node);
+    int balance = tree_height(node->left) - tree_height(node->right);
+    if (balance > 1) {
+        if (tree_height(node->left->left) < tree_height(node->left->right)) {
+            node->left = tree_rotate_left(node->left);
+        }
+        return tree_rotate_right(node);
+    }
+    if (balance < -1) {
+        if (tree_height(node->right->right) < tree_height(node->right->left)) {
+            node->right = tree_rotate_right(node->right);
+        }
+        return tree_rotate_left(node);
+    }
+    return node;
+}
+
+// adds a node whose key is not in the tree yet, returns the new root
+static Tree_node *tree_insert(const HashMap *map, Tree_node *root, Tree_node *node) {
+    if (root == NULL) {
+        return node;
+    }
+    if (tree_order(map, &(node->entry->key), node->entry->hash, root->entry) < 0) {
+        root->left = tree_insert(map, root->left, node);
+    } else {
+        root->right = tree_insert(map, root->right, node);
+    }
+    return tree_rebalance(root);
+}
+
+// takes the leftmost node out of a subtree into *minimum, returns the subtree's new root
+static Tree_node *tree_remove_minimum(Tree_node *root, Tree_node **minimum) {
+    if (root->left == NULL) {
+        *minimum = root;
+        return root->right;
+    }
+    root->left = tree_remove_minimum(root->left, minimum);
+    return tree_rebalance(root);
+}
+
+// takes the node of entry out of the tree into *removed (it stays allocated), returns the new root
+static Tree_node *tree_remove(const HashMap *map, Tree_node *root, const Entry *entry, Tree_node **removed) {
+    if (root == NULL) {
+        return NULL;
+    }
+    if (root->entry != entry) {
+        if (tree_order(map, &(entry->key), entry->hash, root->entry) < 0) {
+            root->left = tree_remove(map, root->left, entry, removed);
+        } else {
+            root->right = tree_remove(map, root->right, entry, removed);
+        }
+        return tree_rebalance(root);
+    }
+    *removed = root;
+    if (root->left == NULL || root->right == NULL) {
+        return (root->left != NULL) ? root->left : root->right;
+    }
+    Tree_node *successor;
+    Tree_node *right = tree_remove_minimum(root->right, &successor);
+    successor->left = root->left;
+    successor->right = right;
+    return tree_rebalance(successor);
+}
+
+static Tree_node *tree_find(const HashMap *map, Tree_node *root, const Key *key, size_t hash) {
+    while (root != NULL) {
+        int order = tree_order(map, key, hash, root->entry);
+        if (order == 0) {
+            return root;
+        }
+        root = (order < 0) ? root->left : root->right;
+    }
+    return NULL;
+}
+
+// frees a tree bin's nodes (not the entries they index) and returns how many there were
+static size_t tree_free(Tree_node *root) {
+    if (root == NULL) {
+        return 0;
+    }
+    size_t freed = 1 + tree_free(root->left) + tree_free(root->right);
+    free(root);
+    return freed;
+}
+
+// drops the tree bin of a bucket, leaving its chain to be searched as a list
+static void tree_bin_drop(HashMap *map, size_t index) {
+    map->tree_node_count -= tree_free(map->tree_bins[index]);
+    map->tree_bins[index] = NULL;
+}
+
+/* builds the tree bin of a bucket from its chain. Running out of memory just leaves the chain without one (lookups in it
+   are slower, but still correct) */
+static void tree_bin_build(HashMap *map, size_t index) {
+    if (map->tree_bins == NULL && (map->tree_bins = (Tree_node **)calloc(map->bucket_count, sizeof(Tree_node *))) == NULL) {
+        return;
+    }
+    Entry *previous = NULL;
+    for (Entry *current = map->buckets[index]; current != NULL; previous = current, current = current->next) {
+        Tree_node *node = (Tree_node *)malloc(sizeof(Tree_node));
+        if (node == NULL) {
+            tree_bin_drop(map, index);
+            return;
+        }
+        *node = (Tree_node){.entry = current, .previous = previous, .height = 1};
+        map->tree_bins[index] = tree_insert(map, map->tree_bins[index], node);
+        (map->tree_node_count)++;
+    }
+}
+
+// frees every tree bin and the array of them (after clears, and before resizes rebuild them)
+static void tree_bins_free(HashMap *map) {
+    if (map->tree_bins == NULL) {
+        return;
+    }
+    for (size_t i = 0; i < map->bucket_count; i++) {
+        if (map->tree_bins[i] != NULL) {
+            tree_bin_drop(map, i);
+        }
+    }
+    free(map->tree_bins);
+    map->tree_bins = NULL;
+}
+
+// gives every chain longer than the threshold a tree bin, after the entries were rehashed into a new bucket array
+static void tree_bins_rebuild(HashMap *map) {
+    for (size_t i = 0; i < map->bucket_count; i++) {
+        size_t length = 0;
+        for (const Entry *current = map->buckets[i]; current != NULL && length <= map->tree_bin_threshold; current = current->next) {
+            length++;
+        }
+        if (length > map->tree_bin_threshold) {
+            tree_bin_build(map, i);
+        }
+    }
+}
+
+// keeps a bucket's tree bin up to date with the entry just linked in as the chain's head, or builds one if the chain got too long
+static void tree_bin_add_head(HashMap *map, size_t index) {
+    Entry *head = map->buckets[index];
+    if (map->tree_bins == NULL || map->tree_bins[index] == NULL) {
+        size_t length = 0;
+        for (const Entry *current = head; current != NULL && length <= map->tree_bin_threshold; current = current->next) {
+            length++;
+        }
+        if (length > map->tree_bin_threshold) {
+            tree_bin_build(map, index);
+        }
+        return;
+    }
+    Tree_node *node = (Tree_node *)malloc(sizeof(Tree_node));
+    if (node == NULL) {
+        tree_bin_drop(map, index);
+        return;
+    }
+    *node = (Tree_node){.entry = head, .previous = NULL, .height = 1};
+    if (head->next != NULL) {
+        tree_find(map, map->tree_bins[index], &(head->next->key), head->next->hash)->previous = head;
+    }
+    map->tree_bins[index] = tree_insert(map, map->tree_bins[index], node);
+    (map->tree_node_count)++;
+}
+
+// takes an entry that is about to be unlinked from its chain out of the bucket's tree bin
+static void tree_bin_remove(HashMap *map, size_t index, const Entry *entry) {
+    Tree_node *removed = NULL;
+    map->tree_bins[index] = tree_remove(map, map->tree_bins[index], entry, &removed);
+    if (removed == NULL) {
+        return;
+    }
+    if (entry->next != NULL) {
+        tree_find(map, map->tree_bins[index], &(entry->next->key), entry->next->hash)->previous = removed->previous;
+    }
+    free(removed);
+    (map->tree_node_count)--;
+}
+
+/* CHAINING STORAGE */
+
+#define INCREMENTAL_REHASH_BUCKETS 4 // old buckets migrated per operation while an incremental resize is in progress
+
+/* moves up to bucket_budget non-empty buckets from the old bucket array into the current one (incremental resizing only).
+   Empty buckets are cheap, but at most 10 per budgeted bucket are skipped so a step stays bounded */
+static void chaining_rehash_step(HashMap *map, size_t bucket_budget) {
+    size_t empty_visits = bucket_budget * 10;
+    while (bucket_budget > 0 && map->rehash_index < map->old_bucket_count) {
+        Entry *current = map->old_buckets[map->rehash_index];
+        if (current == NULL) {
+            (map->rehash_index)++;
+            if (--empty_visits == 0) {
+                break;
+            }
+            continue;
+        }
+        while (current) {
+            Entry *next_entry = current->next;
+            size_t new_index = bucket_index(map, current->hash, map->bucket_count);
+            current->next = map->buckets[new_index];
+            map->buckets[new_index] = current;
+            current = next_entry;
+        }
+        map->old_buckets[map->rehash_index] = NULL;
+        (map->rehash_index)++;
+        bucket_budget--;
+    }
+    if (map->old_buckets != NULL && map->rehash_index == map->old_bucket_count) {
+        // every entry has moved, so the old array can go
+        free(map->old_buckets);
+        map->old_buckets = NULL;
+        map->old_bucket_count = 0;
+        map->rehash_index = 0;
+    }
+}
+
+// returns the link in the chain starting at *link that points at the key's entry, or NULL if the chain does not have it
+static Entry **chaining_chain_find(const HashMap *map, Entry **link, const Key *key, size_t full_hash) {
+    for (; *link != NULL; link = &((*link)->next)) {
+        if (entry_key_matches(map, *link, key, full_hash)) {
+            return link;
+        }
+    }
+    return NULL;
+}
+
+// chaining_chain_find() in bucket index of the current bucket array, through its tree bin if it has one
+static Entry **chaining_bucket_find(const HashMap *map, size_t index, const Key *key, size_t full_hash) {
+    if (map->tree_bins != NULL && map->tree_bins[index] != NULL) {
+        Tree_node *node = tree_find(map, map->tree_bins[index], key, full_hash);
+        if (node == NULL) {
+            return NULL;
+        }
+        return (node->previous != NULL) ? &(node->previous->next) : &(map->buckets[index]);
+    }
+    return chaining_chain_find(map, &(map->buckets[index]), key, full_hash);
+}
+
+/* returns the link (bucket head or previous entry's next pointer) that points at the key's entry, or NULL if it is not in
+   the map. While an incremental resize is in progress the not yet migrated part of the old bucket array is searched too */
+static Entry **chaining_find_link(const HashMap *map, const Key *key, size_t full_hash) {
+    Entry **link = chaining_bucket_find(map, bucket_index(map, full_hash, map->bucket_count), key, full_hash);
+    if (link != NULL || map->old_buckets == NULL) {
+        return link;
+    }
+    size_t old_index = bucket_index(map, full_hash, map->old_bucket_count);
+    if (old_index < map->rehash_index) {
+        return NULL; // that bucket was already migrated
+    }
+    return chaining_chain_find(map, &(map->old_buckets[old_index]), key, full_hash);
+}
+
+// links an entry in as the head of bucket index of the current bucket array (key_count is left to the caller)
+static void chaining_link_head(HashMap *map, size_t index, Entry *entry) {
+    entry->next = map->buckets[index];
+    map->buckets[index] = entry;
+    if (map->tree_bin_threshold > 0) {
+        tree_bin_add_head(map, index);
+    }
+}
+
+// adds a new entry (the key must not be in the map yet) to bucket index of the current bucket array. True on success, else false
+static bool chaining_add_entry(HashMap *map, size_t index, const Key *key, const Value *value, size_t full_hash) {
+    Entry *new_node = allocate_entry(map);
+    if (new_node == NULL) {
+        perror("Could not malloc a new node for hash table insertion!\n");
+        return false;
+    }
+    if (!fill_entry(map, new_node, key, value, full_hash)) {
+        release_entry(map, new_node);
+        return false;
+    }
+    chaining_link_head(map, index, new_node);
+    (map->key_count)++;
+    return true;
+}
+
+static bool chaining_insert(HashMap *map, const Key *key, const Value *value, size_t full_hash) {
+    if (map->old_buckets != NULL) {
+        chaining_rehash_step(map, INCREMENTAL_REHASH_BUCKETS);
+    }
+    if (map->dirty_tracking) {
+        mark_bucket_dirty(map, bucket_index(map, full_hash, map->bucket_count));
+    }
+
+    Entry **link = chaining_find_link(map, key, full_hash);
+    if (link != NULL) {
+        // case where we already have this exact key in the hashmap -- replace the data!
+        // we already have an exact match of keys in this case, so no need to replace the key data
+        return replace_entry_value(map, *link, value);
+    }
+
+    // Key not found, add a new entry. New entries always go into the current bucket array
+    return chaining_add_entry(map, bucket_index(map, full_hash, map->bucket_count), key, value, full_hash);
+}
+
+static Entry *chaining_lookup(const HashMap *map, const Key *key_to_search_for, size_t full_hash) {
+    if (map->old_buckets != NULL && map->rehash_pauses == 0) {
+        /* lookups help with migration too. Moving entries between the two bucket arrays does not change what the map
+           holds, so it is not observable through the const interface (except by iterators, which pause it) */
+        chaining_rehash_step((HashMap *)map, INCREMENTAL_REHASH_BUCKETS);
+    }
+    Entry **link = chaining_find_link(map, key_to_search_for, full_hash);
+    return (link != NULL) ? *link : NULL;
+}
+
+/* unlinks the entry *link points to from its bucket (works for the head of the list too) without freeing anything, and
+   returns it. Tree bins only exist without incremental resizing, so a treed entry is always in the current bucket array */
+static Entry *chaining_detach(HashMap *map, Entry **link) {
+    Entry *current = *link;
+    if (map->tree_bins != NULL) {
+        size_t index = bucket_index(map, current->hash, map->bucket_count);
+        if (map->tree_bins[index] != NULL) {
+            tree_bin_remove(map, index, current);
+        }
+    }
+    *link = current->next;
+    (map->key_count)--; // decrement key count
+    return current;
+}
+
+// deletes the entry *link points to and unlinks it from its bucket (works for the head of the list too)
+static void chaining_unlink(HashMap *map, Entry **link) {
+    if (map->dirty_tracking) {
+        log_deleted_key(map, &((*link)->key));
+    }
+    Entry *current = chaining_detach(map, link);
+    free_entry_data(map, current);
+    release_entry(map, current);  // Free the entry itself
+}
+
+static bool chaining_remove(HashMap *map, const Key *key_to_delete) {
+    if (map->old_buckets != NULL) {
+        chaining_rehash_step(map, INCREMENTAL_REHASH_BUCKETS);
+    }
+    Entry **link = chaining_find_link(map, key_to_delete, key_hash(map, key_to_delete));
+    if (link == NULL) {
+        return false;  // Key not found in the hash table
+    }
+    chaining_unlink(map, link);
+    return true;    // Successfully deleted
+}
+
+// deletes the rejected entries of one bucket array
+static size_t chaining_retain_buckets(HashMap *map, Entry **buckets, size_t first_bucket, size_t bucket_count, Retain_func keep, void *context) {
+    size_t removed = 0;
+    for (size_t i = first_bucket; i < bucket_count; i++) {
+        Entry **link = &(buckets[i]);
+        while (*link != NULL) {
+            if (keep(*link, context)) {
+                link = &((*link)->next);
+            } else {
+                chaining_unlink(map, link); // *link is now the entry after the deleted one
+                removed++;
+            }
+        }
+    }
+    return removed;
+}
+
+static size_t chaining_retain(HashMap *map, Retain_func keep, void *context) {
+    size_t removed = chaining_retain_buckets(map, map->buckets, 0, map->bucket_count, keep, context);
+    if (map->old_buckets != NULL) {
+        // buckets before rehash_index were already migrated (and emptied)
+        removed += chaining_retain_buckets(map, map->old_buckets, map->rehash_index, map->old_bucket_count, keep, context);
+    }
+    return removed;
+}
+
+static bool chaining_resize(HashMap *map, size_t new_buckets_count) {
+    // a resize requested in the middle of a migration finishes the migration first
+    if (map->old_buckets != NULL) {
+        chaining_rehash_step(map, SIZE_MAX);
+    }
+    // Allocate a new bucket array with the new size
+    Entry **new_buckets = calloc(new_buckets_count, sizeof(Entry *));
+    if (new_buckets == NULL) {
+        perror("Memory allocation failed while resizing hash table in hash_table_resize()!\n");
+        return false;
+    }
+
+    if (map->incremental_resize) {
+        // keep the old array around and let the following operations migrate it a few buckets at a time
+        map->old_buckets = map->buckets;
+        map->old_bucket_count = map->bucket_count;
+        map->rehash_index = 0;
+        map->buckets = new_buckets;
+        map->bucket_count = new_buckets_count;
+        return true;
+    }
+
+    tree_bins_free(map); // rebuilt for the new chains below
+
+    // Rehash each entry into the new bucket array
+    for (size_t i = 0; i < map->bucket_count; i++) {
+        Entry *current = map->buckets[i];
+        while (current) {
+            Entry *next_entry = current->next; // Save next pointer before moving
+
+            // Compute new bucket index
+            size_t new_index = bucket_index(map, current->hash, new_buckets_count);
+
+            // Insert entry into new bucket array
+            current->next = new_buckets[new_index];
+            new_buckets[new_index] = current;
+
+            // Move to the next entry in the old bucket
+            current = next_entry;
+        }
+    }
+
+    // Free the old bucket array (but not the entries, as they were moved to the new block)
+    free(map->buckets);
+
+    // Update the hashmap with new bucket array and size
+    map->buckets = new_buckets;
+    map->bucket_count = new_buckets_count;
+    if (map->tree_bin_threshold > 0) {
+        tree_bins_rebuild(map);
+    }
+    if (map->dirty_tracking) {
+        require_full_checkpoint(map); // every bucket index changed
+    }
+    return true;
+}
+
+// frees every chained entry of one bucket array and empties it
+static void chaining_clear_buckets(HashMap *map, Entry **buckets, size_t bucket_count) {
+    if (map->use_entry_slab) {
+        // slab nodes are released all at once, so the chains only need walking if some entry owns a string
+        for (size_t i = 0; i < bucket_count && map->owned_strings > 0; i++) {
+            for (Entry *current = buckets[i]; current != NULL; current = current->next) {
+                free_entry_data(map, current);
+            }
+        }
+        memset(buckets, 0, bucket_count * sizeof(Entry *));
+        return;
+    }
+    Entry *current_bucket, *next_bucket = NULL;
+    for (size_t i = 0; i < bucket_count; i++) {
+        current_bucket = buckets[i];
+        while (current_bucket) {
+            free_entry_data(map, current_bucket);
+            next_bucket = current_bucket->next;  // Store the next entry
+            free(current_bucket);                // Free the current entry
+            current_bucket = next_bucket;        // Move to the next entry
+        }
+        buckets[i] = NULL; // set the pointer to be NULL to indicate no mappings
+    }
+}
+
+static void chaining_clear(HashMap *map) {
+    tree_bins_free(map);
+    chaining_clear_buckets(map, map->buckets, map->bucket_count);
+    if (map->old_buckets != NULL) {
+        // nothing left to migrate
+        chaining_clear_buckets(map, map->old_buckets, map->old_bucket_count);
+        free(map->old_buckets);
+        map->old_buckets = NULL;
+        map->old_bucket_count = 0;
+        map->rehash_index = 0;
+    }
+    if (map->use_entry_slab) {
+        free_entry_slabs(map);
+    }
+}
+
+/* positions below old_bucket_count are buckets of the old array (only used during an incremental resize),
+   the rest are buckets of the current array */
+static Entry *chaining_bucket_head(const HashMap *map, size_t position) {
+    if (position < map->old_bucket_count) {
+        return map->old_buckets[position];
+    }
+    return map->buckets[position - map->old_bucket_count];
+}
+
+static Entry *chaining_next_entry(const HashMap *map, size_t *position, const Entry *previous) {
+    if (previous != NULL) {
+        if (previous->next != NULL) {
+            return previous->next;
+        }
+        (*position)++; // done with this bucket
+    }
+    for (; *position < map->old_bucket_count + map->bucket_count; (*position)++) {
+        Entry *head = chaining_bucket_head(map, *position);
+        if (head != NULL) {
+            return head;
+        }
+    }
+    return NULL;
+}
+
+/* OPEN ADDRESSING STORAGE (linear probing and Robin Hood) */
+
+/* places an entry that is known not to be in the table yet. The arrays must have at least one empty slot.
+   Robin Hood swaps the entry being placed with any resident that is closer to its home slot */
+static void open_addressing_place(const HashMap *map, Entry *slots, size_t *probe_distances, size_t slot_count, Entry entry, size_t hash) {
+    size_t index = bucket_index(map, hash, slot_count);
+    size_t distance = 1;
+    while (probe_distances[index] != 0) {
+        if (map->storage_type == ROBIN_HOOD_STORAGE && probe_distances[index] < distance) {
+            Entry displaced_entry = slots[index];
+            size_t displaced_distance = probe_distances[index];
+            slots[index] = entry;
+            probe_distances[index] = distance;
+            entry = displaced_entry;
+            distance = displaced_distance;
+        }
+        index = next_slot(index, slot_count);
+        distance++;
+    }
+    slots[index] = entry;
+    probe_distances[index] = distance;
+}
+
+// finds the slot holding the key (hash is the full hash of the key), or returns NULL
+static Entry *open_addressing_find(const HashMap *map, const Key *key_to_search_for, size_t hash) {
+    size_t index = bucket_index(map, hash, map->bucket_count);
+    size_t distance = 1;
+    while (map->probe_distances[index] != 0 && distance <= map->bucket_count) {
+        // Robin Hood keeps every run sorted by distance, so a closer resident means the key is not here
+        if (map->storage_type == ROBIN_HOOD_STORAGE && map->probe_distances[index] < distance) {
+            return NULL;
+        }
+        if (entry_key_matches(map, &(map->slots[index]), key_to_search_for, hash)) {
+            return &(map->slots[index]);
+        }
+        index = next_slot(index, map->bucket_count);
+        distance++;
+    }
+    return NULL;
+}
+
+static bool open_addressing_resize(HashMap *map, size_t new_slot_count) {
+    if (new_slot_count <= map->key_count) {
+        fprintf(stderr, "cannot resize an open addressing hash map with %zu keys to %zu slots!\n", map->key_count, new_slot_count);
+        return false;
+    }
+    Entry *new_slots = malloc(new_slot_count * sizeof(Entry));
+    size_t *new_probe_distances = calloc(new_slot_count, sizeof(size_t));
+    if (new_slots == NULL || new_probe_distances == NULL) {
+        perror("Memory allocation failed while resizing hash table in hash_table_resize()!\n");
+        free(new_slots);
+        free(new_probe_distances);
+        return false;
+    }
+    // entries are moved by value, so their strings stay owned by the map
+    for (size_t i = 0; i < map->bucket_count; i++) {
+        if (map->probe_distances[i] != 0) {
+            open_addressing_place(map, new_slots, new_probe_distances, new_slot_count, map->slots[i], map->slots[i].hash);
+        }
+    }
+    free(map->slots);
+    free(map->probe_distances);
+    map->slots = new_slots;
+    map->probe_distances = new_probe_distances;
+    map->bucket_count = new_slot_count;
+    return true;
+}
+
+static bool open_addressing_insert(HashMap *map, const Key *key, const Value *value, size_t hash) {
+    Entry *existing = open_addressing_find(map, key, hash);
+    if (existing != NULL) {
+        return replace_entry_value(map, existing, value);
+    }
+    // there must always be an empty slot to end probes (normally the load factor check keeps one free)
+    if (map->key_count + 1 >= map->bucket_count) {
+        if (!storage_resize(map, (map->bucket_count) * 2)) {
+            return false;
+        }
+    }
+    Entry new_entry;
+    if (!fill_entry(map, &new_entry, key, value, hash)) {
+        return false;
+    }
+    new_entry.next = NULL;
+    open_addressing_place(map, map->slots, map->probe_distances, map->bucket_count, new_entry, hash);
+    (map->key_count)++;
+    return true;
+}
+
+// deletes the entry in a used slot and closes the hole it leaves
+static void open_addressing_erase_slot(HashMap *map, size_t index) {
+    free_entry_data(map, &(map->slots[index]));
+    size_t next = next_slot(index, map->bucket_count);
+    if (map->storage_type == ROBIN_HOOD_STORAGE) {
+        // backward shift deletion: runs are sorted by home slot, so pull displaced entries back until one is at home
+        while (map->probe_distances[next] > 1) {
+            map->slots[index] = map->slots[next];
+            map->probe_distances[index] = map->probe_distances[next] - 1;
+            index = next;
+            next = next_slot(next, map->bucket_count);
+        }
+    } else {
+        // linear probing runs are unsorted: move any later entry whose home slot is at or before the hole into it
+        size_t gap = 1; // slots between the hole and next
+        while (map->probe_distances[next] != 0) {
+            if (map->probe_distances[next] - 1 >= gap) {
+                map->slots[index] = map->slots[next];
+                map->probe_distances[index] = map->probe_distances[next] - gap;
+                index = next;
+                gap = 0;
+            }
+            next = next_slot(next, map->bucket_count);
+            gap++;
+        }
+    }
+    map->probe_distances[index] = 0; // no tombstones needed
+    (map->key_count)--;
+}
+
+static bool open_addressing_remove(HashMap *map, const Key *key_to_delete) {
+    Entry *found = open_addressing_find(map, key_to_delete, key_hash(map, key_to_delete));
+    if (found == NULL) {
+        return false;
+    }
+    open_addressing_erase_slot(map, (size_t)(found - map->slots));
+    return true;
+}
+
+static size_t open_addressing_retain(HashMap *map, Retain_func keep, void *context) {
+    // start right after an empty slot so no run wraps past the end of the walk (there is always one)
+    size_t start = 0;
+    while (map->probe_distances[start] != 0) {
+        start++;
+    }
+    size_t removed = 0;
+    for (size_t step = 1; step <= map->bucket_count; step++) {
+        size_t index = (start + step) % map->bucket_count;
+        // erasing pulls later entries of the run back into the slot, so check it again until it keeps its entry
+        while (map->probe_distances[index] != 0 && !keep(&(map->slots[index]), context)) {
+            open_addressing_erase_slot(map, index);
+            removed++;
+        }
+    }
+    return removed;
+}
+
+static void open_addressing_clear(HashMap *map) {
+    // entries are inline, so only strings need freeing
+    for (size_t i = 0; i < map->bucket_count && map->owned_strings > 0; i++) {
+        if (map->probe_distances[i] != 0) {
+            free_entry_data(map, &(map->slots[i]));
+        }
+    }
+    memset(map->probe_distances, 0, map->bucket_count * sizeof(size_t));
+}
+
+static Entry *open_addressing_next_entry(const HashMap *map, size_t *position, const Entry *previous) {
+    size_t i = (previous != NULL) ? (*position) + 1 : *position;
+    for (; i < map->bucket_count; i++) {
+        if (map->probe_distances[i] != 0) {
+            *position = i;
+            return &(map->slots[i]);
+        }
+    }
+    *position = map->bucket_count;
+    return NULL;
+}
+
+/* SWISS TABLE STORAGE (open addressing with SIMD-scanned control bytes) */
+
+#define SWISS_GROUP_SIZE 16 // slots whose control bytes are compared at once
+#define SWISS_EMPTY ((signed char)-128) // control byte of a slot that was never used since the last rehash
+#define SWISS_DELETED ((signed char)-2) // control byte of a slot whose entry was deleted (probes continue past it)
+
+// bit i is set when control byte i of the group equals the tag
+static uint32_t swiss_match_tag(const signed char *group, signed char tag) {
+#if defined(__SSE2__)
+    __m128i control = _mm_loadu_si128((const __m128i *)group);
+    return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(control, _mm_set1_epi8(tag)));
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    static const uint8_t bit_weights[SWISS_GROUP_SIZE] = {1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128};
+    uint8x16_t matches = vceqq_s8(vld1q_s8(group), vdupq_n_s8(tag));
+    uint8x16_t bits = vandq_u8(matches, vld1q_u8(bit_weights));
+    return (uint32_t)vaddv_u8(vget_low_u8(bits)) | ((uint32_t)vaddv_u8(vget_high_u8(bits)) << 8);
+#else
+    uint32_t mask = 0;
+    for (int i = 0; i < SWISS_GROUP_SIZE; i++) {
+        mask |= (uint32_t)(group[i] == tag) << i;
+    }
+    return mask;
+#endif
+}
+
+// bit i is set when slot i of the group is empty or deleted (both markers are negative, tags never are)
+static uint32_t swiss_match_free(const signed char *group) {
+#if defined(__SSE2__)
+    return (uint32_t)_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)group));
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    static const uint8_t bit_weights[SWISS_GROUP_SIZE] = {1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128};
+    uint8x16_t negative = vcltq_s8(vld1q_s8(group), vdupq_n_s8(0));
+    uint8x16_t bits = vandq_u8(negative, vld1q_u8(bit_weights));
+    return (uint32_t)vaddv_u8(vget_low_u8(bits)) | ((uint32_t)vaddv_u8(vget_high_u8(bits)) << 8);
+#else
+    uint32_t mask = 0;
+    for (int i = 0; i < SWISS_GROUP_SIZE; i++) {
+        mask |= (uint32_t)(group[i] < 0) << i;
+    }
+    return mask;
+#endif
+}
+
+// lowest set bit of a non-zero group mask
+static int swiss_first_bit(uint32_t mask) {
+    return __builtin_ctz(mask);
+}
+
+// finds the slot holding the key (hash is its full, mixed hash), or returns NULL. Probes whole groups (triangular steps visit every group once)
+static Entry *swiss_find(const HashMap *map, const Key *key_to_search_for, size_t hash) {
+    signed char tag = (signed char)(hash & 0x7F);
+    size_t group_mask = (map->bucket_count / SWISS_GROUP_SIZE) - 1;
+    size_t group = (hash >> 7) & group_mask;
+    for (size_t step = 1; step <= group_mask + 1; step++) {
+        const signed char *control = map->control_bytes + group * SWISS_GROUP_SIZE;
+        // the full key is only compared when the 7 bit tag already matches
+        for (uint32_t matches = swiss_match_tag(control, tag); matches != 0; matches &= matches - 1) {
+            size_t index = group * SWISS_GROUP_SIZE + (size_t)swiss_first_bit(matches);
+            if (entry_key_matches(map, &(map->slots[index]), key_to_search_for, hash)) {
+                return &(map->slots[index]);
+            }
+        }
+        // an empty slot means the key was never pushed further along its probe sequence
+        if (swiss_match_tag(control, SWISS_EMPTY) != 0) {
+            return NULL;
+        }
+        group = (group + step) & group_mask;
+    }
+    return NULL;
+}
+
+// places an entry that is known not to be in the table yet into the first free slot of its probe sequence
+static void swiss_place(Entry *slots, signed char *control_bytes, size_t slot_count, const Entry *entry, size_t hash) {
+    size_t group_mask = (slot_count / SWISS_GROUP_SIZE) - 1;
+    size_t group = (hash >> 7) & group_mask;
+    for (size_t step = 1; ; step++) {
+        uint32_t free_slots = swiss_match_free(control_bytes + group * SWISS_GROUP_SIZE);
+        if (free_slots != 0) {
+            size_t index = group * SWISS_GROUP_SIZE + (size_t)swiss_first_bit(free_slots);
+            slots[index] = *entry;
+            control_bytes[index] = (signed char)(hash & 0x7F);
+            return;
+        }
+        group = (group + step) & group_mask;
+    }
+}
+
+// rounds a requested slot count to a power of 2 that is a multiple of the group size
+static size_t swiss_slot_count(size_t requested, bool round_up) {
+    return power_of_two_bucket_count(requested, round_up, SWISS_GROUP_SIZE);
+}
+
+static bool swiss_resize(HashMap *map, size_t new_slot_count) {
+    new_slot_count = swiss_slot_count(new_slot_count, new_slot_count >= map->bucket_count);
+    if (new_slot_count * SWISS_MAX_LOAD_FACTOR <= map->key_count) {
+        fprintf(stderr, "cannot resize a swiss table hash map with %zu keys to %zu slots!\n", map->key_count, new_slot_count);
+        return false;
+    }
+    if (new_slot_count == map->bucket_count && map->deleted_slots == 0) {
+        return true; // nothing to rebuild
+    }
+    Entry *new_slots = malloc(new_slot_count * sizeof(Entry));
+    signed char *new_control_bytes = malloc(new_slot_count);
+    if (new_slots == NULL || new_control_bytes == NULL) {
+        perror("Memory allocation failed while resizing hash table in hash_table_resize()!\n");
+        free(new_slots);
+        free(new_control_bytes);
+        return false;
+    }
+    memset(new_control_bytes, SWISS_EMPTY, new_slot_count);
+    // entries are moved by value, so their strings stay owned by the map
+    for (size_t i = 0; i < map->bucket_count; i++) {
+        if (map->control_bytes[i] >= 0) {
+            swiss_place(new_slots, new_control_bytes, new_slot_count, &(map->slots[i]), map->slots[i].hash);
+        }
+    }
+    free(map->slots);
+    free(map->control_bytes);
+    map->slots = new_slots;
+    map->control_bytes = new_control_bytes;
+    map->bucket_count = new_slot_count;
+    map->deleted_slots = 0;
+    return true;
+}
+
+static bool swiss_insert(HashMap *map, const Key *key, const Value *value, size_t hash) {
+    Entry *existing = swiss_find(map, key, hash);
+    if (existing != NULL) {
+        return replace_entry_value(map, existing, value);
+    }
+    // deleted slots still make probes longer, so rebuild (growing only if the live keys need it) before the table clogs up
+    if ((map->key_count + map->deleted_slots + 1) > map->bucket_count * SWISS_MAX_LOAD_FACTOR) {
+        size_t new_slot_count = (map->key_count + 1 > map->bucket_count / 2) ? map->bucket_count * 2 : map->bucket_count;
+        if (!storage_resize(map, new_slot_count)) {
+            return false;
+        }
+    }
+    Entry new_entry;
+    if (!fill_entry(map, &new_entry, key, value, hash)) {
+        return false;
+    }
+    new_entry.next = NULL;
+    swiss_place(map->slots, map->control_bytes, map->bucket_count, &new_entry, hash);
+    (map->key_count)++;
+    return true;
+}
+
+// deletes the entry in a full slot
+static void swiss_erase_slot(HashMap *map, size_t index) {
+    free_entry_data(map, &(map->slots[index]));
+    const signed char *group = map->control_bytes + (index - index % SWISS_GROUP_SIZE);
+    // if the group already has an empty slot, no probe ever continued past it, so this slot can become empty too
+    if (swiss_match_tag(group, SWISS_EMPTY) != 0) {
+        map->control_bytes[index] = SWISS_EMPTY;
+    } else {
+        map->control_bytes[index] = SWISS_DELETED;
+        (map->deleted_slots)++;
+    }
+    (map->key_count)--;
+}
+
+static bool swiss_remove(HashMap *map, const Key *key_to_delete) {
+    Entry *found = swiss_find(map, key_to_delete, key_hash(map, key_to_delete));
+    if (found == NULL) {
+        return false;
+    }
+    swiss_erase_slot(map, (size_t)(found - map->slots));
+    return true;
+}
+
+static size_t swiss_retain(HashMap *map, Retain_func keep, void *context) {
+    size_t removed = 0;
+    for (size_t i = 0; i < map->bucket_count; i++) {
+        if (map->control_bytes[i] >= 0 && !keep(&(map->slots[i]), context)) {
+            swiss_erase_slot(map, i);
+            removed++;
+        }
+    }
+    return removed;
+}
+
+static void swiss_clear(HashMap *map) {
+    for (size_t i = 0; i < map->bucket_count && map->owned_strings > 0; i++) {
+        if (map->control_bytes[i] >= 0) {
+            free_entry_data(map, &(map->slots[i]));
+        }
+    }
+    memset(map->control_bytes, SWISS_EMPTY, map->bucket_count);
+    map->deleted_slots = 0;
+}
+
+static Entry *swiss_next_entry(const HashMap *map, size_t *position, const Entry *previous) {
+    size_t i = (previous != NULL) ? (*position) + 1 : *position;
+    for (; i < map->bucket_count; i++) {
+        if (map->control_bytes[i] >= 0) {
+            *position = i;
+            return &(map->slots[i]);
+        }
+    }
+    *position = map->bucket_count;
+    return NULL;
+}
+
+// hints the cache about the bucket (or home slot/group) a full hash will be inserted into or looked up in
+static void prefetch_home_bucket(const HashMap *map, size_t hash) {
+    switch (map->storage_type) {
+        case CHAINING_STORAGE:
+            __builtin_prefetch(&(map->buckets[bucket_index(map, hash, map->bucket_count)]));
+        break;
+        case LINEAR_PROBING_STORAGE:
+        case ROBIN_HOOD_STORAGE: {
+            size_t index = bucket_index(map, hash, map->bucket_count);
+            __builtin_prefetch(&(map->probe_distances[index]));
+            __builtin_prefetch(&(map->slots[index]));
+        }
+        break;
+        case SWISS_STORAGE:
+            // which slot of the group is needed is only known once the control bytes are in
+            __builtin_prefetch(&(map->control_bytes[((hash >> 7) & ((map->bucket_count / SWISS_GROUP_SIZE) - 1)) * SWISS_GROUP_SIZE]));
+        break;
+    }
+}
+
+// picks the hash and compare functions for a key type. False if the type cannot be used for keys
+static bool key_ops_for_type(DATA_TYPE key_type, Key_ops *key_ops) {
+    key_ops->clone_func = NULL;
+    key_ops->destroy_func = NULL;
+    switch (key_type) {
+        case INTEGER_TYPE:
+            key_ops->hash_func = hash_int;
+            key_ops->cmp_func = cmp_int;
+        break;
+        case STRING_TYPE:
+            key_ops->hash_func = hash_string;
+            key_ops->cmp_func = cmp_string;
+        break;
+        case FLOAT_TYPE:
+            key_ops->hash_func = hash_float;
+            key_ops->cmp_func = cmp_float;
+        break;
+        case DOUBLE_TYPE:
+            key_ops->hash_func = hash_double;
+            key_ops->cmp_func = cmp_double;
+        break;
+        case BYTES_TYPE:
+            key_ops->hash_func = hash_byte_string;
+            key_ops->cmp_func = cmp_byte_string;
+        break;
+        default:
+            return false;
+    }
+    return true;
+}
+
+// the default ttl_clock of a map
+static uint64_t monotonic_milliseconds(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000 + (uint64_t)now.tv_nsec / 1000000;
+}
+
+/* fills a seed for seeded hashing from /dev/urandom. Where that cannot be read the clock, the map's address and a counter are
+   mixed instead, which still differs between maps and runs but is guessable, so a warning is printed */
+static void random_hash_seed(uint64_t seed[2], const void *salt) {
+    static uint64_t fallback_counter = 0;
+    FILE *urandom = fopen("/dev/urandom", "rb");
+    bool filled = (urandom != NULL) && (fread(seed, sizeof(uint64_t), 2, urandom) == 2);
+    if (urandom != NULL) {
+        fclose(urandom);
+    }
+    if (!filled) {
+        perror("Could not read /dev/urandom for a hash seed, seeding from the clock instead!\n");
+        struct timespec now;
+        clock_gettime(CLOCK_REALTIME, &now);
+        seed[0] = mix_hash((size_t)now.tv_nsec ^ (size_t)(uintptr_t)salt ^ (size_t)(++fallback_counter << 32));
+        seed[1] = mix_hash((size_t)now.tv_sec ^ (size_t)seed[0]);
+    }
+}
+
+// returns the hash map structure itself on success, else NULL. The map itself is stored on the heap
+HashMap *hash_table_create_with_options(size_t desired_size, DATA_TYPE key_type, const HashMap_options *options) {
+    if (desired_size == 0) {
+        perror("Error in hash_table_create() function: cannot create a hash map with a size of 0\n");
+        return NULL;
+    }
+    HashMap_options default_options = {0};
+    if (options == NULL) {
+        options = &default_options;
+    }
+    if (key_type == CUSTOM_TYPE && (options->custom_key_ops == NULL || options->custom_key_ops->hash_func == NULL || options->custom_key_ops->cmp_func == NULL)) {
+        perror("CUSTOM_TYPE keys need HashMap_options.custom_key_ops with at least a hash_func and a cmp_func!\n");
+        return NULL;
+    }
+    HashMap *new_map = malloc(sizeof(HashMap));
+    if (new_map == NULL) {
+        perror("Could not malloc the hash map itself in hash_table_init() function!\n");
+        return NULL;
+    }
+
+    new_map->bucket_count = desired_size;
+    new_map->buckets = NULL;
+    new_map->slots = NULL;
+    new_map->probe_distances = NULL;
+    new_map->control_bytes = NULL;
+    new_map->deleted_slots = 0;
+    new_map->owned_strings = 0;
+    new_map->use_entry_slab = options->use_entry_slab;
+    new_map->slabs = NULL;
+    new_map->free_entries = NULL;
+    new_map->use_string_arena = options->use_string_arena;
+    new_map->borrow_strings = options->borrow_strings;
+    new_map->adopt_data = false;
+    new_map->string_arena = NULL;
+    new_map->incremental_resize = options->incremental_resize;
+    new_map->old_buckets = NULL;
+    new_map->old_bucket_count = 0;
+    new_map->rehash_index = 0;
+    new_map->rehash_pauses = 0;
+    new_map->dirty_tracking = false;
+    new_map->dirty_buckets = NULL;
+    new_map->deleted_keys = NULL;
+    new_map->deleted_key_count = 0;
+    new_map->deleted_key_capacity = 0;
+    new_map->cache_mode = (options->cache_capacity > 0 || options->cache_byte_capacity > 0);
+    new_map->cache_capacity = options->cache_capacity;
+    new_map->cache_byte_capacity = options->cache_byte_capacity;
+    new_map->cache_bytes = 0;
+    new_map->cache_hand = 0;
+    new_map->cache_hits = 0;
+    new_map->cache_misses = 0;
+    new_map->cache_evictions = 0;
+    new_map->ttl_clock = (options->ttl_clock != NULL) ? options->ttl_clock : monotonic_milliseconds;
+    new_map->ttl_wheel = NULL;
+    new_map->seeded_hashing = options->seeded_hashing;
+    new_map->hash_seed[0] = options->hash_seed[0];
+    new_map->hash_seed[1] = options->hash_seed[1];
+    if (options->seeded_hashing && options->hash_seed[0] == 0 && options->hash_seed[1] == 0) {
+        random_hash_seed(new_map->hash_seed, new_map);
+    }
+    new_map->tree_bin_threshold = options->tree_bin_threshold;
+    new_map->tree_bins = NULL;
+    new_map->tree_node_count = 0;
+#ifdef HASHMAP_STATS
+    new_map->counters = (HashMap_counters){0};
+#endif
+    new_map->value_type = options->fixed_value_type ? options->value_type : INVALID_TYPE;
+    if (options->fixed_value_type && (options->value_type < INTEGER_TYPE || options->value_type > DOUBLE_TYPE) && options->value_type != BYTES_TYPE) {
+        fprintf(stderr, "Cannot fix the values of a hash map to type %d!\n", options->value_type);
+        free(new_map);
+        return NULL;
+    }
+    if (options->borrow_strings && options->use_string_arena) {
+        perror("a hash map cannot both borrow strings and copy them into a string arena!\n");
+        free(new_map);
+        return NULL;
+    }
+    if (options->incremental_resize && options->storage_type != CHAINING_STORAGE) {
+        perror("incremental resizing is only supported by chaining storage!\n");
+        free(new_map);
+        return NULL;
+    }
+    if (options->tree_bin_threshold > 0 && (options->storage_type != CHAINING_STORAGE || options->incremental_resize)) {
+        perror("tree bins are only supported by chaining storage without incremental resizing!\n");
+        free(new_map);
+        return NULL;
+    }
+    if (options->use_entry_slab && options->storage_type != CHAINING_STORAGE) {
+        perror("the entry slab allocator is only used by chaining storage (open addressing already stores entries inline)!\n");
+        free(new_map);
+        return NULL;
+    }
+    new_map->min_load_factor = (options->min_load_factor > 0) ? options->min_load_factor : MIN_LOAD_FACTOR;
+    new_map->max_load_factor = (options->max_load_factor > 0) ? options->max_load_factor : MAX_LOAD_FACTOR;
+    float load_factor_limit = (options->storage_type == SWISS_STORAGE) ? SWISS_MAX_LOAD_FACTOR : 1.0f;
+    if (options->min_load_factor < 0 || new_map->min_load_factor * 2 > new_map->max_load_factor ||
+        (options->storage_type != CHAINING_STORAGE && new_map->max_load_factor >= load_factor_limit)) {
+        fprintf(stderr, "Invalid load factors %.3f/%.3f passed into hash_table_create_with_options()! max must be at least twice min (and below %.3f for open addressing)\n",
+                new_map->min_load_factor, new_map->max_load_factor, load_factor_limit);
+        free(new_map);
+        return NULL;
+    }
+    new_map->storage_type = options->storage_type;
+    new_map->power_of_two_buckets = options->power_of_two_buckets || options->storage_type == SWISS_STORAGE;
+    if (new_map->power_of_two_buckets) {
+        new_map->bucket_count = power_of_two_bucket_count(desired_size, true, 1);
+    }
+    switch (options->storage_type) {
+        case CHAINING_STORAGE:
+            new_map->buckets = (Entry **)calloc(new_map->bucket_count, sizeof(Entry *));
+            if (new_map->buckets == NULL) {
+                free(new_map);
+                perror("new hash map buckets array could not be calloc'd in hash_table_create() function!\n");
+                return NULL;
+            }
+            new_map->storage_ops = (Storage_ops){chaining_insert, chaining_lookup, chaining_remove,
+                                                 chaining_resize, chaining_clear, chaining_next_entry, chaining_retain};
+        break;
+        case LINEAR_PROBING_STORAGE:
+        case ROBIN_HOOD_STORAGE:
+            // probes need at least one empty slot to stop at
+            if (new_map->bucket_count < 2) {
+                new_map->bucket_count = 2;
+            }
+            new_map->slots = (Entry *)malloc(new_map->bucket_count * sizeof(Entry));
+            new_map->probe_distances = (size_t *)calloc(new_map->bucket_count, sizeof(size_t));
+            if (new_map->slots == NULL || new_map->probe_distances == NULL) {
+                free(new_map->slots);
+                free(new_map->probe_distances);
+                free(new_map);
+                perror("new hash map slots array could not be allocated in hash_table_create() function!\n");
+                return NULL;
+            }
+            new_map->storage_ops = (Storage_ops){open_addressing_insert, open_addressing_find, open_addressing_remove,
+                                                 open_addressing_resize, open_addressing_clear, open_addressing_next_entry,
+                                                 open_addressing_retain};
+        break;
+        case SWISS_STORAGE:
+            new_map->bucket_count = swiss_slot_count(desired_size, true);
+            new_map->slots = (Entry *)malloc(new_map->bucket_count * sizeof(Entry));
+            new_map->control_bytes = (signed char *)malloc(new_map->bucket_count);
+            if (new_map->slots == NULL || new_map->control_bytes == NULL) {
+                free(new_map->slots);
+                free(new_map->control_bytes);
+                free(new_map);
+                perror("new hash map slots array could not be allocated in hash_table_create() function!\n");
+                return NULL;
+            }
+            memset(new_map->control_bytes, SWISS_EMPTY, new_map->bucket_count);
+            new_map->storage_ops = (Storage_ops){swiss_insert, swiss_find, swiss_remove,
+                                                 swiss_resize, swiss_clear, swiss_next_entry, swiss_retain};
+        break;
+        default:
+            fprintf(stderr, "Unknown storage type %d passed into hash_table_create_with_options()!\n", options->storage_type);
+            free(new_map);
+            return NULL;
+    }
+    new_map->key_type = key_type;
+    if (key_type == CUSTOM_TYPE) {
+        new_map->key_ops = *(options->custom_key_ops);
+    } else if (!key_ops_for_type(key_type, &(new_map->key_ops))) {
+        printf("Must have one of the following datatypes: int, string (char *), float, double (or custom with custom_key_ops)\n");
+        free(new_map->buckets);
+        free(new_map->slots);
+        free(new_map->probe_distances);
+        free(new_map->control_bytes);
+        free(new_map);
+        return NULL;
+    }
+    new_map->key_count = 0;
+    return new_map;
+}
+
+// returns the hash map structure itself on success, else NULL. Uses chaining storage (see hash_table_create_with_options())
+HashMap *hash_table_create(size_t desired_size, DATA_TYPE key_type) {
+    return hash_table_create_with_options(desired_size, key_type, NULL);
+}
+
+// a function that increases/decreases the size of the hashMap
+bool hash_table_resize(HashMap *map, size_t new_buckets_count) {
+    // printf("INVOKED RESIZE HERE\n");
+    if (map == NULL ) {
+        perror("Null map passed in to hash_table_resize() function!\n");
+        return false;
+    }
+    if (new_buckets_count == 0) {
+        perror("cannot resize a hash map to have 0 buckets!\n");
+        return false;
+    }
+    if (map->power_of_two_buckets) {
+        // grow to the next power of 2, shrink to the previous one
+        new_buckets_count = power_of_two_bucket_count(new_buckets_count, new_buckets_count >= map->bucket_count, 1);
+    }
+    return storage_resize(map, new_buckets_count);
+}
+
+/* the bucket count the doublings of single inserts would reach by the time the map holds key_count keys. Jumping to exactly
+   key_count / max_load_factor instead would leave unmixed sequential keys in one long probe cluster */
+static size_t buckets_for_keys(const HashMap *map, size_t key_count) {
+    size_t needed_buckets = map->bucket_count;
+    while (needed_buckets * map->max_load_factor < key_count) {
+        needed_buckets *= 2;
+    }
+    return needed_buckets;
+}
+
+/* grows the table once so that it holds key_count keys in total without resizing again, ahead of an ingest of known size.
+   Never shrinks (deletes still shrink it as usual). True on success, else false */
+bool hash_table_reserve(HashMap *map, size_t key_count) {
+    if (map == NULL) {
+        perror("Null map passed in to hash_table_reserve() function!\n");
+        return false;
+    }
+    size_t needed_buckets = buckets_for_keys(map, key_count);
+    if (needed_buckets <= map->bucket_count) {
+        return true;
+    }
+    return hash_table_resize(map, needed_buckets);
+}
+
+/* shrinks the table to the fewest buckets that keep its keys within max_load_factor (a swiss table rebuild also drops its
+   deleted slots). Entry slabs and string arenas keep their memory, since entries and strings are carved out of them.
+   True on success (including when the table was already that small), else false */
+bool hash_table_shrink_to_fit(HashMap *map) {
+    if (map == NULL) {
+        perror("Null map passed in to hash_table_shrink_to_fit() function!\n");
+        return false;
+    }
+    size_t new_bucket_count = (size_t)((double)map->key_count / map->max_load_factor) + 1;
+    if (map->storage_type != CHAINING_STORAGE && new_bucket_count < map->key_count + 2) {
+        new_bucket_count = map->key_count + 2; // open_addressing_insert() would grow again right away otherwise
+    }
+    if (map->power_of_two_buckets) {
+        new_bucket_count = power_of_two_bucket_count(new_bucket_count, true, 1); // hash_table_resize() rounds shrinks down
+    }
+    if (new_bucket_count >= map->bucket_count && !(map->storage_type == SWISS_STORAGE && map->deleted_slots > 0)) {
+        return true;
+    }
+    return hash_table_resize(map, (new_bucket_count < map->bucket_count) ? new_bucket_count : map->bucket_count);
+}
+
+/* CACHE MODE (see HashMap_options.cache_capacity) */
+
+// counts a lookup of a cache map and gives the entry found a second chance
+static void cache_record_lookup(HashMap *map, Entry *found) {
+    if (found != NULL) {
+        found->referenced = true;
+        (map->cache_hits)++;
+    } else {
+        (map->cache_misses)++;
+    }
+}
+
+/* moves the CLOCK hand on (clearing the bits it passes) to the first entry not referenced since the last pass, and deletes
+   it. Two passes always find one */
+static void cache_evict_one(HashMap *map) {
+    size_t position = map->cache_hand;
+    Entry *entry = map->storage_ops.next_entry(map, &position, NULL);
+    for (size_t wraps = 0; wraps <= 2; ) {
+        if (entry == NULL) {
+            position = 0;
+            entry = map->storage_ops.next_entry(map, &position, NULL);
+            wraps++;
+            continue;
+        }
+        if (!entry->referenced) {
+            break;
+        }
+        entry->referenced = false;
+        entry = map->storage_ops.next_entry(map, &position, entry);
+    }
+    if (entry == NULL) {
+        return;
+    }
+    /* the next call starts from the head of the hand's bucket, so chaining moves on to the next bucket instead of coming
+       back to the entries it just cleared. In open addressing the slot is refilled by the entries shifted back into it */
+    map->cache_hand = (map->storage_type == CHAINING_STORAGE) ? position + 1 : position;
+    Key victim = entry->key; // the storage only compares it before freeing the entry's copy
+    if (map->storage_ops.remove(map, &victim)) {
+        (map->cache_evictions)++;
+    }
+}
+
+// evicts until incoming_entries more entries of incoming_bytes in total fit, keeping at least minimum_keys entries
+static void cache_make_room(HashMap *map, size_t incoming_entries, size_t incoming_bytes, size_t minimum_keys) {
+    while (map->key_count > minimum_keys &&
+           ((map->cache_capacity > 0 && map->key_count + incoming_entries > map->cache_capacity) ||
+            (map->cache_byte_capacity > 0 && map->cache_bytes + incoming_bytes > map->cache_byte_capacity))) {
+        size_t key_count = map->key_count;
+        cache_evict_one(map);
+        if (map->key_count == key_count) {
+            break; // nothing could be evicted
+        }
+    }
+}
+
+/* the hit/miss/eviction counters of a cache map and what it holds right now. Lookups (hash_table_entry_lookup(),
+   hash_table_contains(), hash_table_get_or_insert() and hash_table_update()) count as hits or misses. All zero for maps
+   that are not caches */
+HashMap_cache_stats hash_table_cache_stats(const HashMap *map) {
+    HashMap_cache_stats stats = {0};
+    if (map == NULL) {
+        perror("NULL map passed into hash_table_cache_stats() function!\n");
+        return stats;
+    }
+    if (map->cache_mode) {
+        stats.hits = map->cache_hits;
+        stats.misses = map->cache_misses;
+        stats.evictions = map->cache_evictions;
+        stats.entries = map->key_count;
+        stats.bytes = map->cache_bytes;
+    }
+    return stats;
+}
+
+/* TTL EXPIRATION (chaining storage only, see hash_table_insert_with_ttl()) */
+
+// true if the entry was inserted with a TTL that has run out
+static bool entry_expired(const HashMap *map, const Entry *entry) {
+    return entry->expires_at != 0 && entry->expires_at <= map->ttl_clock();
+}
+
+/* lazy reclamation against a time the caller read once (now): deletes a found entry that has expired (key is its key) and
+   returns NULL for it, else returns entry */
+static Entry *drop_if_expired_at(HashMap *map, Entry *entry, const Key *key, uint64_t now) {
+    if (entry == NULL || entry->expires_at == 0 || entry->expires_at > now) {
+        return entry;
+    }
+    map->storage_ops.remove(map, key);
+    return NULL;
+}
+
+// drop_if_expired_at() at the current time, only reading the clock for entries that have a TTL
+static Entry *drop_if_expired(HashMap *map, Entry *entry, const Key *key) {
+    if (entry == NULL || entry->expires_at == 0) {
+        return entry;
+    }
+    return drop_if_expired_at(map, entry, key, map->ttl_clock());
+}
+
+// the slot a timer belongs in at the wheel's current time
+static Ttl_wheel_slot *ttl_wheel_slot_for(Ttl_wheel *wheel, uint64_t deadline) {
+    uint64_t when = (deadline > wheel->time) ? deadline : wheel->time;
+    uint64_t delta = when - wheel->time;
+    for (size_t level = 0; level < TTL_WHEEL_LEVELS; level++) {
+        if (delta < ((uint64_t)1 << (TTL_WHEEL_BITS * (level + 1)))) {
+            return &(wheel->slots[level][(when >> (TTL_WHEEL_BITS * level)) & (TTL_WHEEL_SLOTS - 1)]);
+        }
+    }
+    // further out than the wheel reaches: park it as late as possible in the top level, it is placed again from there
+    when = wheel->time + ((uint64_t)1 << (TTL_WHEEL_BITS * TTL_WHEEL_LEVELS)) - 1;
+    return &(wheel->slots[TTL_WHEEL_LEVELS - 1][(when >> (TTL_WHEEL_BITS * (TTL_WHEEL_LEVELS - 1))) & (TTL_WHEEL_SLOTS - 1)]);
+}
+
+// makes sure one more timer fits in the slot. False if it could not grow
+static bool ttl_slot_reserve(Ttl_wheel_slot *slot) {
+    if (slot->count < slot->capacity) {
+        return true;
+    }
+    size_t new_capacity = (slot->capacity == 0) ? 4 : slot->capacity * 2;
+    Ttl_timer *grown = realloc(slot->timers, new_capacity * sizeof(Ttl_timer));
+    if (grown == NULL) {
+        perror("Could not grow a slot of the TTL timer wheel!\n");
+        return false;
+    }
+    slot->timers = grown;
+    slot->capacity = new_capacity;
+    return true;
+}
+
+// spreads the timers of the level's current slot over the levels below (the wheel just reached that slot)
+static void ttl_wheel_cascade(Ttl_wheel *wheel, size_t level) {
+    Ttl_wheel_slot *slot = &(wheel->slots[level][(wheel->time >> (TTL_WHEEL_BITS * level)) & (TTL_WHEEL_SLOTS - 1)]);
+    Ttl_timer *timers = slot->timers;
+    size_t count = slot->count;
+    *slot = (Ttl_wheel_slot){NULL, 0, 0};
+    for (size_t i = 0; i < count; i++) {
+        Ttl_wheel_slot *destination = ttl_wheel_slot_for(wheel, timers[i].deadline);
+        // a timer that cannot be moved is dropped, its entries still expire lazily when they are looked up
+        if (ttl_slot_reserve(destination)) {
+            destination->timers[(destination->count)++] = timers[i];
+        }
+    }
+    free(timers);
+}
+
+// deletes the expired entries with this hash in one bucket array
+static size_t ttl_reclaim_bucket(HashMap *map, Entry **link, size_t hash, uint64_t now) {
+    size_t reclaimed = 0;
+    while (*link != NULL) {
+        if ((*link)->hash == hash && (*link)->expires_at != 0 && (*link)->expires_at <= now) {
+            chaining_unlink(map, link);
+            reclaimed++;
+        } else {
+            link = &((*link)->next);
+        }
+    }
+    return reclaimed;
+}
+
+// a timer fired: delete the entries with its hash that have expired (it may be stale, the entry having been replaced or deleted)
+static size_t ttl_reclaim(HashMap *map, size_t hash, uint64_t now) {
+    size_t reclaimed = ttl_reclaim_bucket(map, &(map->buckets[bucket_index(map, hash, map->bucket_count)]), hash, now);
+    if (map->old_buckets != NULL) {
+        size_t old_index = bucket_index(map, hash, map->old_bucket_count);
+        if (old_index >= map->rehash_index) {
+            reclaimed += ttl_reclaim_bucket(map, &(map->old_buckets[old_index]), hash, now);
+        }
+    }
+    return reclaimed;
+}
+
+// frees the timer wheel (clearing a map only empties it)
+static void free_ttl_wheel(HashMap *map, bool keep_wheel) {
+    if (map->ttl_wheel == NULL) {
+        return;
+    }
+    for (size_t level = 0; level < TTL_WHEEL_LEVELS; level++) {
+        for (size_t i = 0; i < TTL_WHEEL_SLOTS; i++) {
+            if (keep_wheel) {
+                map->ttl_wheel->slots[level][i].count = 0;
+            } else {
+                free(map->ttl_wheel->slots[level][i].timers);
+            }
+        }
+    }
+    if (!keep_wheel) {
+        free(map->ttl_wheel);
+        map->ttl_wheel = NULL;
+    }
+}
+
+// checks everything hash_table_insert() and hash_table_get_or_insert() need before touching the map (function_name is for the errors)
+static bool insert_arguments_valid(const HashMap *map, const Key *key, const Value *value, const char *function_name) {
+    if (map == NULL) {
+        fprintf(stderr, "Map is NULL in %s() function!\n", function_name);
+        return false;
+    }
+    if (key == NULL || value == NULL) {
+        fprintf(stderr, "Passed in NULL %s to %s() function!\n", (key == NULL) ? "key" : "value", function_name);
+        return false;
+    }
+    if (key->type != map->key_type) {
+        fprintf(stderr, "You cannot insert a key of type %d into a hash map that uses keys of type %d!\n", key->type, map->key_type);
+        return false;
+    }
+    if (map->value_type != INVALID_TYPE && value->type != map->value_type) {
+        fprintf(stderr, "You cannot insert a value of type %d into a hash map that only holds values of type %d!\n", value->type, map->value_type);
+        return false;
+    }
+    if (map->bucket_count == 0) {
+        perror("cannot insert into a map with 0 buckets!\n");
+        return false;
+    }
+    if (map->buckets == NULL && map->slots == NULL) {
+        perror("Hash table is uninitialized!\n");
+        return false;
+    }
+    return true;
+}
+
+// stores the entry with its already computed hash and grows the table if that pushed it past the load factor
+static bool insert_with_hash(HashMap *map, const Key *key, const Value *value, size_t hash) {
+    size_t key_count = map->key_count;
+    if (!map->storage_ops.insert(map, key, value, hash)) {
+        return false;
+    }
+    HASHMAP_COUNT(map, inserts, map->key_count > key_count);
+    HASHMAP_COUNT(map, updates, map->key_count == key_count);
+    float load_factor = get_hash_table_load_factor(map);
+    if (load_factor > map->max_load_factor) {
+        hash_table_resize(map, (map->bucket_count) * 2);
+    }
+    return true;
+}
+
+// this function doubles as an update function since it replaces key data if the key is already present
+bool hash_table_insert(HashMap *map, const Key *key, const Value *value) {
+    if (!insert_arguments_valid(map, key, value, "hash_table_insert")) {
+        return false;
+    }
+    size_t hash = key_hash(map, key);
+    if (!map->cache_mode) {
+        return insert_with_hash(map, key, value, hash);
+    }
+    // a cache makes room before a new key goes in, so the entry being inserted is not the one evicted
+    if (map->storage_ops.lookup(map, key, hash) == NULL) {
+        cache_make_room(map, 1, cache_entry_bytes(map, key, value), 0);
+    }
+    if (!insert_with_hash(map, key, value, hash)) {
+        return false;
+    }
+    cache_make_room(map, 0, 0, 1); // a replaced value may have grown
+    return true;
+}
+
+/* inserts like hash_table_insert(), but takes over the key's and value's malloc'd data instead of copying it (strings and
+   byte strings from to_key()/to_value() or strdup(), custom keys the map's destroy_func can free). On success the map owns
+   that data, even when only the value was needed because the key was already there, and the data pointers of key and value
+   are set to NULL so a later delete_key()/delete_value() does nothing. On failure the caller still owns everything.
+   Maps that borrow strings never free them, so they cannot take ownership and refuse this. True on success, else false */
+bool hash_table_insert_move(HashMap *map, Key *key, Value *value) {
+    if (map == NULL || key == NULL || value == NULL) {
+        perror("NULL argument passed into hash_table_insert_move() function!\n");
+        return false;
+    }
+    if (map->borrow_strings) {
+        perror("hash_table_insert_move() cannot hand data over to a map that borrows strings!\n");
+        return false;
+    }
+    size_t key_count = map->key_count;
+    size_t evictions = map->cache_evictions;
+    // arena maps copy into the arena either way, so "taking over" just frees the caller's copies afterwards
+    map->adopt_data = !map->use_string_arena;
+    bool success = hash_table_insert(map, key, value);
+    map->adopt_data = false;
+    if (!success) {
+        return false;
+    }
+    // caches may have evicted other entries to make room, which the count has to make up for
+    bool key_stored = map->key_count + (map->cache_evictions - evictions) > key_count && !map->use_string_arena;
+    if (!key_stored) {
+        // the existing key (or the arena copy) was kept, so the caller's key is not needed anymore
+        if (key->type == CUSTOM_TYPE && map->key_ops.destroy_func != NULL) {
+            map->key_ops.destroy_func(key->data.custom);
+        } else {
+            free_data(key->type, key->data);
+        }
+    }
+    if (map->use_string_arena) {
+        free_data(value->type, value->data);
+    }
+    if (type_owns_memory(key->type) || key->type == CUSTOM_TYPE) {
+        key->data.string = NULL;
+    }
+    if (type_owns_memory(value->type)) {
+        value->data.string = NULL;
+    }
+    return true;
+}
+
+/* inserts like hash_table_insert(), but the entry expires ttl_milliseconds from now (on the map's ttl_clock). From then on
+   lookups treat it as missing and delete it, and hash_table_expire() reclaims it even if it is never looked up again.
+   Replacing the value with a plain hash_table_insert() makes the entry permanent. Iteration, printing, dumps and
+   snapshots still see expired entries until they are reclaimed, and TTLs are not saved in dumps or snapshots.
+   Needs chaining storage. ttl_milliseconds must be above 0. True on success, else false */
+bool hash_table_insert_with_ttl(HashMap *map, const Key *key, const Value *value, uint64_t ttl_milliseconds) {
+    if (!insert_arguments_valid(map, key, value, "hash_table_insert_with_ttl")) {
+        return false;
+    }
+    if (map->storage_type != CHAINING_STORAGE || ttl_milliseconds == 0) {
+        perror("hash_table_insert_with_ttl() needs chaining storage and a TTL above 0!\n");
+        return false;
+    }
+    if (map->ttl_wheel == NULL) {
+        map->ttl_wheel = calloc(1, sizeof(Ttl_wheel));
+        if (map->ttl_wheel == NULL) {
+            perror("Could not calloc the TTL timer wheel in hash_table_insert_with_ttl()!\n");
+            return false;
+        }
+        map->ttl_wheel->time = map->ttl_clock();
+    }
+    uint64_t deadline = map->ttl_clock() + ttl_milliseconds;
+    // the timer's room is made first, so nothing can fail once the entry is in
+    Ttl_wheel_slot *slot = ttl_wheel_slot_for(map->ttl_wheel, deadline);
+    if (!ttl_slot_reserve(slot)) {
+        return false;
+    }
+    if (!hash_table_insert(map, key, value)) {
+        return false;
+    }
+    size_t hash = key_hash(map, key);
+    Entry *entry = map->storage_ops.lookup(map, key, hash);
+    if (entry == NULL) {
+        return true; // a cache evicted it straight away
+    }
+    entry->expires_at = deadline;
+    slot->timers[(slot->count)++] = (Ttl_timer){hash, deadline};
+    return true;
+}
+
+/* returns a pointer to the value stored for the key, inserting a copy of default_value first if the key is missing
+   (*inserted, if not NULL, says which happened). The key is hashed once, and finding an existing key is a single probe
+   that copies and frees nothing, so counting loops can do (*hash_table_get_or_insert(map, &key, &zero, NULL)).data.integer++.
+   The pointer is only valid until the next insert or delete (open addressing storage moves its slots around).
+   Scalar values can be changed freely through it, but the type must stay the same and owned data (strings and byte
+   strings) must not be swapped out, since the map frees it later. Use hash_table_insert() to replace those.
+   NULL on failure */
+Value *hash_table_get_or_insert(HashMap *map, const Key *key, const Value *default_value, bool *inserted) {
+    if (inserted != NULL) {
+        *inserted = false;
+    }
+    if (!insert_arguments_valid(map, key, default_value, "hash_table_get_or_insert")) {
+        return NULL;
+    }
+    size_t hash = key_hash(map, key);
+    Entry *entry = drop_if_expired(map, map->storage_ops.lookup(map, key, hash), key);
+    HASHMAP_COUNT(map, hits, entry != NULL);
+    HASHMAP_COUNT(map, misses, entry == NULL);
+    if (map->cache_mode) {
+        cache_record_lookup(map, entry);
+        if (entry == NULL) {
+            cache_make_room(map, 1, cache_entry_bytes(map, key, default_value), 0);
+        }
+    }
+    if (entry == NULL) {
+        if (!insert_with_hash(map, key, default_value, hash)) {
+            return NULL;
+        }
+        // the insert (or the resize after it) may have moved slots around, so find where the new entry ended up
+        entry = map->storage_ops.lookup(map, key, hash);
+        if (inserted != NULL) {
+            *inserted = true;
+        }
+    } else if (map->dirty_tracking) {
+        mark_bucket_dirty(map, bucket_index(map, hash, map->bucket_count)); // the caller is about to change the value
+    }
+    return &(entry->value);
+}
+
+/* calls callback on the value stored for the key so it can be changed in place, after a single probe. The callback gets
+   the same rules as hash_table_get_or_insert() pointers: it must not insert into or delete from the map, change the
+   value's type or swap out owned data. A callback that changes the type has its change undone.
+   True if the key was found and the value kept its type, else false */
+bool hash_table_update(HashMap *map, const Key *key, Update_func callback, void *context) {
+    if (map == NULL || key == NULL || callback == NULL) {
+        perror("NULL argument passed into hash_table_update() function!\n");
+        return false;
+    }
+    if (key->type != map->key_type) {
+        fprintf(stderr, "Key passed into hash_table_update() has the wrong key type! Expected %d, got %d\n", map->key_type, key->type);
+        return false;
+    }
+    if (map->bucket_count == 0) {
+        return false;
+    }
+    size_t hash = key_hash(map, key);
+    Entry *entry = drop_if_expired(map, map->storage_ops.lookup(map, key, hash), key);
+    HASHMAP_COUNT(map, hits, entry != NULL);
+    HASHMAP_COUNT(map, misses, entry == NULL);
+    if (map->cache_mode) {
+        cache_record_lookup(map, entry);
+    }
+    if (entry == NULL) {
+        return false;
+    }
+    if (map->dirty_tracking) {
+        mark_bucket_dirty(map, bucket_index(map, hash, map->bucket_count));
+    }
+    Value before = entry->value;
+    callback(&(entry->value), context);
+    if (entry->value.type != before.type) {
+        fprintf(stderr, "The callback passed into hash_table_update() changed a value of type %d to type %d!\n", before.type, entry->value.type);
+        entry->value = before;
+        return false;
+    }
+    return true;
+}
+
+/* return pointer to the entry if success, else NULL.
+   With open addressing storage the entry lives inside the slot array, so the pointer is only valid until the next insert/delete */
+Entry *hash_table_entry_lookup(const HashMap *map, const Key *key_to_search_for) {
+    if (map == NULL) {
+        perror("HashMap is NULL\n");
+        return NULL;
+    }
+    if (map->bucket_count == 0) {  // Edge case: No buckets in the map
+        return NULL;
+    }
+    if (key_to_search_for == NULL) {
+        perror("Key passed into hash_table_entry_lookup() is NULL!\n");
+        return NULL;
+    }
+    if (key_to_search_for->type != map->key_type) {
+        fprintf(stderr, "Key passed into hash_table_entry_lookup() has the wrong key type! Expected %d, got %d\n", map->key_type, key_to_search_for->type);
+        return NULL;
+    }
+    /* expired entries are misses, and are deleted on the spot. Like incremental migration in chaining_lookup() that
+       happens through the const interface: an expired entry is already as good as gone */
+    Entry *found = drop_if_expired((HashMap *)map, map->storage_ops.lookup(map, key_to_search_for, key_hash(map, key_to_search_for)), key_to_search_for);
+    HASHMAP_COUNT(map, hits, found != NULL);
+    HASHMAP_COUNT(map, misses, found == NULL);
+    if (map->cache_mode) {
+        /* the counters and CLOCK bits are bookkeeping of the cache, not part of what the map holds, so they are updated
+           through the const interface (like incremental migration in chaining_lookup()) */
+        cache_record_lookup((HashMap *)map, found);
+    }
+    return found;
+}
+
+// returns true if key exists, else false
+bool hash_table_contains(const HashMap *map, const Key *key) {
+    if (!map) {
+        perror("passed in NULL hashmap into hash_table_contains() function!\n");
+        return false;
+    }
+    if (!key) {
+        perror("passed in NULL key into hash_table_contains() function!\n");
+        return false;
+    }
+    return (hash_table_entry_lookup(map, key) != NULL);
+}
+
+/* shrinks a table that deletes left below its min_load_factor, in steps of 3/4 (never below 20 buckets). All the steps are
+   worked out first so the entries are only rehashed once, however many keys were just deleted */
+static void shrink_after_deletes(HashMap *map) {
+    size_t new_bucket_count = map->bucket_count;
+    while (new_bucket_count >= 20 && map->key_count < new_bucket_count * map->min_load_factor) {
+        new_bucket_count = (new_bucket_count * 3) / 4;
+        if (map->power_of_two_buckets || map->storage_type == SWISS_STORAGE) {
+            new_bucket_count = power_of_two_bucket_count(new_bucket_count, false, 1); // what hash_table_resize() would round to
+        }
+    }
+    if (new_bucket_count != map->bucket_count) {
+        hash_table_resize(map, new_bucket_count);
+    }
+}
+
+// returns true on deletion else false.
+bool hash_table_entry_delete(HashMap *map, const Key *key_to_delete) {
+    if (map == NULL) {
+        perror("HashMap is NULL\n");
+        return false;
+    }
+    if (map->bucket_count == 0) {  // Edge case: No buckets in the map
+        return false;
+    }
+    if (key_to_delete == NULL) {
+        perror("Key to delete in hash_table_entry_delete() is NULL!\n");
+        return false;
+    }
+    if (key_to_delete->type != map->key_type) {
+        fprintf(stderr, "Key passed into hash_table_entry_delete() has the wrong key type! Expected %d, got %d\n", map->key_type, key_to_delete->type);
+        return false;
+    }
+    if (!map->storage_ops.remove(map, key_to_delete)) {
+        return false;  // Key not found in the hash table
+    }
+    HASHMAP_COUNT(map, deletes, 1);
+    shrink_after_deletes(map);
+    return true;    // Successfully deleted
+}
+
+/* deletes every entry keep() returns false for, in one pass over the storage (no keys are copied or looked up), and shrinks
+   the table at most once afterwards. keep() sees each entry once and must not change the map. Meant for sweeps such as
+   evicting expired entries. Returns how many entries were deleted */
+size_t hash_table_retain(HashMap *map, Retain_func keep, void *context) {
+    if (map == NULL || keep == NULL) {
+        perror("NULL map or predicate passed into hash_table_retain() function!\n");
+        return 0;
+    }
+    if (map->bucket_count == 0 || map->key_count == 0) {
+        return 0;
+    }
+    size_t removed = map->storage_ops.retain(map, keep, context);
+    HASHMAP_COUNT(map, deletes, removed);
+    shrink_after_deletes(map);
+    return removed;
+}
+
+/* reclaims expired TTL entries in a bounded slice: the timer wheel is advanced towards ttl_clock() time, handling at most
+   budget timers and empty milliseconds, so only the buckets of entries that expired are visited (never the whole table).
+   Call it periodically, whatever the budget allows is picked up by the next call. Returns how many entries were deleted */
+size_t hash_table_expire(HashMap *map, size_t budget) {
+    if (map == NULL) {
+        perror("NULL map passed into hash_table_expire() function!\n");
+        return 0;
+    }
+    Ttl_wheel *wheel = map->ttl_wheel;
+    if (wheel == NULL) {
+        return 0;
+    }
+    uint64_t now = map->ttl_clock();
+    size_t reclaimed = 0;
+    while (budget > 0 && wheel->time <= now) {
+        Ttl_wheel_slot *slot = &(wheel->slots[0][wheel->time & (TTL_WHEEL_SLOTS - 1)]);
+        while (slot->count > 0 && budget > 0) {
+            Ttl_timer timer = slot->timers[--(slot->count)];
+            reclaimed += ttl_reclaim(map, timer.hash, now);
+            budget--;
+        }
+        if (slot->count > 0 || budget == 0) {
+            break; // out of budget, the next call continues with this slot
+        }
+        budget--; // stepping over a millisecond counts too, so catching up after a long pause is bounded as well
+        (wheel->time)++;
+        // each level reached the end of one of its slots when the levels below wrapped around
+        for (size_t level = 1; level < TTL_WHEEL_LEVELS && (wheel->time & (((uint64_t)1 << (TTL_WHEEL_BITS * level)) - 1)) == 0; level++) {
+            ttl_wheel_cascade(wheel, level);
+        }
+    }
+    if (reclaimed > 0) {
+        shrink_after_deletes(map);
+    }
+    return reclaimed;
+}
+
+/* MERGES AND SET OPERATIONS */
+
+// true if both maps store the same full hash for a key, so the hashes saved in one map's entries can look keys up in the other
+static bool maps_share_hashing(const HashMap *a, const HashMap *b) {
+    if (a->seeded_hashing || b->seeded_hashing) {
+        return a->seeded_hashing == b->seeded_hashing && a->hash_seed[0] == b->hash_seed[0] && a->hash_seed[1] == b->hash_seed[1] &&
+               a->key_ops.hash_func == b->key_ops.hash_func;
+    }
+    return a->key_ops.hash_func == b->key_ops.hash_func && a->power_of_two_buckets == b->power_of_two_buckets;
+}
+
+/* true if a key is in bucket i of one map exactly when it belongs in bucket i of the other, so their bucket arrays can be
+   walked side by side: chaining maps with the same hashing and bucket count, neither in the middle of an incremental resize */
+static bool maps_in_lockstep(const HashMap *a, const HashMap *b) {
+    return maps_share_hashing(a, b) && a->storage_type == CHAINING_STORAGE && b->storage_type == CHAINING_STORAGE &&
+           a->bucket_count == b->bucket_count && a->old_buckets == NULL && b->old_buckets == NULL;
+}
+
+/* true if the entries of source can change hands as they are: both maps chained, with their nodes, strings and custom keys
+   owned the same way, and nothing about destination (cache limits, a fixed value type) that would have to reject one */
+static bool maps_can_splice(const HashMap *destination, const HashMap *source) {
+    return destination->storage_type == CHAINING_STORAGE && source->storage_type == CHAINING_STORAGE &&
+           destination->use_entry_slab == source->use_entry_slab && destination->use_string_arena == source->use_string_arena &&
+           destination->borrow_strings == source->borrow_strings && destination->key_ops.destroy_func == source->key_ops.destroy_func &&
+           !destination->cache_mode && (destination->value_type == INVALID_TYPE || destination->value_type == source->value_type);
+}
+
+// checks the arguments the merges and set operations share
+static bool set_arguments_valid(const HashMap *map, const HashMap *other, const char *function_name) {
+    if (map == NULL || other == NULL) {
+        fprintf(stderr, "NULL map passed into %s() function!\n", function_name);
+        return false;
+    }
+    if (map->key_type != other->key_type) {
+        fprintf(stderr, "Maps passed into %s() have different key types! (%d and %d)\n", function_name, map->key_type, other->key_type);
+        return false;
+    }
+    return true;
+}
+
+/* grows a smaller destination to source's bucket count ahead of a merge, so that chaining maps with the same hashing can be
+   merged in lockstep. Only done when source is full enough that the union needs at least half of its buckets anyway */
+static void merge_align_buckets(HashMap *destination, const HashMap *source) {
+    if (maps_share_hashing(destination, source) && destination->storage_type == CHAINING_STORAGE &&
+        source->storage_type == CHAINING_STORAGE && destination->bucket_count < source->bucket_count &&
+        (double)source->key_count / destination->max_load_factor > source->bucket_count / 2) {
+        hash_table_resize(destination, source->bucket_count);
+    }
+}
+
+// the single resize a merge that inserted without checking the load factor needs at the end
+static void merge_grow(HashMap *destination) {
+    if (get_hash_table_load_factor(destination) > destination->max_load_factor) {
+        hash_table_resize(destination, buckets_for_keys(destination, destination->key_count));
+    }
+}
+
+/* settles a key both maps of a merge hold: sets *take_incoming if source's value should replace existing's (always for
+   an expired existing entry, which counts as missing). False if the callback broke the rules */
+static bool merge_resolve(HashMap *destination, Entry *existing, const Value *incoming, Merge_func conflict, void *context, bool *take_incoming) {
+    if (destination->dirty_tracking) {
+        mark_bucket_dirty(destination, bucket_index(destination, existing->hash, destination->bucket_count));
+    }
+    HASHMAP_COUNT(destination, updates, 1);
+    *take_incoming = true;
+    if (conflict != NULL && !entry_expired(destination, existing)) {
+        Value before = existing->value;
+        *take_incoming = conflict(&(existing->value), incoming, context);
+        if (existing->value.type != before.type) {
+            fprintf(stderr, "The callback passed into hash_table_merge() changed a value of type %d to type %d!\n", before.type, existing->value.type);
+            existing->value = before;
+            return false;
+        }
+    }
+    if (*take_incoming && destination->value_type != INVALID_TYPE && incoming->type != destination->value_type) {
+        fprintf(stderr, "You cannot merge a value of type %d into a hash map that only holds values of type %d!\n", incoming->type, destination->value_type);
+        return false;
+    }
+    return true;
+}
+
+// merges a copy of an entry of another map into a key destination already holds
+static bool merge_into_existing(HashMap *destination, Entry *existing, const Entry *incoming, Merge_func conflict, void *context) {
+    bool take_incoming;
+    if (!merge_resolve(destination, existing, &(incoming->value), conflict, context, &take_incoming)) {
+        return false;
+    }
+    return !take_incoming || replace_entry_value(destination, existing, &(incoming->value));
+}
+
+// hash_table_merge() of two chaining maps in lockstep: bucket i of source only has keys that belong in bucket i of destination
+static bool merge_lockstep(HashMap *destination, const HashMap *source, Merge_func conflict, void *context) {
+    for (size_t i = 0; i < source->bucket_count; i++) {
+        for (const Entry *incoming = source->buckets[i]; incoming != NULL; incoming = incoming->next) {
+            if (entry_expired(source, incoming)) {
+                continue;
+            }
+            Entry **link = chaining_bucket_find(destination, i, &(incoming->key), incoming->hash);
+            if (link != NULL) {
+                if (!merge_into_existing(destination, *link, incoming, conflict, context)) {
+                    return false;
+                }
+                continue;
+            }
+            if (!insert_arguments_valid(destination, &(incoming->key), &(incoming->value), "hash_table_merge") ||
+                !chaining_add_entry(destination, i, &(incoming->key), &(incoming->value), incoming->hash)) {
+                return false;
+            }
+            HASHMAP_COUNT(destination, inserts, 1);
+            if (destination->dirty_tracking) {
+                mark_bucket_dirty(destination, i);
+            }
+        }
+    }
+    merge_grow(destination);
+    return true;
+}
+
+// hash_table_merge() of any two maps: every entry of source is looked up in destination and inserted or settled
+static bool merge_entries(HashMap *destination, const HashMap *source, Merge_func conflict, void *context) {
+    // the union holds at least as many keys as the bigger of the two maps
+    hash_table_reserve(destination, (destination->key_count > source->key_count) ? destination->key_count : source->key_count);
+    bool shared_hashing = maps_share_hashing(destination, source);
+    size_t position = 0;
+    for (const Entry *incoming = source->storage_ops.next_entry(source, &position, NULL); incoming != NULL;
+         incoming = source->storage_ops.next_entry(source, &position, incoming)) {
+        if (entry_expired(source, incoming)) {
+            continue;
+        }
+        size_t hash = shared_hashing ? incoming->hash : key_hash(destination, &(incoming->key));
+        Entry *existing = destination->storage_ops.lookup(destination, &(incoming->key), hash);
+        if (existing != NULL) {
+            if (!merge_into_existing(destination, existing, incoming, conflict, context)) {
+                return false;
+            }
+            continue;
+        }
+        if (!insert_arguments_valid(destination, &(incoming->key), &(incoming->value), "hash_table_merge")) {
+            return false;
+        }
+        if (destination->cache_mode) {
+            cache_make_room(destination, 1, cache_entry_bytes(destination, &(incoming->key), &(incoming->value)), 0);
+        }
+        if (!insert_with_hash(destination, &(incoming->key), &(incoming->value), hash)) {
+            return false;
+        }
+    }
+    if (destination->cache_mode) {
+        cache_make_room(destination, 0, 0, 1); // replaced values may have grown
+    }
+    return true;
+}
 
-    // Iterate through each bucket
-    for (size_t i = 0; i < (*map)->bucket_count; i++) {
-        Entry *current_node = (*map)->buckets[i];
-        while (current_node != NULL) {
-            // Free the key and value data if they are strings
-            if (current_node->key.type == STRING_TYPE) {
-                free(current_node->key.data.string);
+/* hash_table_merge_move() of maps passing maps_can_splice(): the entries of source are unlinked and linked into destination
+   (or freed when destination's value is kept) without copying keys, values or nodes. Source's slabs and arena chunks,
+   which spliced entries may live in, are handed over as well. Keys both maps hold are settled in a first pass, before
+   anything is unlinked, so a failing conflict() leaves source whole and owning all of its own memory */
+static bool merge_splice(HashMap *destination, HashMap *source, Merge_func conflict, void *context) {
+    if (source->old_buckets != NULL) {
+        chaining_rehash_step(source, SIZE_MAX); // only the current bucket array is walked below
+    }
+    bool lockstep = maps_in_lockstep(destination, source);
+    bool shared_hashing = maps_share_hashing(destination, source);
+    for (size_t i = 0; i < source->bucket_count; i++) {
+        for (Entry *incoming = source->buckets[i]; incoming != NULL; incoming = incoming->next) {
+            if (entry_expired(source, incoming)) {
+                continue;
+            }
+            size_t hash = shared_hashing ? incoming->hash : key_hash(destination, &(incoming->key));
+            Entry **link = lockstep ? chaining_bucket_find(destination, i, &(incoming->key), hash)
+                                    : chaining_find_link(destination, &(incoming->key), hash);
+            bool take_incoming = true;
+            if (link != NULL && !merge_resolve(destination, *link, &(incoming->value), conflict, context, &take_incoming)) {
+                return false;
+            }
+            incoming->referenced = take_incoming; // source is going away, its clock bits are free to carry the outcome
+        }
+    }
+    for (size_t i = 0; i < source->bucket_count; i++) {
+        while (source->buckets[i] != NULL) {
+            Entry *incoming = source->buckets[i];
+            if (entry_expired(source, incoming)) {
+                chaining_unlink(source, &(source->buckets[i]));
+                continue;
+            }
+            size_t hash = shared_hashing ? incoming->hash : key_hash(destination, &(incoming->key));
+            Entry **link = lockstep ? chaining_bucket_find(destination, i, &(incoming->key), hash)
+                                    : chaining_find_link(destination, &(incoming->key), hash);
+            bool take_incoming = incoming->referenced;
+            chaining_detach(source, &(source->buckets[i]));
+            if (link == NULL) {
+                size_t index = lockstep ? i : bucket_index(destination, hash, destination->bucket_count);
+                incoming->hash = hash;
+                incoming->expires_at = 0;
+                chaining_link_head(destination, index, incoming);
+                (destination->key_count)++;
+                HASHMAP_COUNT(destination, inserts, 1);
+                if (destination->dirty_tracking) {
+                    mark_bucket_dirty(destination, index);
+                }
+                continue;
             }
-            if (current_node->value.type == STRING_TYPE) {
-                free(current_node->value.data.string);
+            if (take_incoming) {
+                // the value changes hands, only the key is left for source to free below
+                Entry *existing = *link;
+                free_value_data(destination, &(existing->value));
+                existing->value = incoming->value;
+                existing->referenced = true;
+                existing->expires_at = 0;
+                incoming->value = (Value){.type = INTEGER_TYPE};
             }
+            free_entry_data(source, incoming);
+            release_entry(source, incoming);
+        }
+    }
+    // whatever source still owns now belongs to the entries it handed over
+    destination->owned_strings += source->owned_strings;
+    source->owned_strings = 0;
+    Entry_slab **last_slab = &(destination->slabs);
+    while (*last_slab != NULL) {
+        last_slab = &((*last_slab)->next);
+    }
+    *last_slab = source->slabs; // appended, so destination keeps carving new entries out of its own newest slab
+    source->slabs = NULL;
+    Entry **last_free = &(destination->free_entries);
+    while (*last_free != NULL) {
+        last_free = &((*last_free)->next);
+    }
+    *last_free = source->free_entries;
+    source->free_entries = NULL;
+    String_arena_chunk **last_chunk = &(destination->string_arena);
+    while (*last_chunk != NULL) {
+        last_chunk = &((*last_chunk)->next);
+    }
+    *last_chunk = source->string_arena;
+    source->string_arena = NULL;
+    merge_grow(destination);
+    return true;
+}
+
+/* inserts every entry of source into destination, leaving source as it is. For keys both maps hold conflict() settles the
+   value (NULL lets source's value replace destination's, like an insert). Maps with the same hashing reuse the hashes in
+   source's entries instead of hashing keys again, and chaining maps with the same bucket count are merged bucket by bucket
+   in lockstep, without any intermediate arrays. TTLs are not carried over: expired entries of source are skipped and the
+   merged entries are permanent. Stops at the first entry that cannot be merged. True on success, else false */
+bool hash_table_merge(HashMap *destination, const HashMap *source, Merge_func conflict, void *context) {
+    if (!set_arguments_valid(destination, source, "hash_table_merge")) {
+        return false;
+    }
+    if (destination == source || source->key_count == 0) {
+        return true;
+    }
+    merge_align_buckets(destination, source);
+    if (maps_in_lockstep(destination, source) && !destination->cache_mode) {
+        return merge_lockstep(destination, source, conflict, context);
+    }
+    return merge_entries(destination, source, conflict, context);
+}
+
+/* merges like hash_table_merge() and destroys the source map, setting *source to NULL. Source is being discarded, so when
+   both maps are chained and own their nodes and strings the same way (same use_entry_slab, use_string_arena and
+   borrow_strings), its entries are spliced into destination without copying anything. Other combinations fall back to
+   copying. On failure *source is left in place with all of its entries, while destination keeps the conflicts settled
+   before the failing one. True on success, else false */
+bool hash_table_merge_move(HashMap *destination, HashMap **source, Merge_func conflict, void *context) {
+    if (source == NULL || !set_arguments_valid(destination, *source, "hash_table_merge_move")) {
+        return false;
+    }
+    if (destination == *source) {
+        perror("hash_table_merge_move() cannot merge a map into itself!\n");
+        return false;
+    }
+    if (maps_can_splice(destination, *source)) {
+        merge_align_buckets(destination, *source);
+        if (!merge_splice(destination, *source, conflict, context)) {
+            return false;
+        }
+    } else if (!hash_table_merge(destination, *source, conflict, context)) {
+        return false;
+    }
+    return hash_table_destroy(source);
+}
+
+// what hash_table_intersect() and hash_table_difference() test the entries of a map against
+typedef struct {
+    const HashMap *other;
+    bool shared_hashing; // the entries' own hashes can look their keys up in other
+    bool keep_found; // intersections keep the entries other has, differences the ones it does not
+} Set_filter;
 
-            // Free the current entry and move to the next one
-            Entry *next_node = current_node->next;
-            free(current_node);
-            current_node = next_node;
+static bool set_filter_keep(const Entry *entry, void *context) {
+    const Set_filter *filter = (const Set_filter *)context;
+    size_t hash = filter->shared_hashing ? entry->hash : key_hash(filter->other, &(entry->key));
+    const Entry *found = filter->other->storage_ops.lookup(filter->other, &(entry->key), hash);
+    return (found != NULL && !entry_expired(filter->other, found)) == filter->keep_found;
+}
+
+static bool keep_no_entry(const Entry *entry, void *context) {
+    (void)entry;
+    (void)context;
+    return false;
+}
+
+// set_filter_keep() over two chaining maps in lockstep: bucket i of map is only ever compared with bucket i of other
+static size_t set_filter_lockstep(HashMap *map, const Set_filter *filter) {
+    const HashMap *other = filter->other;
+    size_t removed = 0;
+    for (size_t i = 0; i < map->bucket_count; i++) {
+        Entry **link = &(map->buckets[i]);
+        while (*link != NULL) {
+            Entry **found = (other->buckets[i] == NULL) ? NULL : chaining_bucket_find(other, i, &((*link)->key), (*link)->hash);
+            if ((found != NULL && !entry_expired(other, *found)) == filter->keep_found) {
+                link = &((*link)->next);
+            } else {
+                chaining_unlink(map, link);
+                removed++;
+            }
         }
-        // After freeing all nodes in this bucket, set the bucket to NULL
-        (*map)->buckets[i] = NULL;
     }
+    return removed;
+}
+
+// deletes the entries of map other has (keep_found false) or does not have (keep_found true), shrinking at most once
+static size_t set_filter(HashMap *map, const HashMap *other, bool keep_found, const char *function_name) {
+    if (!set_arguments_valid(map, other, function_name)) {
+        return 0;
+    }
+    if (map->bucket_count == 0 || map->key_count == 0 || (map == other && keep_found)) {
+        return 0;
+    }
+    size_t removed;
+    if (map == other || other->key_count == 0 || other->bucket_count == 0) {
+        // nothing needs looking up: either every key is found or none is
+        removed = (keep_found == (map == other)) ? 0 : map->storage_ops.retain(map, keep_no_entry, NULL);
+    } else {
+        Set_filter filter = {.other = other, .shared_hashing = maps_share_hashing(map, other), .keep_found = keep_found};
+        removed = maps_in_lockstep(map, other) ? set_filter_lockstep(map, &filter) : map->storage_ops.retain(map, set_filter_keep, &filter);
+    }
+    HASHMAP_COUNT(map, deletes, removed);
+    shrink_after_deletes(map);
+    return removed;
+}
+
+/* deletes every entry of map whose key is not in other (other is not changed), leaving map with the keys both have and its
+   own values. Works like hash_table_retain(), comparing same sized chaining maps bucket by bucket in lockstep. Expired
+   entries of other count as missing. Returns how many entries were deleted */
+size_t hash_table_intersect(HashMap *map, const HashMap *other) {
+    return set_filter(map, other, true, "hash_table_intersect");
+}
+
+/* deletes every entry of map whose key is in other (other is not changed), like hash_table_intersect(). Returns how many
+   entries were deleted */
+size_t hash_table_difference(HashMap *map, const HashMap *other) {
+    return set_filter(map, other, false, "hash_table_difference");
+}
+
+// Frees the entire hashMap and sets the original pointer to NULL
+bool hash_table_destroy(HashMap **map) {
+    if (map == NULL || *map == NULL) {
+        perror("HashMap to destroy is NULL!\n");
+        return false;
+    }
+
+    // free every entry (and any strings they own)
+    (*map)->storage_ops.clear(*map);
+    free_string_arena(*map);
 
     // Finally, free the bucket array and the hash map itself
     free((*map)->buckets);
     (*map)->buckets = NULL; // not necessary since map itself is free'd
+    free((*map)->slots);
+    free((*map)->probe_distances);
+    free((*map)->control_bytes);
+    free((*map)->dirty_buckets);
+    free_deleted_keys(*map);
+    free_ttl_wheel(*map, false);
 
     free(*map);  // Free the hash map structure itself
     *map = NULL; // Set the original pointer to NULL
@@ -522,28 +3263,15 @@ bool hash_table_clear(HashMap *map) {
         perror("Passed in NULL HashMap to hash_table_clear() function!\n");
         return false;
     }
-    Entry *current_bucket, *next_bucket = NULL;
-    for (size_t i = 0; i < map->bucket_count; i++) {
-        current_bucket = map->buckets[i];
-        while (current_bucket) {
-            // Free the key if it is a string
-            // alternate option: if map->key_type == STRING_TYPE
-            if ((current_bucket->key).type == STRING_TYPE) {
-                free((current_bucket->key).data.string);
-                current_bucket->key.data.string = NULL;
-            }
-            // Free the value if it is a string
-            if ((current_bucket->value).type == STRING_TYPE) {
-                free((current_bucket->value).data.string);
-                (current_bucket->value).data.string = NULL;
-            }
-            next_bucket = current_bucket->next;  // Store the next entry
-            free(current_bucket);                // Free the current entry
-            current_bucket = next_bucket;        // Move to the next entry
-        }
-        (map->buckets)[i] = NULL; // set the pointer to be NULL to indicate no mappings
+    map->storage_ops.clear(map);
+    free_string_arena(map);
+    if (map->dirty_tracking) {
+        require_full_checkpoint(map);
     }
     map->key_count = 0; // number of buckets in unchanged (map->buckets was not altered), but no more keys are held
+    map->cache_bytes = 0; // clearing slab maps skips the entries that would have counted themselves out
+    map->cache_hand = 0;
+    free_ttl_wheel(map, true); // the timers would only find empty buckets
     return true;
 }
 
@@ -557,62 +3285,72 @@ void hash_table_print(const HashMap *map) {
         printf("Hash Map has no buckets\n");
         return;
     }
-    if (map->buckets == NULL) {
+    if (map->buckets == NULL && map->slots == NULL) {
         perror("map has NULL buckets list in hash_table_print() function!\n");
         return;
     }
 
-    Entry *current_entry = NULL;
+    size_t i = 0;
+    size_t last_printed_bucket = map->bucket_count; // no bucket printed yet
     printf("--start of hash table--\n");
-    for (size_t i = 0; i < map->bucket_count; i++) {
-        current_entry = (map->buckets)[i];
-        if (current_entry != NULL) printf("Bucket #%u:\n", (unsigned int)i);
-        while(current_entry) {
-            // print key
-            switch(current_entry->key.type) {
-                // ensure padding is consistent here
-                case INTEGER_TYPE:
-                    printf("%-40d\t | \t", current_entry->key.data.integer);
-                    break;
-                case STRING_TYPE:
-                    printf("%-40s\t | \t", current_entry->key.data.string);
-                    break;
-                case FLOAT_TYPE:
-                    printf("%-40.6f\t | \t", current_entry->key.data.float_value);
-                    break;
-                case DOUBLE_TYPE:
-                    printf("%-40.6f\t | \t", current_entry->key.data.double_value);
-                    break;
-                default:
-                    printf("Unknonwn data type detected for Key in bucket #%u\n", (unsigned int)i);
-            }
+    for (Entry *current_entry = map->storage_ops.next_entry(map, &i, NULL); current_entry; current_entry = map->storage_ops.next_entry(map, &i, current_entry)) {
+        if (i != last_printed_bucket) {
+            printf("Bucket #%u:\n", (unsigned int)i);
+            last_printed_bucket = i;
+        }
+        // print key
+        switch(current_entry->key.type) {
+            // ensure padding is consistent here
+            case INTEGER_TYPE:
+                printf("%-40d\t | \t", current_entry->key.data.integer);
+                break;
+            case STRING_TYPE:
+                printf("%-40s\t | \t", current_entry->key.data.string);
+                break;
+            case FLOAT_TYPE:
+                printf("%-40.6f\t | \t", current_entry->key.data.float_value);
+                break;
+            case DOUBLE_TYPE:
+                printf("%-40.6f\t | \t", current_entry->key.data.double_value);
+                break;
+            case CUSTOM_TYPE:
+                printf("%-40p\t | \t", current_entry->key.data.custom);
+                break;
+            case BYTES_TYPE:
+                printf("<%zu bytes>%-30s\t | \t", current_entry->key.data.bytes->length, "");
+                break;
+            default:
+                printf("Unknonwn data type detected for Key in bucket #%u\n", (unsigned int)i);
+        }
 
-            // print corresponding value
-            switch(current_entry->value.type) {
-                // ensure padding is consistent here
-                case INTEGER_TYPE:
-                    printf("%-40d (type: int)\n", current_entry->value.data.integer);
-                    break;
-                case STRING_TYPE:
-                    printf("%-40s (type: string)\n", current_entry->value.data.string);
-                    break;
-                case FLOAT_TYPE:
-                    printf("%-40.6f (type: float)\n", current_entry->value.data.float_value);
-                    break;
-                case DOUBLE_TYPE:
-                    printf("%-40.6f (type: double)\n", current_entry->value.data.double_value);
-                    break;
-                default:
-                    printf("Unknown data type detected for Value in bucket #%u\n", (unsigned int)i);
-            }
-            current_entry = current_entry->next;
+        // print corresponding value
+        switch(current_entry->value.type) {
+            // ensure padding is consistent here
+            case INTEGER_TYPE:
+                printf("%-40d (type: int)\n", current_entry->value.data.integer);
+                break;
+            case STRING_TYPE:
+                printf("%-40s (type: string)\n", current_entry->value.data.string);
+                break;
+            case FLOAT_TYPE:
+                printf("%-40.6f (type: float)\n", current_entry->value.data.float_value);
+                break;
+            case DOUBLE_TYPE:
+                printf("%-40.6f (type: double)\n", current_entry->value.data.double_value);
+                break;
+            case BYTES_TYPE:
+                printf("<%zu bytes>%-30s (type: bytes)\n", current_entry->value.data.bytes->length, "");
+                break;
+            default:
+                printf("Unknown data type detected for Value in bucket #%u\n", (unsigned int)i);
         }
     }
     printf("--end of hash table--\n");
     return;
 }
 
-// returns list of all keys in the hasmap or NULL on failure
+/* returns list of all keys in the hasmap or NULL on failure. Custom keys in the list point at the map's own copies, so they
+   are only valid while the key is in the map (and are not freed by delete_key()) */
 Key *get_hash_table_keys(const HashMap *map) {
     if (map == NULL) {
         perror("passed NULL HashMap into get_hash_table_keys() function!\n");
@@ -628,38 +3366,31 @@ Key *get_hash_table_keys(const HashMap *map) {
         return NULL;
     }
 
-    if (map->buckets == NULL) {
+    if (map->buckets == NULL && map->slots == NULL) {
         free(array_of_keys);
         perror("The map passed into get_hash_table_keys() has a NULL list of buckets!\n");
         return NULL;
     }
-    Entry *current_bucket = NULL;
     size_t keys_added_to_array = 0;
+    size_t position = 0;
 
-    for(size_t i = 0; i < map->bucket_count; i++) {
-        current_bucket = (map->buckets)[i];
-        while (current_bucket) {
-            array_of_keys[keys_added_to_array] = current_bucket->key;
-
-            /* in the case of the key being a string (char *), we need to duplicate the
-            string with strdup instead of copying the pointer to the hash map string (which may be free'd later causing a dangling pointer) */
-            if (current_bucket->key.type == STRING_TYPE) {
-                array_of_keys[keys_added_to_array].data.string = strdup(current_bucket->key.data.string);
-                if (array_of_keys[keys_added_to_array].data.string == NULL) {
-                    perror("strdup for key string failed inside get_hash_table_keys() function!\n");
-                    while (keys_added_to_array) { // do not use postincrement here -- could get underflow
-                        keys_added_to_array--;
-                        if (array_of_keys[keys_added_to_array].type == STRING_TYPE) {
-                            free(array_of_keys[keys_added_to_array].data.string);
-                        }
-                    }
-                    free(array_of_keys);
-                    return NULL;
+    for (const Entry *current_bucket = map->storage_ops.next_entry(map, &position, NULL); current_bucket; current_bucket = map->storage_ops.next_entry(map, &position, current_bucket)) {
+        array_of_keys[keys_added_to_array] = current_bucket->key;
+
+        /* in the case of the key being a string (char *) or byte string, we need to duplicate it instead of
+        copying the pointer to the hash map's copy (which may be free'd later causing a dangling pointer) */
+        if (type_owns_memory(current_bucket->key.type)) {
+            if (!duplicate_data(current_bucket->key.type, &(array_of_keys[keys_added_to_array].data), &(current_bucket->key.data))) {
+                perror("strdup for key string failed inside get_hash_table_keys() function!\n");
+                while (keys_added_to_array) { // do not use postincrement here -- could get underflow
+                    keys_added_to_array--;
+                    free_data(array_of_keys[keys_added_to_array].type, array_of_keys[keys_added_to_array].data);
                 }
+                free(array_of_keys);
+                return NULL;
             }
-            keys_added_to_array++;
-            current_bucket = current_bucket->next;
         }
+        keys_added_to_array++;
     }
     return array_of_keys;
 }
@@ -674,7 +3405,7 @@ Value *get_hash_table_values(const HashMap *map) {
     if (number_of_values == 0) {
         return NULL; // No values in the hash table
     }
-    if (map->buckets == NULL) {
+    if (map->buckets == NULL && map->slots == NULL) {
         perror("The map passed into get_hash_table_values() has a NULL list of buckets!\n");
         return NULL;
     }
@@ -683,35 +3414,151 @@ Value *get_hash_table_values(const HashMap *map) {
         perror("array of keys could not be malloc'd in get_hash_table_values() function!\n");
         return NULL;
     }
-    Entry *current_bucket = NULL;
-    size_t values_added_to_array = 0;
+    size_t values_added_to_array = 0;
+    size_t position = 0;
+
+    for (const Entry *current_bucket = map->storage_ops.next_entry(map, &position, NULL); current_bucket; current_bucket = map->storage_ops.next_entry(map, &position, current_bucket)) {
+        array_of_values[values_added_to_array] = current_bucket->value;
+
+        /* in the case of the value being a string (char *) or byte string, we need to duplicate it instead of
+        copying the pointer to the hash map's copy (which may be free'd later causing a dangling pointer) */
+        if (type_owns_memory(current_bucket->value.type)) {
+            if (!duplicate_data(current_bucket->value.type, &(array_of_values[values_added_to_array].data), &(current_bucket->value.data))) {
+                perror("strdup for key string failed inside get_hash_table_values() function!\n");
+                while (values_added_to_array) { // do not use postincrement here -- could get underflow
+                    values_added_to_array--;
+                    free_data(array_of_values[values_added_to_array].type, array_of_values[values_added_to_array].data);
+                }
+                free(array_of_values);
+                return NULL;
+            }
+        }
+        values_added_to_array++;
+    }
+    return array_of_values;
+}
+
+/* starts an iteration over every entry of map. Nothing is allocated or copied: hash_table_iter_next() hands out the
+   entries themselves. Lookups are fine while iterating (they stop migrating buckets until the iteration ends), but inserts,
+   deletes, resizes and clears invalidate the iterator. An iteration left before hash_table_iter_next() returned NULL must be
+   ended with hash_table_iter_end() */
+void hash_table_iter_init(HashMap_iterator *iterator, const HashMap *map) {
+    if (iterator == NULL) {
+        perror("NULL iterator passed into hash_table_iter_init() function!\n");
+        return;
+    }
+    iterator->map = map;
+    iterator->position = 0;
+    iterator->current = NULL;
+    iterator->finished = (map == NULL);
+    if (map == NULL) {
+        perror("passed NULL HashMap into hash_table_iter_init() function!\n");
+        return;
+    }
+    ((HashMap *)map)->rehash_pauses++; // bookkeeping only, the entries are not touched
+}
+
+// ends an iteration early. Safe to call on an iteration that already finished
+void hash_table_iter_end(HashMap_iterator *iterator) {
+    if (iterator == NULL || iterator->finished) {
+        return;
+    }
+    iterator->finished = true;
+    ((HashMap *)iterator->map)->rehash_pauses--;
+}
+
+// returns the next entry of the iteration, or NULL once every entry has been returned (which also ends the iteration)
+const Entry *hash_table_iter_next(HashMap_iterator *iterator) {
+    if (iterator == NULL || iterator->finished) {
+        return NULL;
+    }
+    const HashMap *map = iterator->map;
+    iterator->current = map->storage_ops.next_entry(map, &(iterator->position), iterator->current);
+    if (iterator->current == NULL) {
+        hash_table_iter_end(iterator);
+    }
+    return iterator->current;
+}
+
+// mirrors the bits of value (the scan cursor counts in reverse so that it survives the table doubling or halving)
+static size_t reverse_bits(size_t value) {
+#if SIZE_MAX == UINT64_MAX
+    value = ((value >> 1) & 0x5555555555555555ULL) | ((value & 0x5555555555555555ULL) << 1);
+    value = ((value >> 2) & 0x3333333333333333ULL) | ((value & 0x3333333333333333ULL) << 2);
+    value = ((value >> 4) & 0x0F0F0F0F0F0F0F0FULL) | ((value & 0x0F0F0F0F0F0F0F0FULL) << 4);
+    return (size_t)__builtin_bswap64((uint64_t)value);
+#else
+    size_t reversed = 0;
+    for (size_t bit = 0; bit < sizeof(size_t) * 8; bit++) {
+        reversed = (reversed << 1) | (value & 1);
+        value >>= 1;
+    }
+    return reversed;
+#endif
+}
+
+// the cursor after the bucket at cursor & mask: the high bits of the bucket index are incremented first
+static size_t scan_advance(size_t cursor, size_t mask) {
+    cursor |= ~mask;
+    return reverse_bits(reverse_bits(cursor) + 1);
+}
+
+static void scan_bucket(const Entry *head, Scan_func callback, void *context) {
+    for (const Entry *current = head; current != NULL; current = current->next) {
+        callback(current, context);
+    }
+}
+
+// visits the bucket the cursor points at (plus its expansion in the larger array during an incremental resize)
+static size_t scan_step(const HashMap *map, size_t cursor, Scan_func callback, void *context) {
+    if (map->old_buckets == NULL) {
+        size_t mask = map->bucket_count - 1;
+        scan_bucket(map->buckets[cursor & mask], callback, context);
+        return scan_advance(cursor, mask);
+    }
+    Entry **small = map->old_buckets, **large = map->buckets;
+    size_t small_mask = map->old_bucket_count - 1, large_mask = map->bucket_count - 1;
+    if (small_mask > large_mask) {
+        // shrinking
+        small = map->buckets;
+        large = map->old_buckets;
+        small_mask = map->bucket_count - 1;
+        large_mask = map->old_bucket_count - 1;
+    }
+    scan_bucket(small[cursor & small_mask], callback, context);
+    // every bucket of the larger array whose entries could have come from (or go to) that bucket
+    do {
+        scan_bucket(large[cursor & large_mask], callback, context);
+        cursor = scan_advance(cursor, large_mask);
+    } while ((cursor & (small_mask ^ large_mask)) != 0);
+    return cursor;
+}
 
-    for(size_t i = 0; i < map->bucket_count; i++) {
-        current_bucket = (map->buckets)[i];
-        while (current_bucket) {
-            array_of_values[values_added_to_array] = current_bucket->value;
-
-            /* in the case of the key being a string (char *), we need to duplicate the
-            string with strdup instead of copying the pointer to the hash map string (which may be free'd later causing a dangling pointer) */
-            if (current_bucket->key.type == STRING_TYPE) {
-                array_of_values[values_added_to_array].data.string = strdup(current_bucket->value.data.string);
-                if (array_of_values[values_added_to_array].data.string == NULL) {
-                    perror("strdup for key string failed inside get_hash_table_values() function!\n");
-                    while (values_added_to_array) { // do not use postincrement here -- could get underflow
-                        values_added_to_array--;
-                        if (array_of_values[values_added_to_array].type == STRING_TYPE) {
-                            free(array_of_values[values_added_to_array].data.string);
-                        }
-                    }
-                    free(array_of_values);
-                    return NULL;
-                }
-            }
-            values_added_to_array++;
-            current_bucket = current_bucket->next;
-        }
+/* SCAN style walk of a live map in small steps. Start with cursor 0 and call again with the returned cursor until it returns 0.
+   Each call visits about bucket_budget buckets and calls callback for every entry in them. Every key that stays in the map
+   for the whole walk is visited at least once even if the map is resized (or incrementally migrated) between calls; keys
+   may be visited more than once and keys inserted or deleted in the meantime may or may not be visited.
+   The cursor only survives resizes because buckets come from the low bits of the hash, so this needs chaining storage with
+   power_of_two_buckets. Returns 0 (and reports an error) for other maps */
+size_t hash_table_scan(const HashMap *map, size_t cursor, size_t bucket_budget, Scan_func callback, void *context) {
+    if (map == NULL || callback == NULL) {
+        perror("NULL map or callback passed into hash_table_scan() function!\n");
+        return 0;
     }
-    return array_of_values;
+    if (map->storage_type != CHAINING_STORAGE || !map->power_of_two_buckets) {
+        perror("hash_table_scan() needs a chaining map with power_of_two_buckets!\n");
+        return 0;
+    }
+    if (bucket_budget == 0) {
+        bucket_budget = 1;
+    }
+    // the callback may look keys up, which must not move entries around under the bucket being walked
+    ((HashMap *)map)->rehash_pauses++;
+    do {
+        cursor = scan_step(map, cursor, callback, context);
+    } while (cursor != 0 && --bucket_budget > 0);
+    ((HashMap *)map)->rehash_pauses--;
+    return cursor;
 }
 
 // converts any 1 dimensional array of a valid DATA_TYPE to an array of keys
@@ -864,6 +3711,12 @@ Key to_key(const void *generic_pointer, const DATA_TYPE type) {
         case DOUBLE_TYPE:
             new_key.data.double_value = *((const double *)generic_pointer);
             break;
+        case BYTES_TYPE: // generic_pointer is a Bytes descriptor, the bytes are copied
+            new_key.data.bytes = bytes_duplicate((const Bytes *)generic_pointer);
+            if (new_key.data.bytes == NULL) {
+                perror("could not malloc the byte string in to_key function!\n");
+            }
+            break;
         default:
             perror("Invalid data type for key/value conversion!\n");
             new_key.type = -1; // Indicate invalid type
@@ -898,6 +3751,12 @@ Value to_value(const void *generic_pointer, const DATA_TYPE type) {
         case DOUBLE_TYPE:
             new_value.data.double_value = *((const double *)generic_pointer);
             break;
+        case BYTES_TYPE: // generic_pointer is a Bytes descriptor, the bytes are copied
+            new_value.data.bytes = bytes_duplicate((const Bytes *)generic_pointer);
+            if (new_value.data.bytes == NULL) {
+                perror("could not malloc the byte string in to_value function!\n");
+            }
+            break;
         default:
             perror("Invalid data type for key/value conversion!\n");
             new_value.type = INVALID_TYPE;
@@ -906,34 +3765,59 @@ Value to_value(const void *generic_pointer, const DATA_TYPE type) {
     return new_value;
 }
 
-// deletes a STATICALLY ALLOCATED key with a malloc'd string
+// deletes a STATICALLY ALLOCATED key with a malloc'd string (or byte string)
 void delete_key(Key key_to_delete) {
     // free any strings if present
-    if (key_to_delete.type == STRING_TYPE) {
-        free(key_to_delete.data.string);
-    }
+    free_data(key_to_delete.type, key_to_delete.data);
     return;
 }
 
-// deletes a STATICALLY ALLOCATED value with a malloc'd string
+// deletes a STATICALLY ALLOCATED value with a malloc'd string (or byte string)
 void delete_value(Value value_to_delete) {
     // free any strings if present
-    if (value_to_delete.type == STRING_TYPE) {
-        free(value_to_delete.data.string);
-    }
+    free_data(value_to_delete.type, value_to_delete.data);
     return;
 }
 
-DATA_TYPE hash_table_get_key_type(const HashMap *map) {
-    if (map == NULL) {
-        perror("map is NULL in hash_table_get_key_type() function!\n");
-        return INVALID_TYPE;
+#define BULK_LOAD_BLOCK 256 // keys hash_table_batch_insert() hashes together before inserting them
+#define BULK_LOAD_PREFETCH_DISTANCE 8 // how many keys ahead of the one being inserted its home bucket is prefetched
+
+// element index of a raw array of the given type (see hash_table_batch_insert()). Strings are borrowed, not copied
+static Data raw_array_data(const void *array, size_t index, DATA_TYPE type) {
+    Data data;
+    switch (type) {
+        case INTEGER_TYPE:
+            data.integer = ((const int *)array)[index];
+        break;
+        case FLOAT_TYPE:
+            data.float_value = ((const float *)array)[index];
+        break;
+        case DOUBLE_TYPE:
+            data.double_value = ((const double *)array)[index];
+        break;
+        case CUSTOM_TYPE: // an array of pointers to the keys
+            data.custom = ((void *const *)array)[index];
+        break;
+        case BYTES_TYPE: // an array of Bytes descriptors
+            data.bytes = (Bytes *)&(((const Bytes *)array)[index]);
+        break;
+        default: // STRING_TYPE (callers validate the type)
+            data.string = ((char *const *)array)[index];
+        break;
     }
-    return map->key_type;
+    return data;
+}
+
+// true for the types raw arrays can hold
+static bool is_raw_array_type(DATA_TYPE type) {
+    return type == INTEGER_TYPE || type == STRING_TYPE || type == FLOAT_TYPE || type == DOUBLE_TYPE || type == BYTES_TYPE;
 }
 
 /* batch inserts a list of keys and list of corresponding values. True on success, else false
    assumes keys are unique, and if not the most recent key (lastest in the list of keys) will replace any old key that is idenctical
+   The table is grown once up front, keys are hashed a block at a time and their buckets are prefetched a few keys ahead of
+   the insertion, and the caller's arrays are read directly (strings are only copied once, by the map). If an insertion
+   fails, the elements before it stay in the map
 */
 bool hash_table_batch_insert(HashMap *map, void *array_of_keys, void *array_of_values, size_t number_of_elements, const DATA_TYPE key_type, const DATA_TYPE value_type) {
     // assume the two arrays have the same size. If not, problems will occur
@@ -957,32 +3841,127 @@ bool hash_table_batch_insert(HashMap *map, void *array_of_keys, void *array_of_v
         fprintf(stderr, "key type mismatch in hash_table_batch_insert() function! Expected %d, got %d\n", map->key_type, key_type);
         return false;
     }
-    // note: these are malloc'd and must be free'd later
-    Key *keys = convert_array_to_keys(array_of_keys, number_of_elements, key_type);
-    Value *values = convert_array_to_values(array_of_values, number_of_elements, value_type);
-
-    if (!keys || !values) {
-        perror("failed to convert arrays into key/value arrays inside hash_table_batch_insert() function!");
+    if (map->value_type != INVALID_TYPE && value_type != map->value_type) {
+        fprintf(stderr, "value type mismatch in hash_table_batch_insert() function! Expected %d, got %d\n", map->value_type, value_type);
+        return false;
+    }
+    if (!is_raw_array_type(value_type)) {
+        fprintf(stderr, "Invalid value type %d passed into hash_table_batch_insert() function!\n", value_type);
+        return false;
+    }
+    /* grow once for the whole batch, to the size the doublings of single inserts would have reached (duplicate keys can
+       only leave the table emptier than planned) */
+    size_t needed_buckets = buckets_for_keys(map, map->key_count + number_of_elements);
+    if (needed_buckets > map->bucket_count && !hash_table_resize(map, needed_buckets)) {
+        perror("could not grow the hash map for hash_table_batch_insert()!\n");
         return false;
     }
 
-    for (size_t i = 0; i < number_of_elements; i++) {
-        if (!hash_table_insert(map, &(keys[i]), &(values[i]))) {
-            fprintf(stderr, "Failed insertion for element %zu in hash_table_batch_insert() function!\n", i);
-            delete_key((keys[i]));
-            delete_value((values[i]));
-            return false;
+    Key keys[BULK_LOAD_BLOCK];
+    size_t hashes[BULK_LOAD_BLOCK];
+    size_t key_count = map->key_count;
+    for (size_t block_start = 0; block_start < number_of_elements; block_start += BULK_LOAD_BLOCK) {
+        size_t block_size = number_of_elements - block_start;
+        if (block_size > BULK_LOAD_BLOCK) {
+            block_size = BULK_LOAD_BLOCK;
+        }
+        // hash the whole block first, this loop never touches the table
+        for (size_t i = 0; i < block_size; i++) {
+            keys[i].type = key_type;
+            keys[i].data = raw_array_data(array_of_keys, block_start + i, key_type);
+            hashes[i] = key_hash(map, &(keys[i]));
+        }
+        for (size_t i = 0; i < block_size && i < BULK_LOAD_PREFETCH_DISTANCE; i++) {
+            prefetch_home_bucket(map, hashes[i]);
+        }
+        for (size_t i = 0; i < block_size; i++) {
+            if (i + BULK_LOAD_PREFETCH_DISTANCE < block_size) {
+                prefetch_home_bucket(map, hashes[i + BULK_LOAD_PREFETCH_DISTANCE]);
+            }
+            Value value = {.type = value_type, .data = raw_array_data(array_of_values, block_start + i, value_type)};
+            if (!map->storage_ops.insert(map, &(keys[i]), &value, hashes[i])) {
+                fprintf(stderr, "Failed insertion for element %zu in hash_table_batch_insert() function!\n", block_start + i);
+                return false;
+            }
         }
-        // if there are strings, make sure to free them inside the key/value structs
-        delete_key((keys[i]));
-        delete_value((values[i]));
     }
-    free(keys);
-    free(values);
+    HASHMAP_COUNT(map, inserts, map->key_count - key_count);
+    HASHMAP_COUNT(map, updates, number_of_elements - (map->key_count - key_count));
+    if (map->cache_mode) {
+        cache_make_room(map, 0, 0, 1); // the batch went in whole, so trim it back to the limits in one go
+    }
     return true;
 }
 
-// batch deletions using a list of keys. The "strict_mode" parameter determines if the function returns false if any key is not deleted (was never in the hashmap)
+#define BATCH_LOOKUP_BLOCK 64 // keys hash_table_batch_lookup() has in flight at once (their buckets are all prefetched together)
+
+/* looks up a list of keys given as a raw array (same convention as hash_table_batch_insert()). results[i] is set to the entry
+   of key i, or NULL if it is not in the map. Returns how many keys were found.
+   The keys are handled a block at a time: all of them are hashed and their buckets prefetched, then (for chaining) the first
+   entry of every chain is prefetched, and only then are they resolved. That way the cache misses of a block overlap instead
+   of being paid one key after the other */
+size_t hash_table_batch_lookup(const HashMap *map, void *array_of_keys, size_t number_of_elements, const DATA_TYPE key_type, Entry **results) {
+    if (!map || !array_of_keys || !results) {
+        perror("NULL argument passed into hash_table_batch_lookup() function!\n");
+        return 0;
+    }
+    if (key_type != map->key_type) {
+        fprintf(stderr, "key type mismatch in hash_table_batch_lookup() function! Expected %d, got %d\n", map->key_type, key_type);
+        return 0;
+    }
+    Key keys[BATCH_LOOKUP_BLOCK];
+    size_t hashes[BATCH_LOOKUP_BLOCK];
+    size_t found = 0;
+    uint64_t now = map->ttl_clock();
+    for (size_t block_start = 0; block_start < number_of_elements; block_start += BATCH_LOOKUP_BLOCK) {
+        size_t block_size = number_of_elements - block_start;
+        if (block_size > BATCH_LOOKUP_BLOCK) {
+            block_size = BATCH_LOOKUP_BLOCK;
+        }
+        for (size_t i = 0; i < block_size; i++) {
+            keys[i].type = key_type;
+            keys[i].data = raw_array_data(array_of_keys, block_start + i, key_type);
+            hashes[i] = key_hash(map, &(keys[i]));
+            prefetch_home_bucket(map, hashes[i]);
+        }
+        // the bucket heads (or swiss control bytes) are being loaded by now, so also start loading the entries they point to
+        if (map->storage_type == CHAINING_STORAGE) {
+            for (size_t i = 0; i < block_size; i++) {
+                const Entry *head = map->buckets[bucket_index(map, hashes[i], map->bucket_count)];
+                if (head != NULL) {
+                    __builtin_prefetch(head);
+                }
+            }
+        } else if (map->storage_type == SWISS_STORAGE) {
+            size_t group_mask = (map->bucket_count / SWISS_GROUP_SIZE) - 1;
+            for (size_t i = 0; i < block_size; i++) {
+                size_t group_start = ((hashes[i] >> 7) & group_mask) * SWISS_GROUP_SIZE;
+                uint32_t matches = swiss_match_tag(map->control_bytes + group_start, (signed char)(hashes[i] & 0x7F));
+                if (matches != 0) {
+                    __builtin_prefetch(&(map->slots[group_start + (size_t)swiss_first_bit(matches)]));
+                }
+            }
+        }
+        /* each key then counts like a hash_table_entry_lookup(): expired entries are misses (dropped on the spot, which
+           only ever happens in chaining maps, whose earlier results stay where they are) and caches get their bookkeeping.
+           Expiry is decided against one reading of the clock, so a key given twice cannot be found and then dropped */
+        for (size_t i = 0; i < block_size; i++) {
+            Entry *entry = drop_if_expired_at((HashMap *)map, map->storage_ops.lookup(map, &(keys[i]), hashes[i]), &(keys[i]), now);
+            if (map->cache_mode) {
+                cache_record_lookup((HashMap *)map, entry);
+            }
+            results[block_start + i] = entry;
+            found += (entry != NULL);
+        }
+    }
+    HASHMAP_COUNT(map, hits, found);
+    HASHMAP_COUNT(map, misses, number_of_elements - found);
+    return found;
+}
+
+/* batch deletions using a list of keys given as a raw array (same convention as hash_table_batch_insert()). The "strict_mode"
+   parameter determines if the function returns false if any key is not deleted (was never in the hashmap).
+   The caller's array is read directly (no key copies) and the table is shrunk at most once, after the last delete */
 bool hash_table_batch_delete(HashMap *map, void *array_of_keys, size_t number_of_elements, const DATA_TYPE key_type, const bool strict_mode) {
     if (!map || !array_of_keys) {
         perror("NULL argument in batch delete!");
@@ -996,27 +3975,332 @@ bool hash_table_batch_delete(HashMap *map, void *array_of_keys, size_t number_of
         fprintf(stderr, "Key type mismatch in batch delete! Expected %d, got %d.\n", map->key_type, key_type);
         return false;
     }
-
-    Key *keys = convert_array_to_keys(array_of_keys, number_of_elements, key_type);
-    if (!keys) {
-        perror("Failed to convert array to keys!");
-        return false;
+    if (map->bucket_count == 0) {
+        return !strict_mode;
     }
 
     bool success = true;
+    size_t key_count = map->key_count;
     for (size_t i = 0; i < number_of_elements; i++) {
-        if (!hash_table_entry_delete(map, &keys[i])) {
+        Key key = {.type = key_type, .data = raw_array_data(array_of_keys, i, key_type)};
+        if (!map->storage_ops.remove(map, &key)) {
             if (strict_mode) {
                 fprintf(stderr, "Key at index %zu not found in batch delete!\n", i);
                 success = false;  // Fail if strict mode is enabled and key was never in table
             }
         }
-        delete_key((keys[i]));
     }
-    free(keys);
+    HASHMAP_COUNT(map, deletes, key_count - map->key_count);
+    shrink_after_deletes(map);
+    return success;
+}
+
+/* STREAMING DUMP, RESTORE AND CHECKPOINTS
+*  A dump is a header followed by records: PUT (a key and its value), DELETE (a key) and END. Data uses the byte order of the
+*  machine that wrote it. Records are buffered and handed to the write callback DUMP_CHUNK_SIZE bytes at a time, so no copy
+*  of the map is ever built. A full dump replaces the contents of the map it is restored into, a checkpoint only replays
+*  the changes since the previous checkpoint
+*/
+
+#define DUMP_MAGIC "HMDUMP\0\1"
+#define DUMP_VERSION 1
+#define DUMP_CHUNK_SIZE (64 * 1024) // bytes buffered before each call of the write callback
+
+#define DUMP_RECORD_END 0
+#define DUMP_RECORD_PUT 1
+#define DUMP_RECORD_DELETE 2
+
+// start of every dump
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    int32_t key_type; // the DATA_TYPE of every key
+    uint32_t full; // 1 if the dump holds the whole map, 0 for a checkpoint of changes
+    uint32_t reserved;
+} Dump_header;
+
+// buffers records for a write callback
+typedef struct {
+    Dump_write_func write;
+    void *context;
+    size_t used;
+    bool failed; // a callback returned false, nothing more is written
+    unsigned char buffer[DUMP_CHUNK_SIZE];
+} Dump_writer;
+
+static void dump_flush(Dump_writer *writer) {
+    if (!writer->failed && writer->used > 0 && !writer->write(writer->buffer, writer->used, writer->context)) {
+        writer->failed = true;
+    }
+    writer->used = 0;
+}
+
+static void dump_bytes(Dump_writer *writer, const void *data, size_t size) {
+    if (writer->used + size > DUMP_CHUNK_SIZE) {
+        dump_flush(writer);
+        if (size > DUMP_CHUNK_SIZE) {
+            // too big to buffer (a long string), hand it over directly
+            if (!writer->failed && !writer->write(data, size, writer->context)) {
+                writer->failed = true;
+            }
+            return;
+        }
+    }
+    memcpy(writer->buffer + writer->used, data, size);
+    writer->used += size;
+}
+
+// a datapoint: its type, then the string length and bytes (no NUL), the byte string length and bytes, or the data bits
+static void dump_data(Dump_writer *writer, DATA_TYPE type, Data data) {
+    int32_t stored_type = type;
+    dump_bytes(writer, &stored_type, sizeof(stored_type));
+    if (type == STRING_TYPE) {
+        uint64_t length = strlen(data.string);
+        dump_bytes(writer, &length, sizeof(length));
+        dump_bytes(writer, data.string, length);
+    } else if (type == BYTES_TYPE) {
+        uint64_t length = data.bytes->length;
+        dump_bytes(writer, &length, sizeof(length));
+        dump_bytes(writer, data.bytes->data, length);
+    } else {
+        uint64_t bits = data_to_bits(type, data);
+        dump_bytes(writer, &bits, sizeof(bits));
+    }
+}
+
+static void dump_put_record(Dump_writer *writer, const Entry *entry) {
+    uint8_t record = DUMP_RECORD_PUT;
+    dump_bytes(writer, &record, sizeof(record));
+    dump_data(writer, entry->key.type, entry->key.data);
+    dump_data(writer, entry->value.type, entry->value.data);
+}
+
+// a writer with the header already buffered. NULL on failure
+static Dump_writer *dump_begin(Dump_write_func write, void *context, DATA_TYPE key_type, bool full) {
+    Dump_writer *writer = malloc(sizeof(Dump_writer));
+    if (writer == NULL) {
+        perror("Could not malloc the dump buffer!\n");
+        return NULL;
+    }
+    *writer = (Dump_writer){.write = write, .context = context, .used = 0, .failed = false};
+    Dump_header header = {0};
+    memcpy(header.magic, DUMP_MAGIC, sizeof(header.magic));
+    header.version = DUMP_VERSION;
+    header.key_type = key_type;
+    header.full = full ? 1 : 0;
+    dump_bytes(writer, &header, sizeof(header));
+    return writer;
+}
+
+// writes the END record and whatever is still buffered, then frees the writer. True if every callback succeeded
+static bool dump_finish(Dump_writer *writer) {
+    uint8_t record = DUMP_RECORD_END;
+    dump_bytes(writer, &record, sizeof(record));
+    dump_flush(writer);
+    bool success = !writer->failed;
+    free(writer);
     return success;
 }
 
+// the PUT records of every entry
+static void dump_all_entries(const HashMap *map, Dump_writer *writer) {
+    size_t position = 0;
+    for (Entry *entry = map->storage_ops.next_entry(map, &position, NULL); entry != NULL && !writer->failed;
+         entry = map->storage_ops.next_entry(map, &position, entry)) {
+        dump_put_record(writer, entry);
+    }
+}
+
+/* streams every entry of the map through the write callback (context is passed along unchanged). Works for any storage
+   type and only ever buffers DUMP_CHUNK_SIZE bytes. True on success, else false */
+bool hash_table_dump(const HashMap *map, Dump_write_func write, void *context) {
+    if (map == NULL || write == NULL) {
+        perror("NULL argument passed into hash_table_dump() function!\n");
+        return false;
+    }
+    if (map->key_type == CUSTOM_TYPE) {
+        perror("maps with custom keys cannot be dumped (only their hooks know what the keys hold)!\n");
+        return false;
+    }
+    Dump_writer *writer = dump_begin(write, context, map->key_type, true);
+    if (writer == NULL) {
+        return false;
+    }
+    dump_all_entries(map, writer);
+    return dump_finish(writer);
+}
+
+/* makes the map record which buckets change (and which keys get deleted) so hash_table_checkpoint() can write only those.
+   Chaining storage without incremental resizing only. The first checkpoint after this (and after any resize or clear)
+   is a full dump. True on success, else false */
+bool hash_table_enable_dirty_tracking(HashMap *map) {
+    if (map == NULL) {
+        perror("NULL map passed into hash_table_enable_dirty_tracking() function!\n");
+        return false;
+    }
+    if (map->storage_type != CHAINING_STORAGE || map->incremental_resize || map->key_type == CUSTOM_TYPE) {
+        perror("dirty bucket tracking needs chaining storage without incremental resizing (and keys that can be dumped)!\n");
+        return false;
+    }
+    map->dirty_tracking = true;
+    require_full_checkpoint(map);
+    return true;
+}
+
+/* writes the changes since the previous checkpoint: a DELETE for every deleted key, then a PUT for every entry of every
+   bucket that changed. Only the dirty bitmap is scanned, not the buckets. Falls back to a full dump the first time and
+   after resizes/clears. Nothing is reset if writing fails, so the checkpoint can be retried. True on success, else false */
+bool hash_table_checkpoint(HashMap *map, Dump_write_func write, void *context) {
+    if (map == NULL || write == NULL) {
+        perror("NULL argument passed into hash_table_checkpoint() function!\n");
+        return false;
+    }
+    if (!map->dirty_tracking) {
+        perror("hash_table_checkpoint() needs hash_table_enable_dirty_tracking() first!\n");
+        return false;
+    }
+    bool full = (map->dirty_buckets == NULL);
+    Dump_writer *writer = dump_begin(write, context, map->key_type, full);
+    if (writer == NULL) {
+        return false;
+    }
+    size_t word_count = (map->bucket_count + 63) / 64;
+    if (full) {
+        dump_all_entries(map, writer);
+    } else {
+        for (size_t i = 0; i < map->deleted_key_count; i++) {
+            uint8_t record = DUMP_RECORD_DELETE;
+            dump_bytes(writer, &record, sizeof(record));
+            dump_data(writer, map->deleted_keys[i].type, map->deleted_keys[i].data);
+        }
+        for (size_t word = 0; word < word_count && !writer->failed; word++) {
+            for (uint64_t bits = map->dirty_buckets[word]; bits != 0; bits &= bits - 1) {
+                size_t index = word * 64 + (size_t)__builtin_ctzll(bits);
+                for (Entry *entry = map->buckets[index]; entry != NULL; entry = entry->next) {
+                    dump_put_record(writer, entry);
+                }
+            }
+        }
+    }
+    if (!dump_finish(writer)) {
+        return false;
+    }
+    // start tracking the next checkpoint
+    free_deleted_keys(map);
+    if (full) {
+        map->dirty_buckets = calloc(word_count, sizeof(uint64_t)); // stays NULL (full again next time) if this fails
+    } else {
+        memset(map->dirty_buckets, 0, word_count * sizeof(uint64_t));
+    }
+    return true;
+}
+
+// reads a datapoint written by dump_data(). Strings and byte strings are malloc'd. False on a short read or bad data
+static bool restore_data(Dump_read_func read, void *context, DATA_TYPE *type, Data *data) {
+    int32_t stored_type;
+    if (!read(&stored_type, sizeof(stored_type), context)) {
+        return false;
+    }
+    *type = (DATA_TYPE)stored_type;
+    if (!is_raw_array_type(*type)) {
+        fprintf(stderr, "Invalid data type %d found while restoring a dump!\n", stored_type);
+        return false;
+    }
+    uint64_t word;
+    if (!read(&word, sizeof(word), context)) {
+        return false;
+    }
+    if (*type == BYTES_TYPE) {
+        void *block;
+        if (word > SIZE_MAX - sizeof(Bytes) || (block = malloc(sizeof(Bytes) + (size_t)word)) == NULL) {
+            perror("Could not malloc a byte string while restoring a dump!\n");
+            return false;
+        }
+        data->bytes = bytes_fill_block(block, NULL, 0);
+        data->bytes->length = (size_t)word;
+        if (word > 0 && !read((void *)data->bytes->data, (size_t)word, context)) {
+            free(block);
+            return false;
+        }
+        return true;
+    }
+    if (*type != STRING_TYPE) {
+        *data = data_from_bits(*type, word);
+        return true;
+    }
+    if (word >= SIZE_MAX || (data->string = malloc((size_t)word + 1)) == NULL) {
+        perror("Could not malloc a string while restoring a dump!\n");
+        return false;
+    }
+    if (word > 0 && !read(data->string, (size_t)word, context)) {
+        free(data->string);
+        return false;
+    }
+    data->string[word] = '\0';
+    return true;
+}
+
+/* applies a stream written by hash_table_dump() or hash_table_checkpoint() to the map (which must use the same key type).
+   A full dump clears the map first, checkpoints are replayed on top of what is there. If the stream is cut short the map
+   keeps whatever was applied so far. True on success, else false */
+bool hash_table_restore(HashMap *map, Dump_read_func read, void *context) {
+    if (map == NULL || read == NULL) {
+        perror("NULL argument passed into hash_table_restore() function!\n");
+        return false;
+    }
+    Dump_header header;
+    if (!read(&header, sizeof(header), context) || memcmp(header.magic, DUMP_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != DUMP_VERSION) {
+        perror("hash_table_restore() was not given a hash map dump!\n");
+        return false;
+    }
+    if (header.key_type != (int32_t)map->key_type) {
+        fprintf(stderr, "cannot restore a dump with keys of type %d into a map with keys of type %d!\n", header.key_type, map->key_type);
+        return false;
+    }
+    if (map->borrow_strings) {
+        perror("cannot restore a dump into a map that borrows strings (nothing would own the restored ones)!\n");
+        return false;
+    }
+    if (header.full && !hash_table_clear(map)) {
+        return false;
+    }
+    for (;;) {
+        uint8_t record;
+        if (!read(&record, sizeof(record), context)) {
+            perror("dump ended without an END record in hash_table_restore()!\n");
+            return false;
+        }
+        if (record == DUMP_RECORD_END) {
+            return true;
+        }
+        Key key;
+        Value value = {.type = INVALID_TYPE};
+        bool success = (record == DUMP_RECORD_PUT || record == DUMP_RECORD_DELETE) &&
+                       restore_data(read, context, &(key.type), &(key.data));
+        if (success && record == DUMP_RECORD_PUT) {
+            success = restore_data(read, context, &(value.type), &(value.data));
+            if (!success) {
+                delete_key(key);
+            }
+        }
+        if (!success) {
+            fprintf(stderr, "Corrupt or truncated record (type %d) found in hash_table_restore()!\n", record);
+            return false;
+        }
+        if (record == DUMP_RECORD_PUT) {
+            success = hash_table_insert_move(map, &key, &value); // the freshly read strings are handed over, not copied
+            delete_value(value);
+        } else {
+            hash_table_entry_delete(map, &key); // deleting a key the map does not have is fine
+        }
+        delete_key(key);
+        if (!success) {
+            return false;
+        }
+    }
+}
+
 // a function that returns the number of keys currently in the table (meant to be invoked by the user)
 size_t hash_table_key_count(const HashMap *map) {
     if (map == NULL) {
@@ -1035,6 +4319,175 @@ DATA_TYPE hash_table_get_key_type(const HashMap *map) {
     return map->key_type;  
 }
 
+// counts one chain or probe length into the histogram
+static void stats_record_length(HashMap_stats *stats, size_t length, size_t weight) {
+    stats->length_histogram[(length < HASHMAP_STATS_HISTOGRAM_SIZE) ? length : HASHMAP_STATS_HISTOGRAM_SIZE - 1] += weight;
+    if (length > stats->max_length) {
+        stats->max_length = length;
+    }
+}
+
+// the histogram of chain lengths of one bucket array (its first first_bucket buckets are skipped)
+static void stats_record_chains(HashMap_stats *stats, Entry *const *buckets, size_t first_bucket, size_t bucket_count, size_t *total) {
+    for (size_t i = first_bucket; i < bucket_count; i++) {
+        size_t length = 0;
+        for (const Entry *current = buckets[i]; current != NULL; current = current->next) {
+            length++;
+        }
+        stats_record_length(stats, length, 1);
+        // a lookup of each key in the chain walks up to it, so together they walk 1 + 2 + ... + length entries
+        *total += length * (length + 1) / 2;
+    }
+}
+
+/* what malloc() is estimated to really use for a block of size bytes: a glibc style 8 byte header, 16 byte alignment and
+   a 32 byte minimum */
+static size_t malloc_footprint(size_t size) {
+    size_t footprint = (size + sizeof(size_t) + 15) & ~(size_t)15;
+    return (footprint < 32) ? 32 : footprint;
+}
+
+// adds one malloc'd block of size bytes to a category of a HashMap_memory
+static void memory_add_block(HashMap_memory *memory, size_t *category, size_t size) {
+    if (size == 0) {
+        return;
+    }
+    *category += size;
+    memory->allocator_overhead += malloc_footprint(size) - size;
+}
+
+// the bytes of the separately malloc'd copy of a datapoint's string or byte string, 0 if it has none
+static size_t copied_data_bytes(DATA_TYPE type, Data data) {
+    if (type == STRING_TYPE && data.string != NULL) {
+        return strlen(data.string) + 1;
+    }
+    if (type == BYTES_TYPE && data.bytes != NULL) {
+        return sizeof(Bytes) + data.bytes->length;
+    }
+    return 0;
+}
+
+/* adds up the bytes the map is using: the table, one block per chained entry (or the slabs), every string copy (or the
+   arena) and the bookkeeping of checkpoints and TTLs, plus an estimate of the allocator's own overhead. Fills in the
+   breakdown if it is not NULL. Walks every entry once when the map copies its strings. Returns the total, 0 on errors */
+size_t hash_table_memory_usage(const HashMap *map, HashMap_memory *breakdown) {
+    if (map == NULL) {
+        perror("NULL map passed into hash_table_memory_usage() function!\n");
+        return 0;
+    }
+    HashMap_memory memory = {0};
+    memory_add_block(&memory, &memory.map, sizeof(HashMap));
+    switch (map->storage_type) {
+        case CHAINING_STORAGE:
+            memory_add_block(&memory, &memory.table, map->bucket_count * sizeof(Entry *));
+            memory_add_block(&memory, &memory.table, map->old_bucket_count * sizeof(Entry *));
+        break;
+        case LINEAR_PROBING_STORAGE:
+        case ROBIN_HOOD_STORAGE:
+            memory_add_block(&memory, &memory.table, map->bucket_count * sizeof(Entry));
+            memory_add_block(&memory, &memory.table, map->bucket_count * sizeof(size_t));
+        break;
+        case SWISS_STORAGE:
+            memory_add_block(&memory, &memory.table, map->bucket_count * sizeof(Entry));
+            memory_add_block(&memory, &memory.table, map->bucket_count);
+        break;
+        default:
+        break;
+    }
+    if (map->use_entry_slab) {
+        for (const Entry_slab *slab = map->slabs; slab != NULL; slab = slab->next) {
+            memory_add_block(&memory, &memory.entries, sizeof(Entry_slab) + slab->capacity * sizeof(Entry));
+        }
+    } else if (map->storage_type == CHAINING_STORAGE) {
+        memory.entries = map->key_count * sizeof(Entry);
+        memory.allocator_overhead += map->key_count * (malloc_footprint(sizeof(Entry)) - sizeof(Entry));
+    }
+    if (map->use_string_arena) {
+        for (const String_arena_chunk *chunk = map->string_arena; chunk != NULL; chunk = chunk->next) {
+            memory_add_block(&memory, &memory.strings, sizeof(String_arena_chunk) + chunk->capacity);
+        }
+    } else if (!map->borrow_strings) {
+        size_t position = 0;
+        const Entry *entry = NULL;
+        while ((entry = map->storage_ops.next_entry(map, &position, entry)) != NULL) {
+            memory_add_block(&memory, &memory.strings, copied_data_bytes(entry->key.type, entry->key.data));
+            memory_add_block(&memory, &memory.strings, copied_data_bytes(entry->value.type, entry->value.data));
+        }
+    }
+    if (map->dirty_buckets != NULL) {
+        memory_add_block(&memory, &memory.bookkeeping, ((map->bucket_count + 63) / 64) * sizeof(uint64_t));
+    }
+    memory_add_block(&memory, &memory.bookkeeping, map->deleted_key_capacity * sizeof(Key));
+    for (size_t i = 0; i < map->deleted_key_count; i++) {
+        memory_add_block(&memory, &memory.bookkeeping, copied_data_bytes(map->deleted_keys[i].type, map->deleted_keys[i].data));
+    }
+    if (map->tree_bins != NULL) {
+        memory_add_block(&memory, &memory.bookkeeping, map->bucket_count * sizeof(Tree_node *));
+        memory.bookkeeping += map->tree_node_count * sizeof(Tree_node); // one malloc per node
+        memory.allocator_overhead += map->tree_node_count * (malloc_footprint(sizeof(Tree_node)) - sizeof(Tree_node));
+    }
+    if (map->ttl_wheel != NULL) {
+        memory_add_block(&memory, &memory.bookkeeping, sizeof(Ttl_wheel));
+        for (size_t level = 0; level < TTL_WHEEL_LEVELS; level++) {
+            for (size_t slot = 0; slot < TTL_WHEEL_SLOTS; slot++) {
+                memory_add_block(&memory, &memory.bookkeeping, map->ttl_wheel->slots[level][slot].capacity * sizeof(Ttl_timer));
+            }
+        }
+    }
+    memory.total = memory.map + memory.table + memory.entries + memory.strings + memory.bookkeeping + memory.allocator_overhead;
+    if (breakdown != NULL) {
+        *breakdown = memory;
+    }
+    return memory.total;
+}
+
+/* fills stats with the counters (compiled in with -DHASHMAP_STATS) and a histogram of the chain or probe lengths of the
+   table as it is now. The histogram walks the whole table once, so it is meant for periodic metrics, not hot loops.
+   A lopsided histogram or a large max_length for a modest load factor means the hash is clustering the keys.
+   True on success, else false */
+bool hash_table_get_stats(const HashMap *map, HashMap_stats *stats) {
+    if (map == NULL || stats == NULL) {
+        perror("NULL argument passed into hash_table_get_stats() function!\n");
+        return false;
+    }
+    *stats = (HashMap_stats){0};
+#ifdef HASHMAP_STATS
+    stats->counters_enabled = true;
+    stats->counters = map->counters;
+#endif
+    size_t total = 0;
+    if (map->storage_type == CHAINING_STORAGE) {
+        stats_record_chains(stats, map->buckets, 0, map->bucket_count, &total);
+        if (map->old_buckets != NULL) {
+            stats_record_chains(stats, map->old_buckets, map->rehash_index, map->old_bucket_count, &total);
+        }
+    } else if (map->storage_type == SWISS_STORAGE) {
+        size_t group_mask = (map->bucket_count / SWISS_GROUP_SIZE) - 1;
+        for (size_t i = 0; i < map->bucket_count; i++) {
+            if (map->control_bytes[i] < 0) {
+                continue;
+            }
+            // replay the triangular probe sequence until it reaches the entry's group
+            size_t group = (map->slots[i].hash >> 7) & group_mask;
+            size_t length = 1;
+            for (size_t step = 1; group != i / SWISS_GROUP_SIZE && step <= group_mask + 1; step++, length++) {
+                group = (group + step) & group_mask;
+            }
+            stats_record_length(stats, length, 1);
+            total += length;
+        }
+    } else {
+        for (size_t i = 0; i < map->bucket_count; i++) {
+            if (map->probe_distances[i] != 0) {
+                stats_record_length(stats, map->probe_distances[i], 1);
+                total += map->probe_distances[i];
+            }
+        }
+    }
+    stats->mean_length = (map->key_count > 0) ? (double)total / (double)map->key_count : 0.0;
+    return true;
+}
+
 // debugging function that prints basic info about a hashmap and entries per bucket
 void hash_table_debug_print(const HashMap *map) {
     if (!map) {
@@ -1047,6 +4500,36 @@ void hash_table_debug_print(const HashMap *map) {
     printf("Key count: %zu\n", map->key_count);
     printf("Load factor: %.2f\n", get_hash_table_load_factor(map));
 
+    if (map->storage_type == SWISS_STORAGE) {
+        printf("Deleted slots: %zu\n", map->deleted_slots);
+        for (size_t i = 0; i < (map->bucket_count); i++) {
+            if (map->control_bytes[i] == SWISS_EMPTY) {
+                printf("Slot[%zu]: empty\n", i);
+            } else if (map->control_bytes[i] == SWISS_DELETED) {
+                printf("Slot[%zu]: deleted\n", i);
+            } else {
+                printf("Slot[%zu]: tag 0x%02x\n", i, (unsigned int)map->control_bytes[i]);
+            }
+        }
+        printf("=== END OF DEBUG INFO ===\n");
+        return;
+    }
+    if (map->storage_type != CHAINING_STORAGE) {
+        // open addressing has one entry per slot, so show how far each one is from its home slot instead
+        for (size_t i = 0; i < (map->bucket_count); i++) {
+            if (map->probe_distances[i] == 0) {
+                printf("Slot[%zu]: empty\n", i);
+            } else {
+                printf("Slot[%zu]: probe distance %zu\n", i, map->probe_distances[i] - 1);
+            }
+        }
+        printf("=== END OF DEBUG INFO ===\n");
+        return;
+    }
+
+    if (map->old_buckets != NULL) {
+        printf("Incremental resize in progress: %zu of %zu old buckets migrated\n", map->rehash_index, map->old_bucket_count);
+    }
     for (size_t i = 0; i < (map->bucket_count); i++) {
         Entry *current = map->buckets[i];
         size_t bucket_size = 0;
@@ -1071,8 +4554,36 @@ void hash_table_info_print(const HashMap *map) {
     printf("=== HASH TABLE INFO ===\n");
     printf("Bucket count: %zu\n", map->bucket_count);
     printf("Key count: %zu\n", map->key_count);
-    printf("Load factor: %.2f\n", get_hash_table_load_factor(map));
+    printf("Load factor: %.2f (shrinks below %.3f, grows past %.3f)\n", get_hash_table_load_factor(map), map->min_load_factor,
+           map->max_load_factor);
+    if (map->value_type != INVALID_TYPE) {
+        printf("Value type: fixed to %d\n", map->value_type);
+    }
+    if (map->seeded_hashing) {
+        printf("Hashing: SipHash-1-3, seeded\n");
+    }
+    if (map->tree_bin_threshold > 0) {
+        printf("Tree bins: %zu nodes (chains longer than %zu get one)\n", map->tree_node_count, map->tree_bin_threshold);
+    }
+    HashMap_memory memory;
+    hash_table_memory_usage(map, &memory);
+    printf("Memory: %zu bytes (table %zu, entries %zu, strings %zu, bookkeeping %zu, allocator overhead %zu)\n", memory.total,
+           memory.table, memory.entries, memory.strings, memory.bookkeeping, memory.allocator_overhead);
+    HashMap_stats stats;
+    if (hash_table_get_stats(map, &stats)) {
+        printf("Longest %s: %zu, mean lookup length: %.2f\n", (map->storage_type == CHAINING_STORAGE) ? "chain" : "probe",
+               stats.max_length, stats.mean_length);
+        if (stats.counters_enabled) {
+            printf("Inserts: %zu, updates: %zu, hits: %zu, misses: %zu, deletes: %zu, resizes: %zu (%.3f ms)\n", stats.counters.inserts,
+                   stats.counters.updates, stats.counters.hits, stats.counters.misses, stats.counters.deletes, stats.counters.resizes,
+                   (double)stats.counters.resize_nanoseconds / 1e6);
+        }
+    }
+    if (map->cache_mode) {
+        printf("Cache: %zu/%zu entries, %zu/%zu bytes (0 = no limit), %zu hits, %zu misses, %zu evictions\n", map->key_count,
+               map->cache_capacity, map->cache_bytes, map->cache_byte_capacity, map->cache_hits, map->cache_misses, map->cache_evictions);
+    }
     return;
 }
 
-#endif /* HASHMAP_H */
\ No newline at end of file
+#endif /* HASHMAP_IMPLEMENTATION */
@@ -0,0 +1,316 @@
+
+#ifndef HASHMAP_SNAPSHOT_H
+#define HASHMAP_SNAPSHOT_H
+
+/* Read-only snapshots of a HashMap that can be memory mapped and used without loading them.
+*  hash_table_save() writes a position independent image: a header, a flat open addressing slot array and one blob holding
+*  every key/value string, with offsets into the blob instead of char pointers.
+*  hash_table_open_mmap() maps such an image read-only and answers lookups straight from the page cache, so opening is
+*  immediate whatever the size and every process mapping the same file shares its physical pages.
+*  Images use the byte order and type sizes of the machine that wrote them. POSIX only (mmap)
+*
+*  The definitions are compiled in with those of hashmap.h, where HASHMAP_IMPLEMENTATION is defined (see hashmap.h)
+*/
+
+#include <fcntl.h> // open
+#include <sys/mman.h> // mmap
+#include <sys/stat.h> // fstat
+#include <unistd.h> // close
+#include "hashmap.h"
+
+#define SNAPSHOT_MAGIC "HMSNAP\0\1"
+#define SNAPSHOT_VERSION 1
+
+// start of every image
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    int32_t key_type; // the DATA_TYPE of every key
+    uint64_t slot_count; // always a power of 2, at least twice key_count
+    uint64_t key_count;
+    uint64_t strings_offset; // where the string blob starts in the file
+    uint64_t strings_size; // bytes in the blob, every string is NUL terminated
+} Snapshot_header;
+
+// one slot of the image. Strings are offsets into the blob, other data is stored by its bits
+typedef struct {
+    uint64_t hash; // mix_hash() of the key's hash_func()
+    int32_t key_type; // INVALID_TYPE for an empty slot
+    int32_t value_type;
+    uint64_t key_data;
+    uint64_t value_data;
+} Snapshot_slot;
+
+// a snapshot mapped into memory by hash_table_open_mmap()
+typedef struct {
+    const unsigned char *base; // the whole mapped file
+    size_t size;
+    const Snapshot_slot *slots;
+    const char *strings;
+    size_t slot_count;
+    size_t key_count;
+    size_t strings_size;
+    DATA_TYPE key_type;
+    Key_ops key_ops;
+} MappedHashMap;
+
+/* THE API (each function is documented at its definition below) */
+
+bool hash_table_save(const HashMap *map, const char *path);
+MappedHashMap *hash_table_open_mmap(const char *path);
+bool mapped_hash_table_lookup(const MappedHashMap *map, const Key *key, Value *value_out);
+bool mapped_hash_table_contains(const MappedHashMap *map, const Key *key);
+size_t mapped_hash_table_key_count(const MappedHashMap *map);
+bool hash_table_close_mmap(MappedHashMap **map);
+
+#endif /* HASHMAP_SNAPSHOT_H */
+
+#if defined(HASHMAP_IMPLEMENTATION) && !defined(HASHMAP_SNAPSHOT_IMPLEMENTATION_INCLUDED)
+#define HASHMAP_SNAPSHOT_IMPLEMENTATION_INCLUDED
+
+// turns stored bits back into a datapoint. Strings point into the mapped blob
+static Data snapshot_data(const MappedHashMap *map, DATA_TYPE type, uint64_t bits) {
+    if (type != STRING_TYPE) {
+        return data_from_bits(type, bits);
+    }
+    Data data;
+    data.string = (char *)(map->strings + bits);
+    return data;
+}
+
+// writes the strings of the map's entries in iteration order (the order hash_table_save() gave them offsets in)
+static bool snapshot_write_strings(const HashMap *map, FILE *file) {
+    size_t position = 0;
+    for (Entry *entry = map->storage_ops.next_entry(map, &position, NULL); entry != NULL;
+         entry = map->storage_ops.next_entry(map, &position, entry)) {
+        if (entry->key.type == STRING_TYPE && fwrite(entry->key.data.string, strlen(entry->key.data.string) + 1, 1, file) != 1) {
+            return false;
+        }
+        if (entry->value.type == STRING_TYPE && fwrite(entry->value.data.string, strlen(entry->value.data.string) + 1, 1, file) != 1) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* writes a snapshot of the map to path (through a temporary file that replaces path at the end, so readers never see a
+   half written image). The slot array is built in memory first (32 bytes per slot, two slots per key). True on success */
+bool hash_table_save(const HashMap *map, const char *path) {
+    if (map == NULL || path == NULL) {
+        perror("NULL argument passed into hash_table_save() function!\n");
+        return false;
+    }
+    if (map->key_type == CUSTOM_TYPE || map->key_type == BYTES_TYPE) {
+        perror("maps with custom or byte string keys cannot be saved as snapshots!\n");
+        return false;
+    }
+    size_t slot_count = power_of_two_bucket_count(map->key_count * 2, true, 2);
+    Snapshot_slot *slots = malloc(slot_count * sizeof(Snapshot_slot));
+    if (slots == NULL) {
+        perror("Could not malloc the slot array in hash_table_save()!\n");
+        return false;
+    }
+    for (size_t i = 0; i < slot_count; i++) {
+        slots[i].key_type = INVALID_TYPE;
+    }
+    // place every entry with linear probing, handing out string offsets in iteration order
+    uint64_t strings_size = 0;
+    size_t position = 0;
+    for (Entry *entry = map->storage_ops.next_entry(map, &position, NULL); entry != NULL;
+         entry = map->storage_ops.next_entry(map, &position, entry)) {
+        uint64_t hash = mix_hash(map->key_ops.hash_func(&(entry->key)));
+        size_t index = hash & (slot_count - 1);
+        while (slots[index].key_type != INVALID_TYPE) {
+            index = next_slot(index, slot_count);
+        }
+        if (entry->value.type != INTEGER_TYPE && entry->value.type != STRING_TYPE && entry->value.type != FLOAT_TYPE &&
+            entry->value.type != DOUBLE_TYPE) {
+            fprintf(stderr, "Values of type %d cannot be saved in a snapshot!\n", entry->value.type);
+            free(slots);
+            return false;
+        }
+        Snapshot_slot *slot = &(slots[index]);
+        slot->hash = hash;
+        slot->key_type = entry->key.type;
+        slot->value_type = entry->value.type;
+        if (entry->key.type == STRING_TYPE) {
+            slot->key_data = strings_size;
+            strings_size += strlen(entry->key.data.string) + 1;
+        } else {
+            slot->key_data = data_to_bits(entry->key.type, entry->key.data);
+        }
+        if (entry->value.type == STRING_TYPE) {
+            slot->value_data = strings_size;
+            strings_size += strlen(entry->value.data.string) + 1;
+        } else {
+            slot->value_data = data_to_bits(entry->value.type, entry->value.data);
+        }
+    }
+    Snapshot_header header = {0};
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = SNAPSHOT_VERSION;
+    header.key_type = map->key_type;
+    header.slot_count = slot_count;
+    header.key_count = map->key_count;
+    header.strings_offset = sizeof(Snapshot_header) + slot_count * sizeof(Snapshot_slot);
+    header.strings_size = strings_size;
+
+    size_t path_length = strlen(path);
+    char *temporary_path = malloc(path_length + 5);
+    if (temporary_path == NULL) {
+        perror("Could not malloc the temporary path in hash_table_save()!\n");
+        free(slots);
+        return false;
+    }
+    memcpy(temporary_path, path, path_length);
+    memcpy(temporary_path + path_length, ".tmp", 5);
+    FILE *file = fopen(temporary_path, "wb");
+    if (file == NULL) {
+        fprintf(stderr, "Could not open %s for writing in hash_table_save()!\n", temporary_path);
+        free(slots);
+        free(temporary_path);
+        return false;
+    }
+    bool success = fwrite(&header, sizeof(header), 1, file) == 1 &&
+                   fwrite(slots, sizeof(Snapshot_slot), slot_count, file) == slot_count &&
+                   snapshot_write_strings(map, file);
+    success = (fclose(file) == 0) && success;
+    free(slots);
+    if (success && rename(temporary_path, path) != 0) {
+        fprintf(stderr, "Could not move the snapshot to %s in hash_table_save()!\n", path);
+        success = false;
+    }
+    if (!success) {
+        perror("Failed to write the snapshot in hash_table_save()!\n");
+        remove(temporary_path);
+    }
+    free(temporary_path);
+    return success;
+}
+
+/* maps a snapshot written by hash_table_save() read-only. Returns NULL if the file cannot be mapped or is not a valid image.
+   Nothing is read up front beyond the header */
+MappedHashMap *hash_table_open_mmap(const char *path) {
+    if (path == NULL) {
+        perror("NULL path passed into hash_table_open_mmap() function!\n");
+        return NULL;
+    }
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Could not open snapshot %s in hash_table_open_mmap()!\n", path);
+        return NULL;
+    }
+    struct stat file_info;
+    if (fstat(fd, &file_info) != 0 || (size_t)file_info.st_size < sizeof(Snapshot_header)) {
+        fprintf(stderr, "Snapshot %s is too small to be valid!\n", path);
+        close(fd);
+        return NULL;
+    }
+    size_t size = (size_t)file_info.st_size;
+    void *base = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd); // the mapping stays valid without the descriptor
+    if (base == MAP_FAILED) {
+        fprintf(stderr, "Could not mmap snapshot %s!\n", path);
+        return NULL;
+    }
+    const Snapshot_header *header = base;
+    Key_ops key_ops;
+    bool valid = memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)) == 0 && header->version == SNAPSHOT_VERSION &&
+                 key_ops_for_type((DATA_TYPE)header->key_type, &key_ops) &&
+                 header->slot_count >= 2 && (header->slot_count & (header->slot_count - 1)) == 0 &&
+                 header->slot_count <= (size - sizeof(Snapshot_header)) / sizeof(Snapshot_slot) &&
+                 header->strings_offset == sizeof(Snapshot_header) + header->slot_count * sizeof(Snapshot_slot) &&
+                 header->strings_size == size - header->strings_offset &&
+                 (header->strings_size == 0 || ((const char *)base)[size - 1] == '\0');
+    if (!valid) {
+        fprintf(stderr, "%s is not a valid hash map snapshot!\n", path);
+        munmap(base, size);
+        return NULL;
+    }
+    MappedHashMap *map = malloc(sizeof(MappedHashMap));
+    if (map == NULL) {
+        perror("Could not malloc the mapped hash map in hash_table_open_mmap()!\n");
+        munmap(base, size);
+        return NULL;
+    }
+    map->base = base;
+    map->size = size;
+    map->slots = (const Snapshot_slot *)(map->base + sizeof(Snapshot_header));
+    map->strings = (const char *)(map->base + header->strings_offset);
+    map->slot_count = header->slot_count;
+    map->key_count = header->key_count;
+    map->strings_size = header->strings_size;
+    map->key_type = (DATA_TYPE)header->key_type;
+    map->key_ops = key_ops;
+    return map;
+}
+
+// the slot holding the key, or NULL
+static const Snapshot_slot *mapped_find(const MappedHashMap *map, const Key *key) {
+    uint64_t hash = mix_hash(map->key_ops.hash_func(key));
+    size_t index = hash & (map->slot_count - 1);
+    // there are always empty slots (at most half are used), so the probe ends
+    for (size_t probes = 0; probes < map->slot_count && map->slots[index].key_type != INVALID_TYPE; probes++) {
+        const Snapshot_slot *slot = &(map->slots[index]);
+        if (slot->hash == hash && (slot->key_type != STRING_TYPE || slot->key_data < map->strings_size)) {
+            Key stored = {.type = map->key_type, .data = snapshot_data(map, map->key_type, slot->key_data)};
+            if (map->key_ops.cmp_func(&stored, key) == 0) {
+                return slot;
+            }
+        }
+        index = next_slot(index, map->slot_count);
+    }
+    return NULL;
+}
+
+/* copies the value of a key into value_out without allocating: string values point into the mapping and stay valid until
+   hash_table_close_mmap(). True if the key was found, else false */
+bool mapped_hash_table_lookup(const MappedHashMap *map, const Key *key, Value *value_out) {
+    if (map == NULL || key == NULL || value_out == NULL) {
+        perror("NULL argument passed into mapped_hash_table_lookup() function!\n");
+        return false;
+    }
+    if (key->type != map->key_type) {
+        fprintf(stderr, "Key passed into mapped_hash_table_lookup() has the wrong key type! Expected %d, got %d\n", map->key_type, key->type);
+        return false;
+    }
+    const Snapshot_slot *slot = mapped_find(map, key);
+    if (slot == NULL || (slot->value_type == STRING_TYPE && slot->value_data >= map->strings_size)) {
+        return false;
+    }
+    value_out->type = (DATA_TYPE)slot->value_type;
+    value_out->data = snapshot_data(map, value_out->type, slot->value_data);
+    return true;
+}
+
+// returns true if key exists, else false
+bool mapped_hash_table_contains(const MappedHashMap *map, const Key *key) {
+    if (map == NULL || key == NULL || key->type != map->key_type) {
+        perror("NULL map/key or wrong key type passed into mapped_hash_table_contains() function!\n");
+        return false;
+    }
+    return mapped_find(map, key) != NULL;
+}
+
+// number of keys in the snapshot
+size_t mapped_hash_table_key_count(const MappedHashMap *map) {
+    if (map == NULL) {
+        perror("passed in NULL map into mapped_hash_table_key_count() function!\n");
+        return 0;
+    }
+    return map->key_count;
+}
+
+// unmaps the snapshot and sets the original pointer to NULL. Strings handed out by lookups become invalid
+bool hash_table_close_mmap(MappedHashMap **map) {
+    if (map == NULL || *map == NULL) {
+        perror("mapped hash map to close is NULL!\n");
+        return false;
+    }
+    munmap((void *)(*map)->base, (*map)->size);
+    free(*map);
+    *map = NULL;
+    return true;
+}
+
+#endif /* HASHMAP_IMPLEMENTATION */
@@ -1,38 +1,216 @@
+"""The Python dict baseline of speed_test.c: the same workloads, key sets and sizes, printed in the same columns.
+
+usage: python3 py_speed.py [largest size]   (or `make bench-python BENCH_ARGS=...`)
+The largest size defaults to 1e6 keys since the interpreter is far slower than the C targets. Times are wall clock from
+time.perf_counter_ns(), taken per batch of BENCH_BATCH operations like the C suite. bytes/entry only counts the dict's
+own table (sys.getsizeof()), not the key objects.
+"""
+import math
+import sys
 import time
-import random
 
-NUMBER_OF_KEYS = int(1e7)
-RANGE = 1000
+BENCH_BATCH = 256
+BENCH_MIN_OPERATIONS = 1 << 19
+BENCH_MIN_ITERATION_PASSES = 8
+BENCH_WRITE_PERCENT = 10
+BENCH_ZIPF_THETA = 0.99
+BENCH_TIME_LIMIT_SECONDS = 10.0
+MASK32 = 0xFFFFFFFF
+MASK64 = 0xFFFFFFFFFFFFFFFF
+
+DISTRIBUTIONS = ["uniform", "zipfian", "adversarial"]
+WORKLOADS = ["insert", "lookup hit", "lookup miss", "mixed 90/10", "iterate", "delete"]
+
+
+def mix32(x):
+    x ^= x >> 16
+    x = (x * 0x85EBCA6B) & MASK32
+    x ^= x >> 13
+    x = (x * 0xC2B2AE35) & MASK32
+    return x ^ (x >> 16)
+
+
+def mix64(x):
+    x = ((x ^ (x >> 30)) * 0xBF58476D1CE4E5B9) & MASK64
+    x = ((x ^ (x >> 27)) * 0x94D049BB133111EB) & MASK64
+    return x ^ (x >> 31)
+
+
+class Random:
+    """splitmix64, the generator speed_test.c uses"""
+
+    def __init__(self):
+        self.state = 0x853C49E6748FEA9B
+
+    def next(self):
+        self.state = (self.state + 0x9E3779B97F4A7C15) & MASK64
+        return mix64(self.state)
+
+    def unit(self):
+        return (self.next() >> 11) * 2.0 ** -53
+
+
+def to_int32(x):
+    return x - (1 << 32) if x & 0x80000000 else x
+
+
+def generate_key(key_type, distribution, index):
+    """the key speed_test.c's generate_key() makes for the same index"""
+    adversarial = distribution == "adversarial"
+    if key_type == "int":
+        return to_int32((index << 6) & MASK32) if adversarial else to_int32(mix32(index & MASK32))
+    if key_type == "double":
+        return float(index) if adversarial else (mix64(index) >> 11) * 2.0 ** -53
+    if adversarial:
+        return f"tenant/00000000/session/00000000/user/{index:016d}"
+    return f"{mix64(index):016x}"
+
+
+def lookup_indexes(random, count, n, distribution):
+    if distribution != "zipfian":
+        return [random.next() % n for _ in range(count)]
+    zeta_n = sum(1.0 / math.pow(i, BENCH_ZIPF_THETA) for i in range(1, n + 1))
+    zeta_2 = 1.0 + math.pow(0.5, BENCH_ZIPF_THETA)
+    alpha = 1.0 / (1.0 - BENCH_ZIPF_THETA)
+    eta = (1.0 - math.pow(2.0 / n, 1.0 - BENCH_ZIPF_THETA)) / (1.0 - zeta_2 / zeta_n)
+    indexes = []
+    for _ in range(count):
+        u = random.unit()
+        uz = u * zeta_n
+        if uz < 1.0:
+            index = 0
+        elif uz < zeta_2:
+            index = 1
+        else:
+            index = int(n * math.pow(eta * u - eta + 1.0, alpha))
+        indexes.append(min(index, n - 1))
+    return indexes
+
+
+class Samples:
+    def __init__(self):
+        self.samples = []
+        self.total = 0
+        self.operations = 0
+
+    def record(self, nanoseconds, operations):
+        self.total += nanoseconds
+        self.operations += operations
+        self.samples.append(nanoseconds / operations)
+
+    def percentile(self, fraction):
+        return self.samples[int(fraction * (len(self.samples) - 1) + 0.5)] if self.samples else 0.0
+
+
+def time_operations(dictionary, workload, keys, order, samples, deadline):
+    """times a workload BENCH_BATCH operations at a time, returns (matched, gave_up) like the C time_operations()"""
+    n = len(keys) // 2
+    matched = 0
+    clock = time.perf_counter_ns
+    for begin in range(0, len(order), BENCH_BATCH):
+        batch = range(begin, min(begin + BENCH_BATCH, len(order)))
+        start = clock()
+        if workload == "insert":
+            for i in batch:
+                dictionary[keys[order[i]]] = i
+            matched += len(batch)
+        elif workload == "lookup hit":
+            for i in batch:
+                matched += keys[order[i]] in dictionary
+        elif workload == "lookup miss":
+            for i in batch:
+                matched += keys[n + order[i]] in dictionary
+        elif workload == "mixed 90/10":
+            for i in batch:
+                if i % 100 < BENCH_WRITE_PERCENT:
+                    dictionary[keys[order[i]]] = i
+                    matched += 1
+                else:
+                    matched += keys[order[i]] in dictionary
+        elif workload == "delete":
+            for i in batch:
+                matched += dictionary.pop(keys[order[i]], None) is not None
+        finish = clock()
+        samples.record(finish - start, len(batch))
+        if finish > deadline:
+            return matched, True
+    return matched, False
+
+
+def benchmark(key_type, distribution, keys, insert_order, lookup_order):
+    n = len(keys) // 2
+    rounds = max(1, BENCH_MIN_OPERATIONS // n)
+    passes = BENCH_MIN_OPERATIONS // n if n * BENCH_MIN_ITERATION_PASSES < BENCH_MIN_OPERATIONS else BENCH_MIN_ITERATION_PASSES
+    lookup_rounds = max(1, BENCH_MIN_OPERATIONS // len(lookup_order))
+    deadline = time.perf_counter_ns() + int(BENCH_TIME_LIMIT_SECONDS * 1e9)
+    samples = {workload: Samples() for workload in WORKLOADS}
+    bytes_per_entry = 0.0
+    correct, gave_up = True, False
+    for round_number in range(rounds):
+        dictionary = {}
+        matched, gave_up = time_operations(dictionary, "insert", keys, insert_order, samples["insert"], deadline)
+        if round_number == rounds - 1 and not gave_up:
+            bytes_per_entry = sys.getsizeof(dictionary) / n
+            for _ in range(lookup_rounds):
+                for workload, expected in (("lookup hit", len(lookup_order)), ("lookup miss", 0),
+                                           ("mixed 90/10", len(lookup_order))):
+                    matched, gave_up = time_operations(dictionary, workload, keys, lookup_order, samples[workload], deadline)
+                    correct = correct and (gave_up or matched == expected)
+                    if gave_up:
+                        break
+                if gave_up:
+                    break
+            for _ in range(passes if not gave_up else 0):
+                start = time.perf_counter_ns()
+                total = 0
+                for value in dictionary.values():
+                    total += value
+                samples["iterate"].record(time.perf_counter_ns() - start, n)
+        if not gave_up:
+            matched, gave_up = time_operations(dictionary, "delete", keys, insert_order, samples["delete"], deadline)
+            correct = correct and (gave_up or matched == n)
+        if gave_up or not correct:
+            break
+    if not correct:
+        print("dict returned wrong results!")
+    for workload in WORKLOADS:
+        s = samples[workload]
+        if s.operations == 0:
+            continue
+        s.samples.sort()
+        row = (f"{'python dict':<18} {key_type:<7} {distribution:<12} {n:>9} {workload:<12} {s.total / s.operations:8.1f} "
+               f"{s.percentile(0.5):8.1f} {s.percentile(0.9):8.1f} {s.percentile(0.99):8.1f}")
+        if workload == "insert" and bytes_per_entry:
+            row += f" {bytes_per_entry:10.1f}"
+        print(row)
+    if gave_up:
+        print(f"{'python dict':<18} {key_type:<7} {distribution:<12} {n:>9} gave up after {BENCH_TIME_LIMIT_SECONDS:.0f} seconds")
+
 
 def main():
-    print(f"Attempting to batch insert {NUMBER_OF_KEYS:.2e} keys into Python dictionary")
-    
-    # Generate keys and values
-    start = time.time()
-    keys = list(range(NUMBER_OF_KEYS))
-    values = [random.randint(1, RANGE - 1) for _ in range(NUMBER_OF_KEYS)]
-
-    # Create dictionary
-    dictionary = {}
-
-    # Start timer
-    start_time = time.time()
-
-    # Insert keys and values in batch
-    for i in range(NUMBER_OF_KEYS):
-        dictionary[keys[i]] = values[i]
-
-    # End timer
-    end_time = time.time()
-
-    # Calculate time spent
-    time_spent = end_time - start_time
-    print(f"Operation took {time_spent:.4f} seconds")
-
-    # Optionally print dictionary info
-    print(f"Dictionary size: {len(dictionary)}")
-    
-    print(f"total time taken: {time.time() - start:.4f} seconds")
+    largest = int(float(sys.argv[1])) if len(sys.argv) > 1 else 1000000
+    random = Random()
+    print(f"batch size {BENCH_BATCH} ops, mixed workload {BENCH_WRITE_PERCENT}% writes, Zipf theta {BENCH_ZIPF_THETA:.2f}")
+    print(f"{'target':<18} {'key':<7} {'keys':<12} {'size':>9} {'workload':<12} {'mean ns':>8} {'p50':>8} {'p90':>8} "
+          f"{'p99':>8} {'bytes/entry':>10}")
+    start = time.perf_counter()
+    sizes = [512, 16384, 262144, largest]
+    previous = 0
+    for n in sizes:
+        if n > largest or n <= previous:
+            continue
+        previous = n
+        insert_order = list(range(n))
+        for i in range(n - 1, 0, -1):
+            j = random.next() % (i + 1)
+            insert_order[i], insert_order[j] = insert_order[j], insert_order[i]
+        for key_type in ("int", "double", "string"):
+            for distribution in DISTRIBUTIONS:
+                keys = [generate_key(key_type, distribution, i) for i in range(2 * n)]
+                lookup_order = lookup_indexes(random, n, n, distribution)
+                benchmark(key_type, distribution, keys, insert_order, lookup_order)
+    print(f"total time: {time.perf_counter() - start:.2f} seconds")
+
 
 if __name__ == "__main__":
     main()
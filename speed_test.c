@@ -1,40 +1,615 @@
+/* Benchmark suite for the hashmap layouts. Run with `make bench` (or `make bench BENCH_ARGS="4000000 swiss"`)
+*
+*  usage: ./speed_test [largest size] [target filter]
+*  Every target (the generic HashMap layouts and the macro generated typed maps) runs the same workloads for int, double
+*  and string keys drawn from uniform, Zipfian and adversarial distributions, at sizes from L1 resident up to larger than
+*  the last level cache (the largest size defaults to twice the LLC's worth of entries, at least 1e6 keys). The filter, if
+*  given, only runs targets whose name contains it.
+*
+*  Times are wall clock from clock_gettime(CLOCK_MONOTONIC). Reading the clock costs about as much as one lookup, so
+*  operations are timed in batches of BENCH_BATCH and the percentiles are of the per batch ns/op. bytes/entry is the
+*  growth of the heap (mallinfo2) across building the map, so it includes copied string keys. py_speed.py runs the same
+*  workloads on a Python dict (`make bench-python`) for the dict baseline. `make bench-native`, `bench-lto`,
+*  `bench-amalgamated` and `bench-pgo` run the suite built with more optimizations (see the makefile).
+*/
 #include <stdio.h>
 #include "hashmap.h"
+#include "typed_hashmap.h"
 #include <time.h>
+#include <math.h>
+#include <unistd.h>
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+#include <malloc.h>
+#define BENCH_HAVE_MALLINFO2
+#endif
 
-#define NUMBER_OF_KEYS (int)(1e7)
-#define RANGE 1000
+#define BENCH_BATCH 256 // operations per clock_gettime() sample
+#define BENCH_MIN_OPERATIONS ((size_t)1 << 19) // small maps repeat the workloads until this many operations were timed
+#define BENCH_MIN_ITERATION_PASSES 8
+#define BENCH_WRITE_PERCENT 10 // of the mixed workload's operations, the rest are lookups
+#define BENCH_ZIPF_THETA 0.99 // the skew YCSB uses
+#define BENCH_STRING_LENGTH 64 // bytes per generated string key (including the terminator)
+#define BENCH_TIME_LIMIT_SECONDS 10.0 // per target and key set, after which the remaining workloads are skipped
+#define BENCH_MAX_KEYS ((size_t)1 << 24) // adversarial int keys are index << 6, which must fit an int for all 2n indexes
 
-int main(void) {
-    srand(time(0));
+static inline size_t bench_hash_double(double key) {
+    uint64_t bits;
+    memcpy(&bits, &key, sizeof(double));
+    return (size_t)bits;
+}
 
-    clock_t start = clock();
-    printf("Attempting to batch insert %.2e keys into hashmap\n", (double)NUMBER_OF_KEYS);
+static inline bool bench_eq_double(double a, double b) {
+    return a == b;
+}
 
-    int *keys = malloc(sizeof(int) * NUMBER_OF_KEYS);
-    int *values = malloc(sizeof(int) * NUMBER_OF_KEYS);
+HASHMAP_DECLARE(bench_int_map, int, int, typed_hash_int, typed_eq_int)
+HASHMAP_DECLARE(bench_double_map, double, int, bench_hash_double, bench_eq_double)
+HASHMAP_DECLARE(bench_string_map, const char *, int, typed_hash_string, typed_eq_string)
+HASHMAP_DECLARE_PACKED(bench_packed_int_map, int, int, typed_hash_int, typed_eq_int)
 
-    for (int i = 0; i < NUMBER_OF_KEYS; i++) {
-        keys[i] = i;
-        values[i] = (rand() % (RANGE - 1) + 1);
+/* KEY GENERATION */
+
+typedef enum {
+    UNIFORM_KEYS, // distinct keys spread over the whole key space, looked up uniformly at random
+    ZIPFIAN_KEYS, // the same keys, but lookups follow a Zipf distribution so a few keys take most of the traffic
+    ADVERSARIAL_KEYS // keys whose raw hashes share their low bits: multiples of 64, integral doubles, long common prefixes
+} Key_distribution;
+
+static const char *distribution_names[] = {"uniform", "zipfian", "adversarial"};
+
+// a bijection on 32 bit integers (the murmur3 finalizer), so distinct indexes always give distinct keys
+static uint32_t bench_mix32(uint32_t x) {
+    x ^= x >> 16;
+    x *= 0x85ebca6bU;
+    x ^= x >> 13;
+    x *= 0xc2b2ae35U;
+    x ^= x >> 16;
+    return x;
+}
+
+// the splitmix64 finalizer, another bijection
+static uint64_t bench_mix64(uint64_t x) {
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+static uint64_t bench_random_state = 0x853c49e6748fea9bULL;
+
+static uint64_t bench_random(void) {
+    bench_random_state += 0x9e3779b97f4a7c15ULL;
+    return bench_mix64(bench_random_state);
+}
+
+// uniform in [0, 1)
+static double bench_random_unit(void) {
+    return (double)(bench_random() >> 11) * 0x1p-53;
+}
+
+/* the keys of one benchmark: 2n of them, where indexes below n are inserted and the rest are only used as misses. String
+   keys point into one pool so generating them does not disturb the heap measurement */
+typedef struct {
+    DATA_TYPE type;
+    size_t count;
+    Key *keys;
+    char *string_pool;
+} Bench_keys;
+
+static void generate_key(Bench_keys *keys, Key_distribution distribution, size_t index) {
+    Key *key = &(keys->keys[index]);
+    key->type = keys->type;
+    bool adversarial = (distribution == ADVERSARIAL_KEYS);
+    switch (keys->type) {
+        case INTEGER_TYPE:
+            key->data.integer = adversarial ? (int)(index << 6) : (int)bench_mix32((uint32_t)index);
+        break;
+        case DOUBLE_TYPE:
+            key->data.double_value = adversarial ? (double)index : (double)(bench_mix64(index) >> 11) * 0x1p-53;
+        break;
+        case STRING_TYPE:
+            key->data.string = keys->string_pool + index * BENCH_STRING_LENGTH;
+            if (adversarial) {
+                snprintf(key->data.string, BENCH_STRING_LENGTH, "tenant/00000000/session/00000000/user/%016zu", index);
+            } else {
+                snprintf(key->data.string, BENCH_STRING_LENGTH, "%016llx", (unsigned long long)bench_mix64(index));
+            }
+        break;
+        default:
+        break;
+    }
+}
+
+static bool generate_keys(Bench_keys *keys, DATA_TYPE type, Key_distribution distribution, size_t n) {
+    keys->type = type;
+    keys->count = 2 * n;
+    keys->keys = malloc(sizeof(Key) * keys->count);
+    keys->string_pool = (type == STRING_TYPE) ? malloc(keys->count * BENCH_STRING_LENGTH) : NULL;
+    if (keys->keys == NULL || (type == STRING_TYPE && keys->string_pool == NULL)) {
+        free(keys->keys);
+        free(keys->string_pool);
+        return false;
+    }
+    for (size_t i = 0; i < keys->count; i++) {
+        generate_key(keys, distribution, i);
+    }
+    return true;
+}
+
+static void free_keys(Bench_keys *keys) {
+    free(keys->keys);
+    free(keys->string_pool);
+}
+
+// a random permutation of [0, n): the insert and delete order
+static void shuffled_indexes(uint32_t *indexes, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        indexes[i] = (uint32_t)i;
     }
-    HashMap *map = hash_table_create(NUMBER_OF_KEYS, INTEGER_TYPE);
-    clock_t begin = clock();
-    
-    if (!hash_table_batch_insert(map, keys, values, NUMBER_OF_KEYS, INTEGER_TYPE, INTEGER_TYPE)) {
-        printf("error with insertion\n");
-        goto exit;
+    for (size_t i = n - 1; i > 0; i--) {
+        size_t j = bench_random() % (i + 1);
+        uint32_t swap = indexes[i];
+        indexes[i] = indexes[j];
+        indexes[j] = swap;
     }
-    clock_t end = clock();
-    double time_spent = (double)(end - begin) / CLOCKS_PER_SEC;
-    printf("operation took %.4lf seconds\n", time_spent);
+}
 
-    hash_table_info_print(map);
-    double total_time = (double)(end - start) / CLOCKS_PER_SEC;
-    printf("total time to setup, insert, and clean up is: %.4lf seconds\n", total_time);
-    exit:
-    hash_table_destroy(&map);
-    free(keys);
-    free(values);
+/* count lookup indexes in [0, n): uniform, or Zipf distributed using the generator of Gray et al. ("Quickly generating
+   billion-record synthetic databases"), where index 0 is the most popular */
+static void lookup_indexes(uint32_t *indexes, size_t count, size_t n, Key_distribution distribution) {
+    if (distribution != ZIPFIAN_KEYS) {
+        for (size_t i = 0; i < count; i++) {
+            indexes[i] = (uint32_t)(bench_random() % n);
+        }
+        return;
+    }
+    double zeta_n = 0;
+    for (size_t i = 1; i <= n; i++) {
+        zeta_n += 1.0 / pow((double)i, BENCH_ZIPF_THETA);
+    }
+    double zeta_2 = 1.0 + pow(0.5, BENCH_ZIPF_THETA);
+    double alpha = 1.0 / (1.0 - BENCH_ZIPF_THETA);
+    double eta = (1.0 - pow(2.0 / (double)n, 1.0 - BENCH_ZIPF_THETA)) / (1.0 - zeta_2 / zeta_n);
+    for (size_t i = 0; i < count; i++) {
+        double u = bench_random_unit();
+        double uz = u * zeta_n;
+        size_t index;
+        if (uz < 1.0) {
+            index = 0;
+        } else if (uz < zeta_2) {
+            index = 1;
+        } else {
+            index = (size_t)((double)n * pow(eta * u - eta + 1.0, alpha));
+        }
+        indexes[i] = (uint32_t)((index < n) ? index : n - 1);
+    }
+}
+
+/* TARGETS */
+
+// a map implementation under test. Every operation takes the generic Key so all targets run the exact same workload
+typedef struct Bench_target {
+    const char *name;
+    HashMap_options options; // generic HashMap targets only
+    void *(*create)(const struct Bench_target *target, DATA_TYPE key_type);
+    void (*destroy)(void *map);
+    bool (*insert)(void *map, const Key *key, int value); // adds the key or overwrites its value
+    bool (*lookup)(void *map, const Key *key); // true on a hit
+    bool (*remove)(void *map, const Key *key);
+    long long (*iterate)(void *map); // sums every value
+    bool int_keys_only; // skipped for the other key types
+} Bench_target;
+
+static void *generic_create(const Bench_target *target, DATA_TYPE key_type) {
+    return hash_table_create_with_options(16, key_type, &(target->options));
+}
+
+static void generic_destroy(void *map) {
+    HashMap *generic = (HashMap *)map;
+    hash_table_destroy(&generic);
+}
+
+static bool generic_insert(void *map, const Key *key, int value) {
+    Value generic_value = {.type = INTEGER_TYPE, .data.integer = value};
+    return hash_table_insert((HashMap *)map, key, &generic_value);
+}
+
+static bool generic_lookup(void *map, const Key *key) {
+    return hash_table_entry_lookup((HashMap *)map, key) != NULL;
+}
+
+static bool generic_remove(void *map, const Key *key) {
+    return hash_table_entry_delete((HashMap *)map, key);
+}
+
+static long long generic_iterate(void *map) {
+    long long sum = 0;
+    HashMap_iterator iterator;
+    hash_table_iter_init(&iterator, (HashMap *)map);
+    const Entry *entry;
+    while ((entry = hash_table_iter_next(&iterator)) != NULL) {
+        sum += entry->value.data.integer;
+    }
+    return sum;
+}
+
+// the typed maps are specialized per key type, so the target keeps which one it made
+typedef struct {
+    DATA_TYPE key_type;
+    void *map;
+} Typed_bench_map;
+
+/* defines the create/destroy/insert/lookup/remove/iterate functions of a typed map target, dispatching on the key type to
+   int_map, double_map and string_map (string_map may be NULL for maps without a string variant) */
+#define DEFINE_TYPED_TARGET(prefix, int_map, double_map, string_map) \
+    static void *prefix##_create(const Bench_target *target, DATA_TYPE key_type) { \
+        (void)target; \
+        Typed_bench_map *typed = malloc(sizeof(Typed_bench_map)); \
+        if (typed == NULL) { \
+            return NULL; \
+        } \
+        typed->key_type = key_type; \
+        typed->map = (key_type == INTEGER_TYPE) ? (void *)int_map##_create(16) : \
+            (key_type == DOUBLE_TYPE) ? (void *)double_map##_create(16) : (void *)string_map##_create(16); \
+        if (typed->map == NULL) { \
+            free(typed); \
+            return NULL; \
+        } \
+        return typed; \
+    } \
+    static void prefix##_destroy(void *map) { \
+        Typed_bench_map *typed = (Typed_bench_map *)map; \
+        if (typed->key_type == INTEGER_TYPE) { \
+            int_map *m = typed->map; \
+            int_map##_destroy(&m); \
+        } else if (typed->key_type == DOUBLE_TYPE) { \
+            double_map *m = typed->map; \
+            double_map##_destroy(&m); \
+        } else { \
+            string_map *m = typed->map; \
+            string_map##_destroy(&m); \
+        } \
+        free(typed); \
+    } \
+    static bool prefix##_insert(void *map, const Key *key, int value) { \
+        Typed_bench_map *typed = (Typed_bench_map *)map; \
+        switch (typed->key_type) { \
+            case INTEGER_TYPE: return int_map##_insert(typed->map, key->data.integer, value); \
+            case DOUBLE_TYPE: return double_map##_insert(typed->map, key->data.double_value, value); \
+            default: return string_map##_insert(typed->map, key->data.string, value); \
+        } \
+    } \
+    static bool prefix##_lookup(void *map, const Key *key) { \
+        Typed_bench_map *typed = (Typed_bench_map *)map; \
+        switch (typed->key_type) { \
+            case INTEGER_TYPE: return int_map##_lookup(typed->map, key->data.integer) != NULL; \
+            case DOUBLE_TYPE: return double_map##_lookup(typed->map, key->data.double_value) != NULL; \
+            default: return string_map##_lookup(typed->map, key->data.string) != NULL; \
+        } \
+    } \
+    static bool prefix##_remove(void *map, const Key *key) { \
+        Typed_bench_map *typed = (Typed_bench_map *)map; \
+        switch (typed->key_type) { \
+            case INTEGER_TYPE: return int_map##_delete(typed->map, key->data.integer); \
+            case DOUBLE_TYPE: return double_map##_delete(typed->map, key->data.double_value); \
+            default: return string_map##_delete(typed->map, key->data.string); \
+        } \
+    } \
+    static long long prefix##_iterate(void *map) { \
+        Typed_bench_map *typed = (Typed_bench_map *)map; \
+        long long sum = 0; \
+        size_t position = 0; \
+        int value; \
+        if (typed->key_type == INTEGER_TYPE) { \
+            int key; \
+            while (int_map##_next(typed->map, &position, &key, &value)) { \
+                sum += value; \
+            } \
+        } else if (typed->key_type == DOUBLE_TYPE) { \
+            double key; \
+            while (double_map##_next(typed->map, &position, &key, &value)) { \
+                sum += value; \
+            } \
+        } else { \
+            const char *key; \
+            while (string_map##_next(typed->map, &position, &key, &value)) { \
+                sum += value; \
+            } \
+        } \
+        return sum; \
+    }
+
+DEFINE_TYPED_TARGET(typed, bench_int_map, bench_double_map, bench_string_map)
+DEFINE_TYPED_TARGET(typed_packed, bench_packed_int_map, bench_double_map, bench_string_map) // only run with int keys
+
+#define GENERIC_TARGET(target_name, ...) {.name = target_name, .options = {__VA_ARGS__}, .create = generic_create, \
+    .destroy = generic_destroy, .insert = generic_insert, .lookup = generic_lookup, .remove = generic_remove, \
+    .iterate = generic_iterate}
+#define TYPED_TARGET(target_name, prefix, only_int_keys) {.name = target_name, .create = prefix##_create, \
+    .destroy = prefix##_destroy, .insert = prefix##_insert, .lookup = prefix##_lookup, .remove = prefix##_remove, \
+    .iterate = prefix##_iterate, .int_keys_only = only_int_keys}
+
+/* the typed maps stand in for the khash style baseline: they are the same open addressing design (a macro specialized
+   per key type, keys borrowed rather than copied). The packed variant only differs for int keys */
+static const Bench_target targets[] = {
+    GENERIC_TARGET("chaining", .storage_type = CHAINING_STORAGE),
+    GENERIC_TARGET("chaining slab pow2", .use_entry_slab = true, .power_of_two_buckets = true),
+    GENERIC_TARGET("chaining seeded", .seeded_hashing = true, .tree_bin_threshold = 8), // the hash flooding resistant mode
+    GENERIC_TARGET("linear pow2", .storage_type = LINEAR_PROBING_STORAGE, .power_of_two_buckets = true),
+    GENERIC_TARGET("robin hood", .storage_type = ROBIN_HOOD_STORAGE),
+    GENERIC_TARGET("swiss", .storage_type = SWISS_STORAGE),
+    TYPED_TARGET("typed", typed, false),
+    TYPED_TARGET("typed packed", typed_packed, true),
+};
+
+/* MEASUREMENT */
+
+static uint64_t now_nanoseconds(void) {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (uint64_t)time.tv_sec * 1000000000ULL + (uint64_t)time.tv_nsec;
+}
+
+static size_t heap_in_use(void) {
+#ifdef BENCH_HAVE_MALLINFO2
+    struct mallinfo2 info = mallinfo2();
+    return info.uordblks + info.hblkhd;
+#else
     return 0;
-}
\ No newline at end of file
+#endif
+}
+
+// the ns/op of every timed batch of one workload
+typedef struct {
+    double *samples;
+    size_t count;
+    size_t capacity;
+    uint64_t total_nanoseconds;
+    size_t operations;
+} Bench_samples;
+
+static void record_sample(Bench_samples *samples, uint64_t nanoseconds, size_t operations) {
+    samples->total_nanoseconds += nanoseconds;
+    samples->operations += operations;
+    if (samples->count == samples->capacity) {
+        size_t new_capacity = samples->capacity ? samples->capacity * 2 : 1024;
+        double *grown = realloc(samples->samples, sizeof(double) * new_capacity);
+        if (grown == NULL) {
+            return; // the mean still counts the batch
+        }
+        samples->samples = grown;
+        samples->capacity = new_capacity;
+    }
+    samples->samples[samples->count++] = (double)nanoseconds / (double)operations;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static double percentile(const Bench_samples *samples, double fraction) {
+    if (samples->count == 0) {
+        return 0;
+    }
+    size_t index = (size_t)(fraction * (double)(samples->count - 1) + 0.5);
+    return samples->samples[index];
+}
+
+typedef enum {
+    INSERT_WORKLOAD,
+    HIT_WORKLOAD,
+    MISS_WORKLOAD,
+    MIXED_WORKLOAD,
+    ITERATE_WORKLOAD,
+    DELETE_WORKLOAD,
+    WORKLOAD_COUNT
+} Workload;
+
+static const char *workload_names[] = {"insert", "lookup hit", "lookup miss", "mixed 90/10", "iterate", "delete"};
+
+/* runs operations [begin, end) of a workload. Insert and delete walk the shuffled order, lookups walk the lookup stream
+   (misses use the second half of the keys). Returns how many operations found or changed their key */
+static size_t run_operations(const Bench_target *target, void *map, Workload workload, const Bench_keys *keys,
+                             const uint32_t *order, size_t begin, size_t end) {
+    size_t n = keys->count / 2, matched = 0;
+    switch (workload) {
+        case INSERT_WORKLOAD:
+            for (size_t i = begin; i < end; i++) {
+                matched += target->insert(map, &(keys->keys[order[i]]), (int)i);
+            }
+        break;
+        case HIT_WORKLOAD:
+            for (size_t i = begin; i < end; i++) {
+                matched += target->lookup(map, &(keys->keys[order[i]]));
+            }
+        break;
+        case MISS_WORKLOAD:
+            for (size_t i = begin; i < end; i++) {
+                matched += target->lookup(map, &(keys->keys[n + order[i]]));
+            }
+        break;
+        case MIXED_WORKLOAD:
+            for (size_t i = begin; i < end; i++) {
+                if (i % 100 < BENCH_WRITE_PERCENT) {
+                    matched += target->insert(map, &(keys->keys[order[i]]), (int)i); // overwrites, the size stays n
+                } else {
+                    matched += target->lookup(map, &(keys->keys[order[i]]));
+                }
+            }
+        break;
+        case DELETE_WORKLOAD:
+            for (size_t i = begin; i < end; i++) {
+                matched += target->remove(map, &(keys->keys[order[i]]));
+            }
+        break;
+        default:
+        break;
+    }
+    return matched;
+}
+
+/* times count operations of a workload BENCH_BATCH at a time. Stops early (setting *gave_up) once the clock passes
+   deadline, so that a layout that degrades to linear probes on some key set does not stall the whole suite */
+static size_t time_operations(const Bench_target *target, void *map, Workload workload, const Bench_keys *keys,
+                              const uint32_t *order, size_t count, Bench_samples *samples, uint64_t deadline, bool *gave_up) {
+    size_t matched = 0;
+    for (size_t begin = 0; begin < count && !*gave_up; begin += BENCH_BATCH) {
+        size_t end = (count - begin < BENCH_BATCH) ? count : begin + BENCH_BATCH;
+        uint64_t start = now_nanoseconds();
+        matched += run_operations(target, map, workload, keys, order, begin, end);
+        uint64_t finish = now_nanoseconds();
+        record_sample(samples, finish - start, end - begin);
+        *gave_up = (finish > deadline);
+    }
+    return matched;
+}
+
+/* runs every workload on one target, key set and size, and prints a row per workload. Small maps are rebuilt (and their
+   lookups repeated) until at least BENCH_MIN_OPERATIONS operations of each workload were timed. Returns false if the
+   target gave wrong results */
+static bool benchmark_target(const Bench_target *target, const Bench_keys *keys, Key_distribution distribution,
+                             const uint32_t *insert_order, const uint32_t *lookup_order, size_t lookup_count) {
+    size_t n = keys->count / 2;
+    size_t rounds = (n < BENCH_MIN_OPERATIONS) ? BENCH_MIN_OPERATIONS / n : 1;
+    size_t passes = (n * BENCH_MIN_ITERATION_PASSES < BENCH_MIN_OPERATIONS) ? BENCH_MIN_OPERATIONS / n : BENCH_MIN_ITERATION_PASSES;
+    size_t lookup_rounds = (lookup_count < BENCH_MIN_OPERATIONS) ? BENCH_MIN_OPERATIONS / lookup_count : 1;
+    uint64_t deadline = now_nanoseconds() + (uint64_t)(BENCH_TIME_LIMIT_SECONDS * 1e9);
+    Bench_samples samples[WORKLOAD_COUNT] = {0};
+    size_t bytes = 0;
+    bool correct = true, gave_up = false;
+    for (size_t round = 0; round < rounds && correct && !gave_up; round++) {
+        size_t heap_before = heap_in_use();
+        void *map = target->create(target, keys->type);
+        if (map == NULL) {
+            printf("could not create the %s map\n", target->name);
+            return false;
+        }
+        size_t matched = time_operations(target, map, INSERT_WORKLOAD, keys, insert_order, n, &samples[INSERT_WORKLOAD], deadline, &gave_up);
+        correct = gave_up || matched == n;
+        if (round == rounds - 1) {
+            bytes = heap_in_use() - heap_before;
+            // the lookups run on the last build only, with as many passes over the lookup stream as small maps need
+            for (size_t i = 0; i < lookup_rounds && correct && !gave_up; i++) {
+                matched = time_operations(target, map, HIT_WORKLOAD, keys, lookup_order, lookup_count, &samples[HIT_WORKLOAD], deadline, &gave_up);
+                correct = gave_up || matched == lookup_count;
+                matched = time_operations(target, map, MISS_WORKLOAD, keys, lookup_order, lookup_count, &samples[MISS_WORKLOAD], deadline, &gave_up);
+                correct = correct && (gave_up || matched == 0);
+                matched = time_operations(target, map, MIXED_WORKLOAD, keys, lookup_order, lookup_count, &samples[MIXED_WORKLOAD], deadline, &gave_up);
+                correct = correct && (gave_up || matched == lookup_count);
+            }
+            for (size_t pass = 0; pass < passes && !gave_up; pass++) {
+                uint64_t start = now_nanoseconds();
+                volatile long long sum = target->iterate(map);
+                (void)sum;
+                record_sample(&samples[ITERATE_WORKLOAD], now_nanoseconds() - start, n);
+            }
+        }
+        if (correct && !gave_up) {
+            matched = time_operations(target, map, DELETE_WORKLOAD, keys, insert_order, n, &samples[DELETE_WORKLOAD], deadline, &gave_up);
+            correct = gave_up || matched == n;
+        }
+        target->destroy(map);
+    }
+    const char *key_name = (keys->type == INTEGER_TYPE) ? "int" : (keys->type == DOUBLE_TYPE) ? "double" : "string";
+    if (!correct) {
+        printf("%s returned wrong results!\n", target->name);
+    }
+    for (int workload = 0; workload < WORKLOAD_COUNT; workload++) {
+        Bench_samples *s = &samples[workload];
+        if (s->operations != 0) {
+            qsort(s->samples, s->count, sizeof(double), compare_doubles);
+            printf("%-18s %-7s %-12s %9zu %-12s %8.1f %8.1f %8.1f %8.1f", target->name, key_name,
+                   distribution_names[distribution], n, workload_names[workload],
+                   (double)s->total_nanoseconds / (double)s->operations, percentile(s, 0.5), percentile(s, 0.9),
+                   percentile(s, 0.99));
+            if (workload == INSERT_WORKLOAD && bytes != 0) {
+                printf(" %10.1f", (double)bytes / (double)n);
+            }
+            printf("\n");
+        }
+        free(s->samples);
+    }
+    if (gave_up) {
+        printf("%-18s %-7s %-12s %9zu gave up after %.0f seconds\n", target->name, key_name, distribution_names[distribution],
+               n, BENCH_TIME_LIMIT_SECONDS);
+    }
+    return correct;
+}
+
+// the number of keys that overflows the last level cache twice over (the cache size is a guess where sysconf() can't tell)
+static size_t keys_beyond_last_level_cache(void) {
+    long cache_size = 0;
+#ifdef _SC_LEVEL3_CACHE_SIZE
+    cache_size = sysconf(_SC_LEVEL3_CACHE_SIZE);
+    if (cache_size <= 0) {
+        cache_size = sysconf(_SC_LEVEL2_CACHE_SIZE);
+    }
+#endif
+    if (cache_size <= 0) {
+        cache_size = 32L * 1024 * 1024;
+    }
+    size_t keys = 2 * (size_t)cache_size / sizeof(Entry);
+    return (keys < 1000000) ? 1000000 : keys;
+}
+
+int main(int argc, char **argv) {
+    size_t largest = (argc > 1) ? (size_t)strtoull(argv[1], NULL, 10) : keys_beyond_last_level_cache();
+    const char *filter = (argc > 2) ? argv[2] : NULL;
+    if (largest == 0 || largest > BENCH_MAX_KEYS) {
+        printf("usage: %s [largest size, at most %zu] [target filter]\n", argv[0], BENCH_MAX_KEYS);
+        return 1;
+    }
+    // ~L1 resident, ~L2 resident, ~LLC resident, beyond the LLC (entries are about sizeof(Entry) bytes each)
+    size_t sizes[] = {512, 16384, 262144, largest};
+    size_t size_count = sizeof(sizes) / sizeof(sizes[0]);
+    DATA_TYPE key_types[] = {INTEGER_TYPE, DOUBLE_TYPE, STRING_TYPE};
+    printf("batch size %d ops, mixed workload %d%% writes, Zipf theta %.2f\n", BENCH_BATCH, BENCH_WRITE_PERCENT, BENCH_ZIPF_THETA);
+#ifndef BENCH_HAVE_MALLINFO2
+    printf("bytes/entry needs mallinfo2() (glibc 2.33 or later), so it is left out\n");
+#endif
+    printf("%-18s %-7s %-12s %9s %-12s %8s %8s %8s %8s %10s\n", "target", "key", "keys", "size", "workload", "mean ns",
+           "p50", "p90", "p99", "bytes/entry");
+    uint64_t start = now_nanoseconds();
+    bool correct = true;
+    size_t previous = 0;
+    for (size_t s = 0; s < size_count; s++) {
+        size_t n = sizes[s];
+        if (n > largest || n <= previous) {
+            continue;
+        }
+        previous = n;
+        size_t lookup_count = n;
+        uint32_t *insert_order = malloc(sizeof(uint32_t) * n);
+        uint32_t *lookup_order = malloc(sizeof(uint32_t) * lookup_count);
+        if (insert_order == NULL || lookup_order == NULL) {
+            printf("could not allocate the key orders for %zu keys\n", n);
+            free(insert_order);
+            free(lookup_order);
+            return 1;
+        }
+        shuffled_indexes(insert_order, n);
+        for (size_t t = 0; t < sizeof(key_types) / sizeof(key_types[0]); t++) {
+            for (int distribution = UNIFORM_KEYS; distribution <= ADVERSARIAL_KEYS; distribution++) {
+                Bench_keys keys;
+                if (!generate_keys(&keys, key_types[t], distribution, n)) {
+                    printf("could not allocate %zu keys\n", 2 * n);
+                    continue;
+                }
+                lookup_indexes(lookup_order, lookup_count, n, distribution);
+                for (size_t i = 0; i < sizeof(targets) / sizeof(targets[0]); i++) {
+                    if (targets[i].int_keys_only && key_types[t] != INTEGER_TYPE) {
+                        continue;
+                    }
+                    if (filter == NULL || strstr(targets[i].name, filter) != NULL) {
+                        correct = benchmark_target(&targets[i], &keys, distribution, insert_order, lookup_order, lookup_count) && correct;
+                    }
+                }
+                free_keys(&keys);
+            }
+        }
+        free(insert_order);
+        free(lookup_order);
+    }
+    printf("total time: %.2f seconds\n", (double)(now_nanoseconds() - start) / 1e9);
+    return correct ? 0 : 1;
+}
@@ -0,0 +1,272 @@
+
+#ifndef TYPED_HASHMAP_H
+#define TYPED_HASHMAP_H
+
+/* Compile time specialized maps for callers who know their key and value types up front.
+*  HASHMAP_DECLARE(name, KeyT, ValT, hash_fn, eq_fn) emits a map type called name and static inline name_* functions
+*  for it. Keys and values are stored unboxed in one flat open addressing slot array next to their cached hash (no Key/Value
+*  tagged unions, no function pointers, no type checks), so the compiler can inline hash_fn and eq_fn into every probe.
+*  hash_fn takes a KeyT and returns a size_t, eq_fn takes two KeyTs and returns true if they are equal (both may be macros).
+*  The map copies keys and values bit for bit and never owns anything they point to: a string keyed map keeps the caller's
+*  char pointers, which must stay valid for as long as they are in the map.
+*  HASHMAP_DECLARE_PACKED() takes the same arguments but leaves the hash out of the slots, so keys and values are packed at
+*  their natural size with no per entry overhead beyond one bit.
+*
+*  HASHMAP_DECLARE(int_map, int, int, typed_hash_int, typed_eq_int)
+*  int_map *map = int_map_create(16);
+*  int_map_insert(map, 7, 49);
+*  int *value = int_map_lookup(map, 7);
+*  int_map_destroy(&map);
+*/
+
+#include "hashmap.h"
+
+#define TYPED_MAP_MIN_CAPACITY 8
+#define TYPED_MAP_OCCUPIED ((size_t)1 << (sizeof(size_t) * 8 - 1)) // set in the cached hash of every used slot (0 means empty)
+
+// ready made hash/equality functions for the common key types
+static inline size_t typed_hash_int(int key) {
+    return (size_t)(unsigned int)key;
+}
+
+static inline bool typed_eq_int(int a, int b) {
+    return a == b;
+}
+
+static inline size_t typed_hash_string(const char *key) {
+    return hash_bytes(key, strlen(key));
+}
+
+static inline bool typed_eq_string(const char *a, const char *b) {
+    return a == b || strcmp(a, b) == 0;
+}
+
+/* The two slot layouts. Cached slots keep the hash next to the key, so probes compare hashes before calling eq_fn and
+   growing never calls hash_fn. Packed slots hold nothing but the key and value at their natural size (8 bytes for
+   int -> int) and mark used slots in a separate bitmap; hashes are recomputed where needed, which only pays off for cheap
+   hash_fns. Each layout gives the slot fields and how to test, mark, clear and hash a slot */
+#define TYPED_MAP_CACHED_SLOT_FIELDS size_t hash; /* mix_hash() of hash_fn(key) with TYPED_MAP_OCCUPIED set, 0 if empty */
+#define TYPED_MAP_CACHED_USED(map, index) ((map)->slots[index].hash != 0)
+#define TYPED_MAP_CACHED_MARK(map, index, full_hash) ((map)->slots[index].hash = (full_hash))
+#define TYPED_MAP_CACHED_UNMARK(map, index) ((map)->slots[index].hash = 0)
+#define TYPED_MAP_CACHED_SLOT_HASH(map, index, hash_of) ((map)->slots[index].hash)
+#define TYPED_MAP_CACHED_MATCH(map, index, full_hash, eq_fn, key_to_match) \
+    ((map)->slots[index].hash == (full_hash) && eq_fn((map)->slots[index].key, key_to_match))
+#define TYPED_MAP_CACHED_USES_BITMAP false
+
+#define TYPED_MAP_PACKED_SLOT_FIELDS
+#define TYPED_MAP_PACKED_USED(map, index) ((((map)->occupied[(index) >> 6]) >> ((index) & 63)) & 1)
+#define TYPED_MAP_PACKED_MARK(map, index, full_hash) ((map)->occupied[(index) >> 6] |= (uint64_t)1 << ((index) & 63))
+#define TYPED_MAP_PACKED_UNMARK(map, index) ((map)->occupied[(index) >> 6] &= ~((uint64_t)1 << ((index) & 63)))
+#define TYPED_MAP_PACKED_SLOT_HASH(map, index, hash_of) hash_of((map)->slots[index].key)
+#define TYPED_MAP_PACKED_MATCH(map, index, full_hash, eq_fn, key_to_match) eq_fn((map)->slots[index].key, key_to_match)
+#define TYPED_MAP_PACKED_USES_BITMAP true
+
+/* a map whose slots cache the key's hash (16 bytes per slot for int -> int). The right choice for string keys or any
+   key with an expensive hash_fn or eq_fn */
+#define HASHMAP_DECLARE(name, KeyT, ValT, hash_fn, eq_fn) TYPED_MAP_GENERATE(name, KeyT, ValT, hash_fn, eq_fn, TYPED_MAP_CACHED)
+
+/* a map whose slots are nothing but the key and value (8 bytes per slot for int -> int, plus 1 bit of bitmap). Use it for
+   huge maps of small keys whose hash_fn and eq_fn cost next to nothing */
+#define HASHMAP_DECLARE_PACKED(name, KeyT, ValT, hash_fn, eq_fn) TYPED_MAP_GENERATE(name, KeyT, ValT, hash_fn, eq_fn, TYPED_MAP_PACKED)
+
+/* Slots are probed linearly in a power of 2 array kept at most 3/4 full. Deletes shift the following slots back instead of
+   leaving tombstones, so probes stay short whatever the mix of operations. The array grows but never shrinks (call
+   name_clear() or recreate the map to give memory back). Pointers returned by name_lookup() and name_get_or_insert() are
+   invalidated by inserts and deletes */
+#define TYPED_MAP_GENERATE(name, KeyT, ValT, hash_fn, eq_fn, layout) \
+    typedef struct { \
+        layout##_SLOT_FIELDS \
+        KeyT key; \
+        ValT value; \
+    } name##_slot; \
+    \
+    typedef struct { \
+        name##_slot *slots; \
+        uint64_t *occupied; /* one bit per slot (packed layout only) */ \
+        size_t capacity; /* always a power of 2 */ \
+        size_t count; \
+    } name; \
+    \
+    static inline size_t name##_hash(KeyT key) { \
+        return mix_hash(hash_fn(key)) | TYPED_MAP_OCCUPIED; \
+    } \
+    \
+    /* gives the map empty arrays for capacity slots. False (and the map untouched) on failure */ \
+    static inline bool name##_allocate(name *map, size_t capacity) { \
+        name##_slot *slots = calloc(capacity, sizeof(name##_slot)); \
+        uint64_t *occupied = layout##_USES_BITMAP ? calloc((capacity + 63) / 64, sizeof(uint64_t)) : NULL; \
+        if (slots == NULL || (layout##_USES_BITMAP && occupied == NULL)) { \
+            perror("Could not calloc the slots of a " #name "!\n"); \
+            free(slots); \
+            free(occupied); \
+            return false; \
+        } \
+        map->slots = slots; \
+        map->occupied = occupied; \
+        map->capacity = capacity; \
+        return true; \
+    } \
+    \
+    /* creates a map that can hold about capacity keys before growing. NULL on failure */ \
+    static inline name *name##_create(size_t capacity) { \
+        name *map = malloc(sizeof(name)); \
+        if (map == NULL) { \
+            perror("Could not malloc the map in " #name "_create()!\n"); \
+            return NULL; \
+        } \
+        map->count = 0; \
+        if (!name##_allocate(map, power_of_two_bucket_count(capacity + capacity / 3 + 1, true, TYPED_MAP_MIN_CAPACITY))) { \
+            free(map); \
+            return NULL; \
+        } \
+        return map; \
+    } \
+    \
+    /* frees the map (not what its keys or values point to) and sets the original pointer to NULL */ \
+    static inline void name##_destroy(name **map) { \
+        if (map == NULL || *map == NULL) { \
+            return; \
+        } \
+        free((*map)->slots); \
+        free((*map)->occupied); \
+        free(*map); \
+        *map = NULL; \
+    } \
+    \
+    /* index of the key's slot, or capacity if it is not in the map */ \
+    static inline size_t name##_find(const name *map, KeyT key, size_t hash) { \
+        size_t mask = map->capacity - 1; \
+        for (size_t index = hash & mask;; index = (index + 1) & mask) { \
+            if (!layout##_USED(map, index)) { \
+                return map->capacity; \
+            } \
+            if (layout##_MATCH(map, index, hash, eq_fn, key)) { \
+                return index; \
+            } \
+        } \
+    } \
+    \
+    /* pointer to the key's value inside the map, or NULL if the key is not in it */ \
+    static inline ValT *name##_lookup(const name *map, KeyT key) { \
+        size_t index = name##_find(map, key, name##_hash(key)); \
+        return (index == map->capacity) ? NULL : &(map->slots[index].value); \
+    } \
+    \
+    static inline bool name##_contains(const name *map, KeyT key) { \
+        return name##_find(map, key, name##_hash(key)) != map->capacity; \
+    } \
+    \
+    /* moves every slot into new arrays of new_capacity (a power of 2) */ \
+    static inline bool name##_rehash(name *map, size_t new_capacity) { \
+        name grown = {.count = map->count}; \
+        if (!name##_allocate(&grown, new_capacity)) { \
+            return false; \
+        } \
+        size_t mask = new_capacity - 1; \
+        for (size_t i = 0; i < map->capacity; i++) { \
+            if (layout##_USED(map, i)) { \
+                size_t hash = layout##_SLOT_HASH(map, i, name##_hash); \
+                size_t index = hash & mask; \
+                while (layout##_USED(&grown, index)) { \
+                    index = (index + 1) & mask; \
+                } \
+                grown.slots[index] = map->slots[i]; \
+                layout##_MARK(&grown, index, hash); \
+            } \
+        } \
+        free(map->slots); \
+        free(map->occupied); \
+        *map = grown; \
+        return true; \
+    } \
+    \
+    /* pointer to the key's value inside the map, inserting the key with default_value first if it is missing (*inserted, \
+       unless NULL, says which happened). Hashes and probes once, so map[key] += 1 style loops cost a single lookup. \
+       NULL if the map could not grow */ \
+    static inline ValT *name##_get_or_insert(name *map, KeyT key, ValT default_value, bool *inserted) { \
+        size_t hash = name##_hash(key); \
+        size_t index = name##_find(map, key, hash); \
+        if (inserted != NULL) { \
+            *inserted = (index == map->capacity); \
+        } \
+        if (index != map->capacity) { \
+            return &(map->slots[index].value); \
+        } \
+        if ((map->count + 1) * 4 > map->capacity * 3 && !name##_rehash(map, map->capacity * 2)) { \
+            return NULL; \
+        } \
+        size_t mask = map->capacity - 1; \
+        for (index = hash & mask; layout##_USED(map, index); index = (index + 1) & mask) { \
+        } \
+        map->slots[index].key = key; \
+        map->slots[index].value = default_value; \
+        layout##_MARK(map, index, hash); \
+        (map->count)++; \
+        return &(map->slots[index].value); \
+    } \
+    \
+    /* inserts the key with the value, or replaces the value if the key is already there. True on success */ \
+    static inline bool name##_insert(name *map, KeyT key, ValT value) { \
+        ValT *slot = name##_get_or_insert(map, key, value, NULL); \
+        if (slot == NULL) { \
+            return false; \
+        } \
+        *slot = value; \
+        return true; \
+    } \
+    \
+    /* removes the key. True if it was in the map */ \
+    static inline bool name##_delete(name *map, KeyT key) { \
+        size_t hole = name##_find(map, key, name##_hash(key)); \
+        if (hole == map->capacity) { \
+            return false; \
+        } \
+        size_t mask = map->capacity - 1; \
+        /* pull back every following slot that may sit in the hole, so no probe sequence is cut short */ \
+        for (size_t index = (hole + 1) & mask; layout##_USED(map, index); index = (index + 1) & mask) { \
+            size_t hash = layout##_SLOT_HASH(map, index, name##_hash); \
+            size_t home = hash & mask; \
+            if (((index - home) & mask) >= ((index - hole) & mask)) { \
+                map->slots[hole] = map->slots[index]; \
+                layout##_MARK(map, hole, hash); \
+                hole = index; \
+            } \
+        } \
+        layout##_UNMARK(map, hole); \
+        (map->count)--; \
+        return true; \
+    } \
+    \
+    static inline size_t name##_count(const name *map) { \
+        return map->count; \
+    } \
+    \
+    /* removes every key, keeping the current capacity */ \
+    static inline void name##_clear(name *map) { \
+        memset(map->slots, 0, map->capacity * sizeof(name##_slot)); \
+        if (map->occupied != NULL) { \
+            memset(map->occupied, 0, ((map->capacity + 63) / 64) * sizeof(uint64_t)); \
+        } \
+        map->count = 0; \
+    } \
+    \
+    /* bytes of memory the map uses, not counting what its keys and values point to */ \
+    static inline size_t name##_memory_usage(const name *map) { \
+        return sizeof(name) + map->capacity * sizeof(name##_slot) + (map->occupied ? ((map->capacity + 63) / 64) * sizeof(uint64_t) : 0); \
+    } \
+    \
+    /* iteration: start with *position = 0 and call until it returns false. Inserts and deletes invalidate the position */ \
+    static inline bool name##_next(const name *map, size_t *position, KeyT *key_out, ValT *value_out) { \
+        for (; *position < map->capacity; (*position)++) { \
+            if (layout##_USED(map, *position)) { \
+                *key_out = map->slots[*position].key; \
+                *value_out = map->slots[*position].value; \
+                (*position)++; \
+                return true; \
+            } \
+        } \
+        return false; \
+    }
+
+#endif /* TYPED_HASHMAP_H */